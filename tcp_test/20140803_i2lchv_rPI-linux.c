@@ -13,13 +13,163 @@
  * Command format (upper or lower case can be used):
  *
  * 27-Jul-2014: Increased delay USCHAR from 260 to 400 uS due to some empty response from module
- * 03-Aug-2014: Modified 'msgget()' to continue loop if no response. Set back delay USCHAR to 260 from 400 uS. 
+ * 03-Aug-2014: Modified 'msgget()' to continue loop if no response. Set back delay USCHAR to 260 from 400 uS.
+ * 17-Oct-2026: 'msgget()' now blocks in poll() on the serial port and returns as soon as the
+ *              CR/LF terminator arrives. The old fixed-wait reader is kept as 'msgget_fixed()' (-w).
+ *              Added bus latency benchmark (-b N).
+ * 17-Oct-2026: ATTN* can be waited for as a rising edge from the GPIO character device (default),
+ *              with the mmap'd register sampling as fallback, or on an eventfd fake line (-a, -B N).
+ * 17-Oct-2026: Connections are handled by threads instead of forked processes. A single bus thread
+ *              owns the UART and ATTN line and executes queued transactions one at a time,
+ *              so concurrent clients can no longer interleave module transactions.
+ * 17-Oct-2026: One epoll event loop serves all connections (no thread or process per client).
+ *              Each connection has its own input buffer and output queue.
+ * 17-Oct-2026: Input is split into lines (CR, LF or CR-LF) across reads; every complete line is
+ *              executed and clients may pipeline up to nPIPE commands. Responses keep request order.
+ * 17-Oct-2026: Value cache per logic unit/property/channel, fed by every RC, DMP and PSUM response
+ *              and invalidated by LD (and any other write). Reads with a max-age (@ms prefix or
+ *              _MAXAGE) are answered from it when the data is fresh enough. Commands are parsed
+ *              in the event loop (cmdParse) and only executed by the bus thread (cmdEXE).
+ * 17-Oct-2026: Background refresher thread sweeps PSUM over all logic units every -r MS and re-reads
+ *              (RC) only the properties whose change counter moved, keeping the value cache fresh.
+ * 17-Oct-2026: ID, PROP and the ATTR of every property are read for each logic unit at discovery
+ *              and kept in the LUnit; these commands are answered from memory without the bus.
+ * 17-Oct-2026: The logic unit table and module metadata are saved to a topology file (-t). At start
+ *              the file is loaded and the server is up at once; every slot is then probed again by
+ *              the bus thread in the background and the table patched where the crate changed.
+ * 17-Oct-2026: Hot-plug: slots without logic unit are rescanned every -s SEC and _RESCAN probes all
+ *              slots on request. Probes run at low priority on the bus, clients stay connected.
+ * 17-Oct-2026: Bus scheduler with priority classes SAFETY (HVON/HVOFF), IWRITE, IREAD, POLL (refresher)
+ *              and DISC (slot probes), each with an optional deadline (-D). A lower class head that
+ *              would miss its deadline goes first; the cost of a transaction is estimated from its
+ *              length * USCHAR plus the average ATTN* wait. _BUS shows per class statistics.
+ * 17-Oct-2026: Identical module reads share one bus transaction while it is queued or on the bus;
+ *              a write to the logic unit seals the reads queued before it.
+ * 17-Oct-2026: Batch reads: _ALL runs a read on every logic unit, _RCL reads a list of properties of
+ *              one logic unit. One request, one framed multi-line response.
+ * 17-Oct-2026: Binary protocol on port 24743 (length-prefixed frames, numeric opcodes, packed
+ *              float/int values) next to the text protocol. Values from the cache are packed
+ *              without going through text.
+ * 17-Oct-2026: Change subscriptions: _SUB registers a property/channel range of a logic unit and the
+ *              server pushes the channels that moved by more than a deadband (the ATTR precision by
+ *              default) whenever the value cache changes. Fed by the refresher, no extra bus traffic.
+ * 17-Oct-2026: The crate state (logic units, channel values with read times, PSUM counters) is
+ *              published in a shared-memory file (-m) with a seqlock per logic unit; local programs
+ *              read it with hvpi_shm.h instead of a connection.
+ * 17-Oct-2026: Latency histograms of every stage of a module transaction per verb and slot, counters
+ *              of msgget() outcomes and error codes (_STATS, SIGUSR1). Atomic counters, no lock.
+ * 17-Oct-2026: Run-time messages go through a lock-free ring of binary records (time, slot, verb,
+ *              status, duration) that a log thread formats and writes out in batches; a full ring
+ *              drops and counts records instead of stalling the bus. Levels -v, output -L.
+ * 17-Oct-2026: Serial device (-d) and GPIO register file (-g) can be given, to run against the
+ *              i2lchv_sim crate simulator on a pty.
+ * 17-Oct-2026: All time goes through usnow()/clkSLEEP(); the virtual clock (-V) turns sleeps and
+ *              timeouts into jumps of simulated time, shared with i2lchv_sim through the GPIO file.
+ *              Serial reads wait on the simulator's frame and character counts, not on the wall clock.
+ * 17-Oct-2026: Traffic capture (-C): requests, responses, UART frames and ATTN* waits are appended
+ *              to a binary file by a capture thread, to be replayed with i2lchv_replay.
+ * 17-Oct-2026: Circuit breaker per slot (-k): a module that gives no handshake, ATTN* or response,
+ *              or answers NAK, several times in a row is marked degraded. Its reads are answered
+ *              from the value cache marked STALE, other commands fail at once instead of each
+ *              waiting out the timeouts, and one trial transaction per probe interval tells when
+ *              it is back. _HEALTH. A NAK or a handshake out of place is an error (ABNORMAL-13..15),
+ *              no longer NORMAL, and a module that NAKs or misses ATTN* is drained.
  *
  * SLOT# SUBMODULE# module-cmd-syntax		(high-voltage module command )
  * _Q        								(quit)
  * _LL     								(prints summary of module/submodle found)
  * _CLI      								(clears the output buffers of all HV modules)
+ * _BUS      								(bus queue statistics: transactions, queue depth, average
+ *                                          queue wait & bus time [ms], transactions/s, % bus busy;
+ *                                          then one CLASS line per scheduling class: depth, transactions,
+ *                                          average & max queue wait [ms], deadline misses, deadline [ms];
+ *                                          SCHED line: average ATTN* wait [ms], reordered transactions,
+ *                                          reads that shared a transaction, shared reads sealed by writes)
+ * @MS SLOT# SUBMODULE# RC|DMP|PSUM ...	(answer from the value cache if every value in the
+ *                                          response was read from the module less than MS ms ago)
+ * _MAXAGE [MS]							(default max-age of this connection for RC/DMP/PSUM,
+ *                                          0 = always read the module (default))
+ * _ALL module-cmd-syntax					(batch: the read command on every logic unit, e.g. _ALL RC MV)
+ * _RCL SLOT# SUBMODULE# PROP [PROP ...]	(batch: RC of each property of one logic unit)
+ *                                          A batch answers "BATCH n" followed by n module responses
+ *                                          in request order ("? SLOT# SUBMODULE#" for a failed one);
+ *                                          the @MS prefix and _MAXAGE apply to every read
+ * _SUB [SLOT# SUBMODULE# PROP [FIRST [LAST [DEADBAND]]]]
+ *                                          (subscribe to changes of channels FIRST..LAST (default all)
+ *                                          of property PROP; a change of at least DEADBAND (default one
+ *                                          digit of the ATTR precision) is pushed as a line
+ *                                          "! SLOT# SUBMODULE# PROP CH VALUE [CH VALUE ...]" between
+ *                                          responses. Values come from the value cache, kept fresh by
+ *                                          the refresher (-r). _SUB alone lists the subscriptions)
+ * _UNSUB [SLOT# SUBMODULE# PROP]			(drop a subscription, or all of them)
+ * _STATS [VERB|SLOT#|CLEAR]				(latency statistics in us of the stages of module transactions:
+ *                                          PARSE, QUEUE, TX, HNDSHK, ATTN, ACK, RSP and EXE (the whole bus
+ *                                          part) with count, average, 50/90/99 percentiles & max; msgget()
+ *                                          outcomes, error codes and one line per slot. With a verb (RC, DMP,
+ *                                          PSUM, LD, HVON, HVOFF, ID, PROP, ATTR, OTHER) or SLOT# the stages
+ *                                          of those commands only; CLEAR resets. kill -USR1 prints _STATS
+ *                                          to the log)
+ * _RESCAN [SLOT#]							(probe all slots, or SLOT#, in the background and update the
+ *                                          logic unit table; shows rescans, probes & table changes)
+ * _CACHE    								(value cache statistics: hits, misses, stored responses,
+ *                                          invalidations, ID/PROP/ATTR answered from memory,
+ *                                          refresher sweeps, PSUM & RC reads)
+ * _HEALTH   								(circuit breaker: failures to trip & ms between trials, then
+ *                                          per slot OK|DEGRADED|TRIAL, failures in a row, trips, trials,
+ *                                          commands failed at once, stale answers, ms since the module
+ *                                          last answered. While a slot is degraded, RC/DMP/PSUM are
+ *                                          answered from the cache with " STALE MS" (age of the oldest
+ *                                          value) added, other commands answer "?")
  *
+ * Binary protocol (port# 24743): frames of little-endian fields, pipelined like text commands,
+ * responses in request order. LU = SLOT# * 2 + SUBMODULE#, PROP = index of the property in the
+ * PROP response of the logic unit.
+ *   request  : u16 length (whole frame), u16 request-id, u8 opcode, u8 LU, u8 PROP, u8 first channel,
+ *              u16 max-age ms (cache, 0 = read the module), u16 n, then the payload
+ *   response : u16 length (whole frame), u16 request-id, u8 opcode, u8 status, u8 LU, u8 PROP,
+ *              u8 format (0 none, 1 float32, 2 u16, 3 u8, 4 text, 5 channel+float32), u8 0, u16 n,
+ *              then n values
+ *   opcodes  : 1 RC PROP -> float32[channels]   2 DMP channel -> float32[properties]
+ *              3 PSUM -> u16[words]              4 LD PROP from first channel, payload float32[n]
+ *                                                (finite, |value| < 1e6)
+ *              5 HVON    6 HVOFF                 7 module-cmd-syntax as text payload -> text
+ *              8 logic units present -> u8[LU]
+ *              9 subscribe PROP, channels first..first+n-1 (n = 0: to the last), optional payload
+ *                float32 deadband; changes are pushed as opcode 11 frames with the request-id of the
+ *                subscription, format 5: n x (u8 channel, float32 value)
+ *              10 unsubscribe PROP (LU 255: all)
+ *   status   : 0 OK, 1 bad request, 2 no such logic unit, 3 no such property, 4 module or bus error
+ *              (text payload: module response), 5 unknown opcode, 6 OK but the values are from the
+ *              cache because the module is degraded (see _HEALTH)
+ *
+ * Command line options:
+ *  -w        use the old fixed-wait serial reader (sleep USCHAR*nchar before every read)
+ *  -b N      after discovery, time N transactions of each command type on every logic unit
+ *            with the fixed-wait and the event-driven reader, print the table and exit
+ *  -a MODE   ATTN* backend: cdev (GPIO character device edge events, default),
+ *            mmap (sample /dev/mem GPIO registers every 5 ms) or fake (eventfd stand-in line)
+ *  -B N      time N ATTN waits on the fake line with 5 ms sampling and with edge events, then exit
+ *  -r MS     refresher sweep period in ms (default 1000, 0 = no background refresher)
+ *  -t FILE   topology file (default /var/tmp/i2lchv.topo, "-" = always run full discovery);
+ *            delete it to force a full discovery at the next start
+ *  -s SEC    rescan slots without logic unit every SEC seconds (default 30, 0 = only _RESCAN)
+ *  -D MS,..  queue deadlines of the classes SAFETY,IWRITE,IREAD,POLL,DISC in ms, 0 = none
+ *            (default 50,250,1000,0,0)
+ *  -m FILE   shared-memory file the crate state is published in for local readers, see hvpi_shm.h
+ *            (default /dev/shm/hvpi_crate, "-" = none)
+ *  -v LEVEL  log level: 0 errors, 1 also events (default), 2 also every command, response and
+ *            module transaction with its status and duration
+ *  -L FILE   append the log to FILE (default "-" = stdout)
+ *  -d DEV    serial device of the crate (default /dev/ttyAMA0; the pty of i2lchv_sim)
+ *  -g FILE   map FILE as the GPIO registers instead of /dev/mem (implies -a mmap), e.g. the
+ *            ATTN* line of i2lchv_sim
+ *  -V        virtual clock, with i2lchv_sim -V: time jumps ahead whenever the bus, refresher and
+ *            topology threads all wait (for the UART, ATTN*, the next sweep or rescan), so
+ *            sleeps and timeouts take no wall time and a run is reproducible
+ *  -C FILE   append a capture of the traffic to FILE: every request and response, UART frame and
+ *            ATTN* wait with its time (layout in hvpi_cap.h), for i2lchv_replay
+ *  -k N[,MS] circuit breaker: a slot is degraded after N failed transactions in a row and tried
+ *            again every MS ms (default 3,5000, 0 = off)
  *
  * JG
  */
@@ -36,6 +186,9 @@
 #define  nSUBMOD         2  /* maximum number of sumbmodules in a HV module */
 #define  nLU            (nSLOTS * nSUBMOD) /* number of logic units */
 #define  nLUTYP          8  /* Number of different logic unit types */
+#define  nPROP          16  /* maximum number of properties of a logic unit */
+#define  nCHAN          24  /* maximum number of channels of a logic unit */
+#define  nBATCH         nLU /* maximum number of commands in one batch (_ALL, _RCL) */
 
 #define  MSGstat_NONE    -2 /* no message was received */
 #define  MSGstat_noEOM   -1 /* failed to find end-of-message sequence */
@@ -43,6 +196,12 @@
 #define  MSGstat_OK       1 /* message */
 #define  MSGstat_HNDSHK   2 /* message is the handshake sequence */
 
+#define  ATTN_MMAP    0 /* ATTN backend: sample the mmap'd GPIO level register every 5 ms */
+#define  ATTN_CDEV    1 /* ATTN backend: rising-edge events from the GPIO character device */
+#define  ATTN_FAKE    2 /* ATTN backend: eventfd-driven stand-in line (no hardware) */
+#define  ATTN_GPIO   23 /* ATTN* from the HV modules is routed to GPIO23 */
+#define  ATTN_CHIP   "/dev/gpiochip0"
+
 #define  ABNORMAL  -100 /* encoutered unexpected condition */
 #define  NORMAL     0 /* as expected */
 
@@ -62,6 +221,33 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/mman.h>
+#include <sys/time.h>
+#include <poll.h>
+#include <time.h>
+#include <errno.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <linux/gpio.h>
+#include <signal.h>
+#include <sched.h>
+#include <stdarg.h>
+#include "hvpi_shm.h"
+#include "hvpi_cap.h"
+
+#if (HVPI_NSLOTS != nSLOTS) || (HVPI_NSUBMOD != nSUBMOD) || (HVPI_NPROP != nPROP) || (HVPI_NCHAN != nCHAN)
+#error hvpi_shm.h does not match the logic unit limits
+#endif
+
+/* Cached value - last value of a property/channel read from the hardware */
+struct CVal
+  {
+  unsigned char txt[L16];  /* value as sent by the module */
+  float         val;       /* numeric value */
+  long long     tread;     /* usnow() when it was read, 0 = not valid */
+  };
 
 /* Logic Unit Structure - holds information about each logic unit */
 struct LUnit
@@ -73,12 +259,69 @@ struct LUnit
   int  slot;
   int  nsmod; /* number of sub-modules */
   int  smod;  /* sub-module number */
+
+  /* value cache (protected by cache_mutex) */
+  int           nprop;               /* properties known to the cache */
+  int           propok;              /* pname[] is in PROP order (DMP can be decoded) */
+  unsigned char pname[nPROP][L16];   /* property names */
+  int           nval[nPROP];         /* channels returned by the last RC of the property */
+  struct CVal   val[nPROP][nCHAN];   /* per property/channel values */
+  int           npsum;               /* words returned by the last PSUM */
+  struct CVal   psum[nPROP];         /* PSUM change counters */
+
+  /* module metadata - responses kept as received, they do not change while the
+   * module stays in its slot (protected by cache_mutex)
+   */
+  unsigned char rid[L256];           /* ID response */
+  unsigned char rprop[L256];         /* PROP response */
+  unsigned char rattr[nPROP][L256];  /* ATTR response of each property (pname[] index) */
   };
 
-struct LUnit *pLU[nLU], *pLUtmp;
+struct LUnit *pLU[nLU];
 int lstLU = -1;
 int SS2LU[nSLOTS][nSUBMOD]; /* map of slot-submodule to logic unit */
 int SLOTwMOD[nSLOTS], nMOD = 0; /* slots with module in them */
+char LU_type[nLUTYP][L16] = {"1461PS0", "1461NS0", "1469PS0", "1469PS1",
+  "1469NS0", "1469NS1", "1471PS0", "1471NS0"};
+
+/* The logic unit table (pLU, SS2LU, SLOTwMOD) is patched by the bus thread when a slot
+ * changes; other threads read it holding topo_lock. A replaced logic unit is freed
+ * holding topo_lock and cache_mutex, so other threads only use a logic unit holding one
+ * of them (luLOCK())
+ */
+pthread_rwlock_t topo_lock = PTHREAD_RWLOCK_INITIALIZER;
+unsigned char    *topo_file = "/var/tmp/i2lchv.topo"; /* saved table (-t), "-" = none */
+int              topo_dirty = 0; /* table changed since it was saved */
+int              topo_warm = 0;  /* table was loaded from the file - revalidate it */
+pthread_t        topo_thread;
+pthread_mutex_t  topo_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t   topo_cond = PTHREAD_COND_INITIALIZER;
+int              topo_rescan = 30; /* s between rescans of slots without logic unit (-s), 0 = none */
+int              topo_req = -1;  /* _RESCAN request: slot#, nSLOTS = all slots, -1 = none */
+long             topo_nscan = 0, topo_nprobe = 0, topo_nchange = 0;
+
+/* Topology file: header followed by one record per logic unit */
+#define  TOPO_MAGIC    0x54505648 /* "HVPT" */
+#define  TOPO_VERSION  1
+
+struct TopoHdr
+  {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t recsize;  /* sizeof(struct TopoRec) */
+  uint32_t nrec;
+  };
+
+struct TopoRec
+  {
+  int32_t       slot, nsmod, smod, lutype;
+  unsigned char id[L256];
+  int32_t       nprop;               /* 0 = no property list */
+  unsigned char pname[nPROP][L16];
+  unsigned char rid[L256];
+  unsigned char rprop[L256];
+  unsigned char rattr[nPROP][L256];
+  };
 
 /* serial port  variables */
 int sio, mdlns;
@@ -91,420 +334,5135 @@ int           sio_RXlen;
 unsigned char sio_dmpRXbuff = 0;
 unsigned char sio_MSGbuff[L4096];
 int           sio_MSGlen;
+int           sio_fixed = 0; /* 1 = use the old fixed-wait reader msgget_fixed() */
+long long     sio_ntx = 0, sio_nrx = 0; /* frames sent, characters read (virtual clock) */
+unsigned char *sio_dev = "/dev/ttyAMA0"; /* serial device (-d) */
 
-/* Network variables */
-unsigned char nio_RXbuff[L4096]; /* receive buffer */
-int           nio_RXlen; /* received message length */
-unsigned char nio_TXbuff[L4096]; /* transmit buffer */
-int           nio_TXlen; /* Network - transmit buffer length */
-unsigned char nio_quit = 0; /* close connection */
+/* Bus transaction - one command line from a network session. Sessions queue
+ * transactions with busSubmit(); the bus thread is the only user of the serial
+ * port and the ATTN line, it executes them one at a time with cmdEXE() and hands
+ * each one back through its complete() function
+ */
+struct BusTxn
+  {
+  unsigned char cmd[L4096]; /* command line as received */
+  int           cmdlen;
+  unsigned char rsp[L4096]; /* response to send back (without prompt) */
+  int           rsplen;
+  int           status;     /* cmdParse()/cmdEXE() return code */
+  int           type;       /* TXN_* */
+  int           slot, sm;   /* module address (TXN_MOD) */
+  int           moff;       /* offset in cmd of the module command (TXN_MOD) */
+  int           maxage;     /* ms - answer from the cache if the data is that fresh */
+  int           cls;        /* scheduling class CLS_* */
+  long long     cost;       /* estimated bus time (us) */
+  long long     tdead;      /* usnow() deadline of the class, 0 = none */
+  long          seq;        /* submission order */
+  int           rdonly;     /* module read (RC, PSUM, ID, ...) - may be shared */
+  int           nocoal;     /* do not share (the requester has a write pending) */
+  int           run;        /* taken by the bus thread */
+  int           lead;       /* on bus_lead - identical reads attach to it */
+  struct BusTxn *lnext;     /* bus_lead link */
+  struct BusTxn *fhead, *fnext; /* identical reads sharing this transaction's response */
+  struct BusTxn *parent;    /* batch this command belongs to */
+  int           nkid, nleft; /* batch: commands, commands not done yet */
+  struct BusTxn *kid[nBATCH]; /* batch: commands in response order */
+  int           quit;       /* _Q received - close connection */
+  int           done;       /* set once complete() has been called */
+  int           rel;        /* the event loop has it - the response may be sent and the
+                             * transaction freed (the bus thread's done is not enough:
+                             * it may still be on net_done) */
+  long long     trecv;      /* usnow() when the request arrived */
+  long long     tqueue, tstart, tdone; /* usnow() when queued, started, done */
+  void          (*complete)(struct BusTxn *); /* called by the bus thread */
+  void          *owner;     /* requester private data */
+  struct BusTxn *next;      /* queue link */
+  struct BusTxn *cnext;     /* next command of the same connection */
+  int           cread;      /* cacheable read (RC, DMP, PSUM) */
+  int           write;      /* counted in the connection's nwrite */
+  int           bid, bop, blu, bprop; /* binary request: id, opcode, LU, property */
+  int           bst;        /* binary status if the request was refused (BST_*) */
+  int           bready;     /* rsp already holds the binary response frame */
+  int           brk;        /* the trial transaction of a degraded slot */
+  long long     tdata;      /* usnow() of the oldest value of a cache answer */
+  };
 
-unsigned char *prompt="hvpi>"; 
+/* Transaction types */
+#define  TXN_MOD     0 /* module command: SLOT# SUBMODULE# module-cmd-syntax */
+#define  TXN_Q       1 /* _Q */
+#define  TXN_LL      2 /* _LL */
+#define  TXN_CLI     3 /* _CLI */
+#define  TXN_BUS     4 /* _BUS */
+#define  TXN_MAXAGE  5 /* _MAXAGE ms */
+#define  TXN_CACHE   6 /* _CACHE */
+#define  TXN_PROBE   7 /* revalidate slot ptx->slot (topology thread) */
+#define  TXN_RESCAN  8 /* _RESCAN [slot] */
+#define  TXN_BATCH   9 /* _ALL module-cmd-syntax, _RCL SLOT# SUBMODULE# prop ... */
+#define  TXN_SUB    10 /* _SUB [SLOT# SUBMODULE# prop [first [last [deadband]]]] */
+#define  TXN_UNSUB  11 /* _UNSUB [SLOT# SUBMODULE# prop] */
+#define  TXN_STATS  12 /* _STATS [verb|slot#|CLEAR] */
+#define  TXN_HEALTH 13 /* _HEALTH */
+
+/* Value cache */
+pthread_mutex_t cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+long            cache_nhit = 0, cache_nmiss = 0, cache_nstore = 0, cache_ninval = 0;
+long            cache_nmeta = 0; /* ID, PROP & ATTR answered from memory */
+
+/* Crate state published for local readers (hvpi_shm.h) - written with cache_mutex */
+unsigned char   *shm_file = HVPI_SHM_FILE; /* -m, "-" = none */
+struct hvpi_shm *shm_base = NULL;
+
+/* Background refresher - PSUM sweep over all logic units, RC of the properties that changed */
+int             poll_ms = 1000;  /* sweep period (-r), 0 = no refresher */
+pthread_t       poll_thread;
+pthread_mutex_t poll_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t  poll_cond = PTHREAD_COND_INITIALIZER;
+long            poll_nsweep = 0, poll_npsum = 0, poll_nrc = 0;
+
+/* Circuit breaker per slot - a module that fails (no handshake, no ATTN*, no response, NAK)
+ * brk_nfail times in a row is degraded: its reads are answered from the value cache marked
+ * stale, other commands fail at once, and one trial transaction every brk_probe ms goes to
+ * the bus (the refresher's PSUM, or a client command) until the module answers again
+ */
+#define  BRK_CLOSED    0 /* module answers */
+#define  BRK_OPEN      1 /* degraded */
+#define  BRK_TRIAL     2 /* degraded, a trial transaction is on its way */
+#define  CACHE_STALE   INT32_MAX /* max-age of a stale answer: any value read from the module */
+
+struct Health
+  {
+  int           state;      /* BRK_* */
+  int           nfail;      /* failures in a row */
+  long long     tok;        /* usnow() of the last answer */
+  long long     tprobe;     /* usnow() from when the next trial may go */
+  uint32_t      ntrip, ntrial, nfast, nstale;
+  };
+
+pthread_mutex_t brk_mutex = PTHREAD_MUTEX_INITIALIZER;
+struct Health   brk_slot[nSLOTS];
+int             brk_nfail = 3;    /* -k, 0 = no circuit breaker */
+int             brk_probe = 5000; /* -k ms between trials */
+
+/* Bus transaction queue */
+/* Bus scheduling classes, highest priority first */
+#define  nCLASS      5
+#define  CLS_SAFETY  0 /* HVON, HVOFF */
+#define  CLS_IWRITE  1 /* interactive writes (LD, ..., _CLI) */
+#define  CLS_IREAD   2 /* interactive reads */
+#define  CLS_POLL    3 /* background refresher */
+#define  CLS_DISC    4 /* discovery - slot probes */
+
+char            bus_cname[nCLASS][L16] = {"SAFETY", "IWRITE", "IREAD", "POLL", "DISC"};
+int             bus_deadline[nCLASS] = {50, 250, 1000, 0, 0}; /* ms after queueing, 0 = none (-D) */
+struct BusTxn   *bus_qhead[nCLASS], *bus_qtail[nCLASS]; /* one FIFO per class */
+long            bus_seq = 0;
+long long       bus_attn = 5000; /* running average of the ATTN* wait (us) */
+long            bus_nboost = 0;  /* transactions moved up to keep a connection's order */
+struct BusTxn   *bus_lead = NULL; /* reads queued or on the bus that identical reads can share */
+long            bus_ncoal = 0, bus_nseal = 0; /* reads that shared one, leaders sealed by a write */
+int             bus_cdepth[nCLASS];
+long            bus_cntxn[nCLASS], bus_cmiss[nCLASS];
+long long       bus_cwait[nCLASS], bus_cmaxwait[nCLASS]; /* queue wait (us) */
+pthread_mutex_t bus_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t  bus_cond = PTHREAD_COND_INITIALIZER;
+pthread_t       bus_thread;
+long long       bus_t0;        /* bus thread start time */
+long            bus_ntxn = 0;  /* transactions completed */
+int             bus_depth = 0, bus_maxdepth = 0; /* transactions queued */
+long long       bus_twait = 0, bus_tbusy = 0; /* total queue wait & execution time (us) */
+int             bus_idle = 0;  /* bus thread waits for work (virtual clock) */
+
+/* Clock - usnow() is the time of the server. With the virtual clock (-V) time only moves
+ * when the threads that drive the bus (main during discovery, then the bus, refresher and
+ * topology threads) are all blocked: it jumps to the earliest clkUNTIL() deadline. Sleeps
+ * then cost no wall time and a run depends only on the order of events. Protected by
+ * bus_mutex; the time is shared with i2lchv_sim through the GPIO register file.
+ */
+#define  nCLKW          8 /* threads that can wait for the clock at the same time */
+#define  GPIO_VCLK     64 /* GPIO file: int64 virtual time (server), word index */
+#define  GPIO_VATTN    66 /* GPIO file: int64 virtual time ATTN* goes up, 0 = never (simulator) */
+#define  GPIO_VFRAME   68 /* GPIO file: int64 frames taken from the server (simulator) */
+#define  GPIO_VBYTE    70 /* GPIO file: int64 characters written back (simulator) */
+
+struct ClkWait
+  {
+  long long      t;          /* wake-up time */
+  int            used, woken;
+  pthread_cond_t cond;       /* only the thread woken is signalled */
+  };
+
+int             clk_virtual = 0;       /* -V */
+long long       clk_now = 1000000;     /* virtual time (us) */
+int             clk_nrun = 1;          /* bus-driving threads not blocked */
+struct ClkWait  clk_wait[nCLKW];
+volatile int64_t *clk_vclk = NULL, *clk_vattn = NULL; /* in the GPIO file */
+volatile int64_t *clk_vframe = NULL, *clk_vbyte = NULL;
+
+/* Latency histograms of the stages of a module transaction, per command verb and per slot.
+ * Counters are only touched with atomic adds - no lock on the bus path (_STATS, SIGUSR1).
+ * Bins: 4 per power of two of the time in us.
+ */
+#define  nSTAGE      8
+#define  ST_PARSE    0 /* cmdParse() / binParse() in the event loop */
+#define  ST_QUEUE    1 /* waiting for the bus */
+#define  ST_TX       2 /* command written to the UART */
+#define  ST_HNDSHK   3 /* msgget() of the handshake */
+#define  ST_ATTN     4 /* IsGpioSet() - module ready with the response */
+#define  ST_ACK      5 /* ACK written to the UART */
+#define  ST_RSP      6 /* msgget() of the response */
+#define  ST_EXE      7 /* cmdEXE() of a module command, all of the above on the bus */
+#define  nVERB      10 /* RC DMP PSUM LD HVON HVOFF ID PROP ATTR other */
+#define  nHBIN      96
+#define  nERRC      21 /* ABNORMAL-0..-15, then msgget() status -2..2 */
+
+struct Hist
+  {
+  uint32_t  bin[nHBIN];
+  uint32_t  n;
+  uint32_t  max;   /* us */
+  uint64_t  sum;   /* us */
+  };
+
+const char *stat_sname[nSTAGE] = {"PARSE", "QUEUE", "TX", "HNDSHK", "ATTN", "ACK", "RSP", "EXE"};
+const char *stat_vname[nVERB] = {"RC", "DMP", "PSUM", "LD", "HVON", "HVOFF", "ID", "PROP", "ATTR", "OTHER"};
+struct Hist     stat_verb[nSTAGE][nVERB];
+struct Hist     stat_slot[nSTAGE][nSLOTS];
+uint32_t        stat_msg[2][5];        /* MSGstat_* outcome of the handshake & response msgget() */
+uint32_t        stat_err[nERRC];       /* error return codes */
+uint32_t        stat_serr[nSLOTS];     /* failed module transactions per slot */
+volatile sig_atomic_t stat_dump = 0;   /* SIGUSR1 - print the statistics */
+
+/* Logger - records are put in a preallocated ring without lock (one sequence number per
+ * cell) by any thread and formatted and written in batches by the log thread. When the
+ * ring is full the record is dropped and counted; a bus transaction never waits for output.
+ */
+#define  nLOG       4096 /* records in the ring, power of 2 */
+#define  LOG_TXT      64 /* text kept with a record */
+#define  LOG_ERR       0 /* levels (-v) */
+#define  LOG_INFO      1
+#define  LOG_DEBUG     2
+#define  EV_TEXT       0 /* record types */
+#define  EV_CMD        1 /* command line received */
+#define  EV_RSP        2 /* response sent back */
+#define  EV_EXE        3 /* module transaction executed on the bus */
+
+struct LogRec
+  {
+  uint32_t      seq;        /* ring cell sequence */
+  uint8_t       level, ev;
+  int8_t        slot;       /* -1 = none */
+  uint8_t       verb;       /* stat_vname[] index */
+  int32_t       status;
+  int32_t       dur;        /* us */
+  long long     t;          /* usnow() */
+  unsigned char txt[LOG_TXT];
+  };
+
+struct LogRec   log_ring[nLOG];
+uint32_t        log_head = 0;     /* next cell to fill (atomic) */
+uint32_t        log_tail = 0;     /* next cell to write out (log thread) */
+uint32_t        log_ndrop = 0;    /* records lost to a full ring (atomic) */
+int             log_level = LOG_INFO; /* -v */
+unsigned char   *log_fname = "-"; /* -L, "-" = stdout */
+FILE            *log_fp = NULL;
+long long       log_t0 = 0;       /* wall clock - usnow() (us) */
+pthread_t       log_thread;
+
+/* Capture (-C) - requests, responses, UART frames and ATTN* waits are appended to a binary
+ * file (layout in hvpi_cap.h) for i2lchv_replay. Records go through a ring like the
+ * logger's and the capture thread writes them out; a full ring drops and counts them.
+ */
+#define  nCAP       2048 /* records in the ring, power of 2 */
+
+struct CapRec
+  {
+  uint32_t            seq;  /* ring cell sequence */
+  struct hvpi_cap_hdr h;
+  unsigned char       data[HVPI_CAP_DATA];
+  };
+
+struct CapRec   *cap_ring = NULL; /* allocated with -C only */
+uint32_t        cap_head = 0;     /* next cell to fill (atomic) */
+uint32_t        cap_tail = 0;     /* next cell to write out (capture thread, atomic) */
+int             cap_wakefd = -1;  /* eventfd: the ring is half full -> capture thread */
+uint32_t        cap_ndrop = 0;    /* records lost to a full ring (atomic) */
+unsigned char   *cap_fname = NULL; /* -C */
+FILE            *cap_fp = NULL;
+uint32_t        cap_nconn = 0;    /* connection ids (event loop) */
+int             cap_slot = -1;    /* module addressed by the last UART frame (bus thread) */
+pthread_t       cap_thread;
+
+/* Network connection - one per accepted socket, all served by the NetServer() event loop.
+ * Complete command lines are queued for the bus as soon as they arrive (pipelining);
+ * responses are sent back in request order.
+ */
+#define  CONN_IDLE     0 /* accepting commands */
+#define  CONN_CLOSING  2 /* _Q done - close as soon as the output queue is empty */
+#define  CONN_DEAD     3 /* closed, waiting to be freed */
+#define  nPIPE        64 /* maximum commands of one connection queued on the bus */
+#define  nSUB         32 /* maximum subscriptions of one connection */
+
+struct Conn
+  {
+  int           fd;
+  int           state;
+  int           gone;       /* socket closed while commands were on the bus */
+  unsigned int  events;     /* epoll events we are waiting for */
+  unsigned char in[L4096];  /* input framing buffer */
+  int           inlen;
+  int           lastcr;     /* last line ended with CR - skip a following LF or NUL */
+  int           quit;       /* _Q taken - no more lines are parsed, later input is dropped */
+  unsigned char *out;       /* output queue */
+  int           outlen, outpos, outsize;
+  struct BusTxn *phead, *ptail; /* commands on the bus, in request order */
+  int           npend;
+  int           nwrite;     /* commands on the bus that are not cacheable reads */
+  int           maxage;     /* default max-age for reads (_MAXAGE), 0 = always read hardware */
+  int           bin;        /* binary protocol connection */
+  int           nsub;       /* subscriptions (_SUB) */
+  uint32_t      id;         /* connection id in the capture (-C) */
+  struct Conn   *next;      /* closed connections waiting to be freed */
+  };
 
-/* global error reporting */
-int errno;
+/* Binary protocol (port BASE_PORT + 1) - request/response header layout in the header comment */
+#define  BIN_HDR      12  /* bytes of the frame header */
+#define  BIN_MAXREQ   L256 /* longest request frame */
+#define  BIN_LDMAX    1.0e6 /* |LD value| limit - beyond any module setting (ATTR %7.1lf and alike) */
+#define  BOP_RC        1
+#define  BOP_DMP       2
+#define  BOP_PSUM      3
+#define  BOP_LD        4
+#define  BOP_HVON      5
+#define  BOP_HVOFF     6
+#define  BOP_CMD       7
+#define  BOP_LUS       8
+#define  BOP_SUB       9
+#define  BOP_UNSUB    10
+#define  BOP_PUSH     11 /* server push of a subscription */
+#define  BST_OK        0
+#define  BST_EREQ      1 /* bad request */
+#define  BST_ELU       2 /* no such logic unit */
+#define  BST_EPROP     3 /* no such property */
+#define  BST_EMOD      4 /* module or bus error */
+#define  BST_EOP       5 /* unknown opcode */
+#define  BST_STALE     6 /* values from the cache, the module is not answering */
+#define  BFMT_NONE     0
+#define  BFMT_F32      1
+#define  BFMT_U16      2
+#define  BFMT_U8       3
+#define  BFMT_TEXT     4
+#define  BFMT_CHF32    5 /* u8 channel + float32 value */
+
+/* Change subscription of a connection (_SUB) - owned by the event loop. The cache counts
+ * value changes in sub_gen (with cache_mutex) and wakes the event loop, which compares
+ * the cached values of every subscription with the ones it pushed last.
+ */
+struct Sub
+  {
+  struct Conn   *pc;
+  int           slot, sm;
+  unsigned char prop[L16];
+  int           ch0, ch1;     /* channel range */
+  float         db;           /* deadband */
+  int           bid;          /* binary: request-id of the subscription */
+  int           have[nCHAN];  /* last[] was pushed */
+  float         last[nCHAN];  /* values pushed last */
+  struct Sub    *next;
+  };
+
+struct Sub      *sub_list = NULL;
+int             sub_n = 0;        /* subscriptions (cache_mutex) */
+long            sub_gen = 0;      /* cached values changed (cache_mutex) */
+long            sub_seen = 0;     /* sub_gen the event loop has pushed */
+long            sub_npush = 0;    /* pushed updates */
+
+/* Network event loop */
+int             net_epfd = -1;    /* epoll instance */
+int             net_wakefd = -1;  /* eventfd: bus thread -> event loop */
+struct BusTxn   *net_done = NULL; /* transactions completed by the bus thread */
+struct Conn     *net_dead = NULL; /* closed connections, freed after the current events */
+pthread_mutex_t net_mutex = PTHREAD_MUTEX_INITIALIZER;
+int             net_nconn = 0;    /* open connections */
+struct Conn     net_listen, net_blisten, net_wake; /* epoll tags for the listening sockets & eventfd */
+
+unsigned char *prompt="hvpi>"; 
 
 /* to access GPIO pins */
 static volatile uint32_t  *gpioReg = MAP_FAILED;
 
+/* ATTN* line access */
+int attn_mode = ATTN_CDEV;  /* backend used by IsGpioSet() */
+unsigned char *attn_file = NULL; /* GPIO register file to map instead of /dev/mem (-g) */
+int attn_fd = -1;           /* line event fd (ATTN_CDEV) or eventfd (ATTN_FAKE) */
+volatile int attn_fake = 0; /* level of the fake line */
 
-/* ================================================================================
- * 
- * Checks for wait_sec for gpio pin to be set  
+
+/* ======================================================================================
  *
- * ================================================================================
+ * Monotonic wall-clock time in microseconds
+ *
+ * ======================================================================================
  */
-int IsGpioSet(unsigned gpio, float wait_sec)
+long long usreal(void)
   {
-  unsigned bank = 0, bit;
-  int ntry=0, iloop;
-   
-  /* The Broadcom BCM2835 processor has two registers holding the levels of the 
-   * 54 GPIO pins known to the system - 32 are in the first register, the remaining 22
-   * are in the second register
-   */
-  if(gpio > 31) bank = 1;
-  bit = (1<<(gpio&0x1F));
-  ntry = wait_sec*200.0; /* we check pin status every 5 millisec or 200 times/sec */
-  
-  for(iloop=0; iloop < ntry; iloop++) 
-     {
-     /* Bank = 0 is the 13teen register from the base */
- /*   if ((*(gpioReg + 13 + bank) & bit) == 0) return NORMAL;*/
-/*      printf("ATTN(%4d): %8x; ",iloop, (*(gpioReg + 13 + bank) & bit));*/
-      if ((*(gpioReg + 13 + bank) & bit) == bit) return NORMAL;
-     usleep(5000); /* sleep for 5 milliseconds */
-     }
-   return ABNORMAL;
-   }
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long)ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+  }
 
 
 /* ======================================================================================
  *
- * Retrieve a message from serial port buffer.
- * (A) It waits the equivalent of nchars * USCHAR before each buffer retrieve.
- * (B) If no character is received on the first attempt, it returns with status -2
- * (C) It then attempts multiple retrieves (10 maximum) until either it does not get
- * any further response or it finds the sequence 0x0d,0x0a (CR,LF) used by the LeCroy
- * HV modules to signal an end-of-message.
- * (D) If an end-of-message terminator was found, it checks if the message received
- * is the 3-byte handshake sequence 0x06,0x0d,0x0a (ACK,CR,LF).
- * 
- * Return codes,
- *  -2  = no message received / other error
- *  -1  = incomplete transaction: end-of-message sequence not found
- *   0  = transaction has end-of-message sequence but no acknowledge (asserted NAK [0x15] likely)
- *   1  = normal transaction: ACK, content, end-of-message sequence
- *   2  = message received is the 3-byte handshake sequence (content is 0 bytes)
+ * Time of the server in microseconds (monotonic, or the virtual clock)
  *
- * =======================================================================================
+ * ======================================================================================
  */
-int msgget(int nchar)
+long long usnow(void)
   {
-  /* nchar is the expected number of characters in the transaction */
-  int iloop, stat, indx;
-   
-  iloop = 0;
-  stat = MSGstat_NONE;
-  sio_MSGbuff[0] = '\0';
-  sio_MSGlen = 0;
-  
-  while(iloop < NTRIES) /* attempt to get complete message */
+  if(clk_virtual) return __atomic_load_n(&clk_now, __ATOMIC_ACQUIRE);
+  return usreal();
+  }
+
+
+/* ======================================================================================
+ *
+ * Put a record in the log ring - any thread, never blocks. A full ring drops the record.
+ * txt may be NULL; len < 0 = up to the terminating NUL
+ *
+ * ======================================================================================
+ */
+void logREC(int level, int ev, int slot, int verb, int status, long long dur, unsigned char *txt, int len)
+  {
+  struct LogRec *pr;
+  uint32_t pos, seq;
+
+  if(level > log_level) return;
+  pos = __atomic_load_n(&log_head, __ATOMIC_RELAXED);
+  for(;;)
     {
-    sio_RXlen = 0;
-    sio_RXbuff[0] = '\0';
-    iloop = iloop + 1;
-    usleep(USCHAR * nchar);
-	sio_RXlen = read(sio,sio_RXbuff,L256-1);
-	if(sio_RXlen > 0 )
+    pr = &log_ring[pos & (nLOG - 1)];
+    seq = __atomic_load_n(&pr->seq, __ATOMIC_ACQUIRE);
+    if(seq == pos)
       {
-/*      printf("msgget : loop(1) = %d\n", iloop);*/
-      sio_RXbuff[sio_RXlen] = '\0';
-      strcat(sio_MSGbuff,sio_RXbuff);
-      sio_MSGlen = strlen(sio_MSGbuff);
-         
-      /* check for end-of-message sequence */
-      if(
-        (sio_MSGbuff[sio_MSGlen - 2] == 0x0d) && /* byte before last should be CR */
-        (sio_MSGbuff[sio_MSGlen - 1] == 0x0a) /* last byte should be LF */
-        )
-        {
-        /* found end-of-message sequence */
-        /* check that 1st byte is the ACK (0x06).
-         * Module could signal that it is not ready by setting this byte to NAK (0x15)
-         */
-        if(sio_MSGbuff[0] != 0x06)
-          {
-          stat = MSGstat_noACK; /* end-of-message sequence but no ACK */
-          }
-        else
-          {
-          stat = MSGstat_OK; /* end-of-message sequence and ACK */
-          
-          /* check if this is a handshake - we already know that ACK,CR & LF are in the buffer.
-           * So, we only need to check that the buffer length is 3-bytes
-           */
-          if(sio_MSGlen == 3) stat = MSGstat_HNDSHK;
-          }
-                                  
-        /* we are done - exit while */
-        break;
-        }
-      
-      /* data has been received but the end-of-message sequence was not found */
-      stat = MSGstat_noEOM;
+      /* cell is free - claim it (a failed exchange reloads pos) */
+      if(__atomic_compare_exchange_n(&log_head, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) break;
       }
-    else
+    else if((int32_t)(seq - pos) < 0)
       {
-      /* no response at all - bail out */
-/*** 03-08-2014      break;  keep loop  ***/
-/***	printf("msgget : loop(0) = %d\n", iloop); ***/
+      /* the log thread has not written this cell out yet */
+      __atomic_fetch_add(&log_ndrop, 1, __ATOMIC_RELAXED);
+      return;
       }
+    else pos = __atomic_load_n(&log_head, __ATOMIC_RELAXED);
     }
-         
-  /* return */
-  return stat;  
-  };
 
+  pr->t = usnow();
+  pr->level = level;
+  pr->ev = ev;
+  pr->slot = slot;
+  pr->verb = verb;
+  pr->status = status;
+  pr->dur = (dur > INT32_MAX) ? INT32_MAX : dur;
+  if(txt == NULL) len = 0;
+  else if((len < 0) || (len > LOG_TXT - 1)) len = strnlen(txt, LOG_TXT - 1);
+  if(len > 0) memcpy(pr->txt, txt, len);
+  pr->txt[len] = '\0';
+  __atomic_store_n(&pr->seq, pos + 1, __ATOMIC_RELEASE);
+  }
 
 
-/* =====================================================================================
+/* ======================================================================================
  *
- * Basic command processing:
- *   - check for expected number of arguments
- *   - process global commands (e.g. _Q, _LL, ....)
- *   - check that requested module/submodule exists 
+ * Text message to the log (formatted by the caller's thread, as logREC())
  *
- * Return codes,
- *  -1 = command failed = ABNORMAL
- *   0 = command OK = NORMAL
- * =====================================================================================
- */   
-int cmdEXE(void)
+ * ======================================================================================
+ */
+void logMSG(int level, const char *fmt, ...)
   {
-  unsigned char s1[L4096], s2[L4096], tmp[L4096];
-  unsigned char *ps1;
-  int slot, sm, i1, i2, i3;
-  int status;
+  unsigned char txt[LOG_TXT];
+  va_list ap;
 
+  if(level > log_level) return;
+  va_start(ap, fmt);
+  vsnprintf(txt, LOG_TXT, fmt, ap);
+  va_end(ap);
+  logREC(level, EV_TEXT, -1, 0, 0, 0, txt, -1);
+  }
 
-  status = ABNORMAL; /* set status to fail by default */
-  nio_TXbuff[0] = '\0';
-  nio_TXlen = 0;
-  nio_RXbuff[nio_RXlen] = '\0';
-  s1[0] = '\0';
-  
-  /* Commands must be in upper-case characters */
-  for(i1=0;i1<nio_RXlen;i1++) {
-	 s1[i1] = toupper(nio_RXbuff[i1]);
-/*         printf(":%c: ",s1[i1]);*/
-  }
-  s1[nio_RXlen] = '\0';
-  ps1 = strchr(s1,'\r'); /* search for CR character */
-/***  ps1 = strchr(s1,'\n');*/ /* search for CR character */
-  *ps1 = '\0';  /* replace CR by NULL to terminate string */
-/*  printf("cmdEXE: got: %s\n",s1); */
-  i1=0;
-  while(s1[i1] == ' ') /* get rid of leading spacings */
-  	{
-  	i1 = i1+1;
-  	if(s1[i1] == '\0') return status; /* unexpected end of string */
-  	}
-  	
-  /* is this the quit command? */
-  if(strncmp(&s1[i1],"_Q",2) == 0)
+
+/* ======================================================================================
+ *
+ * Format one record as a log line, return its length
+ *
+ * ======================================================================================
+ */
+int logLINE(struct LogRec *pr, unsigned char *out)
+  {
+  static const char *lname[3] = {"ERR", "INF", "DBG"};
+  struct tm tm;
+  time_t sec;
+  long long t;
+  int n, i1;
+
+  t = pr->t + log_t0;
+  sec = t / 1000000;
+  localtime_r(&sec, &tm);
+  n = strftime(out, 32, "%Y-%m-%d %H:%M:%S", &tm);
+  n += sprintf(&out[n], ".%06lld %s ", t % 1000000, lname[pr->level]);
+  switch(pr->ev)
     {
-    nio_quit = 1;
-    return NORMAL;
+    case EV_CMD:
+      n += sprintf(&out[n], "got : ");
+      break;
+    case EV_RSP:
+      n += sprintf(&out[n], "sentback status %d %dus : ", pr->status, pr->dur);
+      break;
+    case EV_EXE:
+      n += sprintf(&out[n], "exe slot %d %s status %d %dus : ", pr->slot,
+        (pr->verb < nVERB) ? stat_vname[pr->verb] : "?", pr->status, pr->dur);
+      break;
     }
+  /* one line per record - module responses carry CR/LF */
+  for(i1 = 0; pr->txt[i1] != '\0'; i1++) out[n++] = (pr->txt[i1] < ' ') ? ' ' : pr->txt[i1];
+  out[n++] = '\n';
+  return n;
+  }
 
-  /* is this the dump module/submodule summary command? */
-  if(strncmp(&s1[i1],"_LL",3) == 0)
+
+/* ======================================================================================
+ *
+ * Log thread - writes the records out in batches, reports dropped ones
+ *
+ * ======================================================================================
+ */
+void *logTSK(void *arg)
+  {
+  static unsigned char buf[L4096 * 16];
+  struct LogRec *pr;
+  uint32_t ndrop, nseen = 0;
+  int len;
+
+  for(;;)
     {
-    nio_TXbuff[0] = '\0';    
-    for(i2 = 0; i2 <= lstLU ; i2++)
+    len = 0;
+    for(;;)
       {
-      tmp[0] = '\0';      
-      sprintf(tmp,"%d %s\n",pLU[i2]->slot,pLU[i2]->id);
-      strcat(nio_TXbuff,tmp);
-      }      
-    nio_TXlen = strlen(nio_TXbuff);
-    return NORMAL;
+      pr = &log_ring[log_tail & (nLOG - 1)];
+      if(__atomic_load_n(&pr->seq, __ATOMIC_ACQUIRE) != log_tail + 1) break; /* empty (or being filled) */
+      len += logLINE(pr, &buf[len]);
+      __atomic_store_n(&pr->seq, log_tail + nLOG, __ATOMIC_RELEASE);
+      log_tail++;
+      if(len > (int)sizeof(buf) - L256)
+        {
+        fwrite(buf, 1, len, log_fp);
+        len = 0;
+        }
+      }
+    ndrop = __atomic_load_n(&log_ndrop, __ATOMIC_RELAXED);
+    if(ndrop != nseen)
+      {
+      len += sprintf(&buf[len], "log - %u records dropped (ring full)\n", ndrop - nseen);
+      nseen = ndrop;
+      }
+    if(len > 0)
+      {
+      fwrite(buf, 1, len, log_fp);
+      fflush(log_fp);
+      }
+    else usleep(50000);
     }
-	
-  /* is this a request to clear all modules response buffers?
-   * this will clear any module holding the ATN* line with a message to be delivered
-   */
-  if(strncmp(&s1[i1],"_CLI",4) == 0)
+  return NULL;
+  }
+
+
+/* ======================================================================================
+ *
+ * Open the log output and start the log thread
+ *
+ * ======================================================================================
+ */
+void logSTART(void)
+  {
+  struct timeval tv;
+  int i1;
+
+  for(i1 = 0; i1 < nLOG; i1++) log_ring[i1].seq = i1;
+  gettimeofday(&tv, NULL);
+  log_t0 = (long long)tv.tv_sec * 1000000LL + tv.tv_usec - usnow();
+  log_fp = stdout;
+  if(strcmp(log_fname, "-") != 0)
     {
-    for(i2 = 0; i2 < nMOD; i2++) /* loop over slots with modules */
+    log_fp = fopen(log_fname, "a");
+    if(log_fp == NULL)
       {
-      /* Load handshake message into SIO TX buffer */
-      sio_TXbuff[0] = '\0';
-      strcpy(sio_TXbuff,pLU[SS2LU[SLOTwMOD[i2]][0]]->ack);
-      sio_TXlen = strlen(sio_TXbuff);
-	  write(sio,sio_TXbuff,sio_TXlen); /* send message */
-         
-      /* get buffer content of module (if any)
-       * response may be an ACK sequence if nothing to xfer
-       * Set time wait = equivalent to 50 characters xfer (~ 13ms)
-       * return status does not matter - we are just forcing a buffer dump
-       */ 
-      msgget(50);
+      printf("logSTART - can't open %s: %s - logging to stdout\n", log_fname, strerror(errno));
+      log_fp = stdout;
       }
-    return NORMAL;
     }
-  	  
-  /* if this a properly composed message, this substring must be the slot# */
-  i2 = i1; /* index in s1 where we are */
-  while(s1[i2] != ' ')
+  if(pthread_create(&log_thread, NULL, logTSK, NULL) != 0)
     {
-    i3 = s1[i2]; /* get character */
-    if(isdigit(i3) == 0) return (status-1); /* should be a digit */
-    i2 = i2+1;
-    if(s1[i2] == '\0') return (status-2); /* unexpected end of string */
+    printf("logSTART - can't start log thread ...\n");
+    exit(1);
     }
-  s2[0] = '\0';
-  strncpy(s2,&s1[i1],i2-i1);
-  s2[i2-i1] = '\0';
-  sscanf(s2,"%d",&slot); /* slot number */
-  if((slot < 0) || (slot >= nSLOTS)) return (status-3); /* out of range slot# */
+  }
 
-  /* get rid of space(s) between slot# and submodule# */
-  i1 = i2;
-  while(s1[i1] == ' ')
-  	{
-  	i1 = i1+1;
-  	if(s1[i1] == '\0') return (status-4); /* unexpected end of string */
-  	}
 
-  /* the next substring must be the submodule# */
-  i2 = i1; /* index in s1 where we are */
-  while(s1[i2] != ' ')
+/* ======================================================================================
+ *
+ * Put a record in the capture ring - any thread, never blocks (as logREC()).
+ * data may be NULL; it is cut to HVPI_CAP_DATA bytes
+ *
+ * ======================================================================================
+ */
+void capREC(int type, int slot, uint32_t conn, int status, unsigned char *data, int len)
+  {
+  struct CapRec *pr;
+  uint32_t pos, seq;
+  uint64_t one = 1;
+
+  if(cap_ring == NULL) return;
+  pos = __atomic_load_n(&cap_head, __ATOMIC_RELAXED);
+  for(;;)
     {
-    i3 = s1[i2]; /* get character */
-    if(isdigit(i3) == 0) return (status-5); /* should be a digit */
-    i2 = i2+1;
-    if(s1[i2] == '\0') return (status-6); /* unexpected end of string */
+    pr = &cap_ring[pos & (nCAP - 1)];
+    seq = __atomic_load_n(&pr->seq, __ATOMIC_ACQUIRE);
+    if(seq == pos)
+      {
+      if(__atomic_compare_exchange_n(&cap_head, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) break;
+      }
+    else if((int32_t)(seq - pos) < 0)
+      {
+      __atomic_fetch_add(&cap_ndrop, 1, __ATOMIC_RELAXED);
+      return;
+      }
+    else pos = __atomic_load_n(&cap_head, __ATOMIC_RELAXED);
     }
-  s2[0] = '\0';
-  strncpy(s2,&s1[i1],i2-i1);
-  s2[i2-i1] = '\0';
-  sscanf(s2,"%d",&sm); /* submodule number */
-  if((sm < 0) || (sm >= nSUBMOD)) return (status-7); /* out of range submodule# */
- 
-  /* check that there is a ubit at this slot/submodule address */
-  if(SS2LU[slot][sm] < 0) return (status-8);
-  
-  /* get rid of space(s) between submodule# and module-cmd-syntax
-   * the space is already stored in the module header
+
+  if((data == NULL) || (len < 0)) len = 0;
+  if(len > HVPI_CAP_DATA) len = HVPI_CAP_DATA;
+  if(len > 0) memcpy(pr->data, data, len);
+  pr->h.len = sizeof(struct hvpi_cap_hdr) + len;
+  pr->h.type = type;
+  pr->h.slot = slot;
+  pr->h.conn = conn;
+  pr->h.status = status;
+  pr->h.t = usnow();
+  __atomic_store_n(&pr->seq, pos + 1, __ATOMIC_RELEASE);
+  /* the fill goes up one cell per record, so exactly one record crosses half full */
+  if(pos - __atomic_load_n(&cap_tail, __ATOMIC_RELAXED) == nCAP / 2) write(cap_wakefd, &one, sizeof(one));
+  }
+
+
+/* ======================================================================================
+ *
+ * Capture thread: a DROP record for the records lost since the last one, if any.
+ * Returns the bytes added to buf
+ *
+ * ======================================================================================
+ */
+int capDROP(unsigned char *buf, uint32_t *pnseen)
+  {
+  struct hvpi_cap_hdr hd;
+  uint32_t ndrop;
+
+  ndrop = __atomic_load_n(&cap_ndrop, __ATOMIC_ACQUIRE);
+  if(ndrop == *pnseen) return 0;
+  memset(&hd, 0, sizeof(hd));
+  hd.len = sizeof(hd);
+  hd.type = HVPI_CAP_DROP;
+  hd.slot = -1;
+  hd.status = ndrop - *pnseen;
+  hd.t = usnow();
+  memcpy(buf, &hd, sizeof(hd));
+  *pnseen = ndrop;
+  return sizeof(hd);
+  }
+
+
+/* ======================================================================================
+ *
+ * Capture thread - appends the records to the file in batches. A loss is recorded before
+ * the next record written, so that the DROP marks where the file has a gap. The thread
+ * is woken when the ring passes half full, or looks every 50 ms
+ *
+ * ======================================================================================
+ */
+void *capTSK(void *arg)
+  {
+  static unsigned char buf[L4096 * 16];
+  struct CapRec *pr;
+  struct pollfd pfd;
+  uint64_t count;
+  uint32_t nseen = 0;
+  int len;
+
+  pfd.fd = cap_wakefd;
+  pfd.events = POLLIN;
+
+  for(;;)
+    {
+    len = 0;
+    for(;;)
+      {
+      pr = &cap_ring[cap_tail & (nCAP - 1)];
+      if(__atomic_load_n(&pr->seq, __ATOMIC_ACQUIRE) != cap_tail + 1) break;
+      len = len + capDROP(&buf[len], &nseen);
+      memcpy(&buf[len], &pr->h, sizeof(pr->h));
+      memcpy(&buf[len + sizeof(pr->h)], pr->data, pr->h.len - sizeof(pr->h));
+      len = len + pr->h.len;
+      __atomic_store_n(&pr->seq, cap_tail + nCAP, __ATOMIC_RELEASE);
+      __atomic_store_n(&cap_tail, cap_tail + 1, __ATOMIC_RELAXED);
+      if(len > (int)sizeof(buf) - 2 * (int)sizeof(struct CapRec))
+        {
+        fwrite(buf, 1, len, cap_fp);
+        len = 0;
+        }
+      }
+    len = len + capDROP(&buf[len], &nseen);
+    if(len > 0)
+      {
+      fwrite(buf, 1, len, cap_fp);
+      fflush(cap_fp);
+      }
+    else if(poll(&pfd, 1, 50) > 0) read(cap_wakefd, &count, sizeof(count));
+    }
+  return NULL;
+  }
+
+
+/* ======================================================================================
+ *
+ * Open the capture file (append), mark the start of this run and start the capture thread
+ *
+ * ======================================================================================
+ */
+void capSTART(void)
+  {
+  struct hvpi_cap_filehdr fh;
+  int64_t twall;
+  uint32_t i1;
+
+  cap_fp = fopen(cap_fname, "ab");
+  cap_ring = (struct CapRec *)malloc(nCAP * sizeof(struct CapRec));
+  cap_wakefd = eventfd(0, EFD_NONBLOCK);
+  if((cap_fp == NULL) || (cap_ring == NULL) || (cap_wakefd < 0))
+    {
+    printf("capSTART - can't capture to %s: %s\n", cap_fname, strerror(errno));
+    exit(1);
+    }
+  if(ftell(cap_fp) == 0)
+    {
+    fh.magic = HVPI_CAP_MAGIC;
+    fh.version = HVPI_CAP_VERSION;
+    fh.pad = 0;
+    fwrite(&fh, sizeof(fh), 1, cap_fp);
+    }
+  for(i1 = 0; i1 < nCAP; i1++) cap_ring[i1].seq = i1;
+  twall = log_t0;
+  capREC(HVPI_CAP_START, -1, 0, clk_virtual, (unsigned char *)&twall, sizeof(twall));
+  if(pthread_create(&cap_thread, NULL, capTSK, NULL) != 0)
+    {
+    printf("capSTART - can't start capture thread ...\n");
+    exit(1);
+    }
+  }
+
+
+/* ======================================================================================
+ *
+ * Virtual clock: move time to the earliest deadline and wake the threads waiting for it.
+ * Called with bus_mutex held once no bus-driving thread is running
+ *
+ * ======================================================================================
+ */
+void clkADVANCE(void)
+  {
+  long long tmin = 0;
+  int iw;
+
+  for(iw = 0; iw < nCLKW; iw++)
+    {
+    if(clk_wait[iw].used && !clk_wait[iw].woken && (clk_wait[iw].t != 0) &&
+       ((tmin == 0) || (clk_wait[iw].t < tmin))) tmin = clk_wait[iw].t;
+    }
+  if(tmin == 0) return; /* all blocked on something else (a client, the bus) */
+  if(tmin > clk_now)
+    {
+    __atomic_store_n(&clk_now, tmin, __ATOMIC_RELEASE);
+    if(clk_vclk != NULL) __atomic_store_n(clk_vclk, tmin, __ATOMIC_RELEASE);
+    }
+  for(iw = 0; iw < nCLKW; iw++)
+    {
+    if(clk_wait[iw].used && !clk_wait[iw].woken && (clk_wait[iw].t != 0) && (clk_wait[iw].t <= clk_now))
+      {
+      clk_wait[iw].woken = 1;
+      clk_nrun++;
+      pthread_cond_signal(&clk_wait[iw].cond);
+      }
+    }
+  }
+
+
+/* ======================================================================================
+ *
+ * Virtual clock: a bus-driving thread blocks (clkIDLE) or is made runnable again by
+ * the thread that wakes it (clkRUN). Called with bus_mutex held; no-ops in real time
+ *
+ * ======================================================================================
+ */
+void clkIDLE(void)
+  {
+  if(clk_virtual == 0) return;
+  clk_nrun--;
+  if(clk_nrun == 0) clkADVANCE();
+  }
+
+void clkRUN(void)
+  {
+  if(clk_virtual == 0) return;
+  clk_nrun++;
+  }
+
+
+/* ======================================================================================
+ *
+ * Wait until usnow() >= tend, or *pflag >= 0 (pflag may be NULL; a change of the flag
+ * must be followed by clkKICK()). tend = 0 waits for the flag only
+ *
+ * ======================================================================================
+ */
+void clkUNTIL(long long tend, volatile int *pflag)
+  {
+  int iw;
+
+  pthread_mutex_lock(&bus_mutex);
+  for(iw = 0; (iw < nCLKW) && clk_wait[iw].used; iw++);
+  if(iw == nCLKW)
+    {
+    /* cannot happen - there are fewer bus-driving threads */
+    pthread_mutex_unlock(&bus_mutex);
+    return;
+    }
+  while(((tend == 0) || (clk_now < tend)) && ((pflag == NULL) || (*pflag < 0)))
+    {
+    clk_wait[iw].t = tend;
+    clk_wait[iw].used = 1;
+    clk_wait[iw].woken = 0;
+    clkIDLE();
+    while(clk_wait[iw].woken == 0) pthread_cond_wait(&clk_wait[iw].cond, &bus_mutex);
+    }
+  clk_wait[iw].used = 0;
+  pthread_mutex_unlock(&bus_mutex);
+  }
+
+
+/* ======================================================================================
+ *
+ * Wake every thread in clkUNTIL() to look at its flag again
+ *
+ * ======================================================================================
+ */
+void clkKICK(void)
+  {
+  int iw;
+
+  if(clk_virtual == 0) return;
+  pthread_mutex_lock(&bus_mutex);
+  for(iw = 0; iw < nCLKW; iw++)
+    {
+    if(clk_wait[iw].used && !clk_wait[iw].woken)
+      {
+      clk_wait[iw].woken = 1;
+      clk_nrun++;
+      pthread_cond_signal(&clk_wait[iw].cond);
+      }
+    }
+  pthread_mutex_unlock(&bus_mutex);
+  }
+
+
+/* ======================================================================================
+ *
+ * Sleep us microseconds of server time
+ *
+ * ======================================================================================
+ */
+void clkSLEEP(long long us)
+  {
+  if(clk_virtual == 0)
+    {
+    usleep(us);
+    return;
+    }
+  clkUNTIL(usnow() + us, NULL);
+  }
+
+
+/* ================================================================================
+ * 
+ * Current level of gpio pin (0 or 1)
+ *
+ * ================================================================================
+ */
+int attn_level(unsigned gpio)
+  {
+  unsigned bank = 0, bit;
+  struct gpiohandle_data data;
+  long long tup;
+
+  if(attn_mode == ATTN_FAKE) return (attn_fake != 0);
+  if(clk_virtual)
+    {
+    /* the simulator tells when its response is ready */
+    tup = __atomic_load_n(clk_vattn, __ATOMIC_ACQUIRE);
+    return (tup != 0) && (usnow() >= tup);
+    }
+  if(attn_mode == ATTN_CDEV)
+    {
+    if(ioctl(attn_fd, GPIOHANDLE_GET_LINE_VALUES_IOCTL, &data) < 0) return 0;
+    return (data.values[0] != 0);
+    }
+
+  /* The Broadcom BCM2835 processor has two registers holding the levels of the 
+   * 54 GPIO pins known to the system - 32 are in the first register, the remaining 22
+   * are in the second register
    */
-  i1 = i2;
-  while(s1[i1] == ' ')
-  	{
-  	i1 = i1+1;
-  	if(s1[i1] == '\0') return (status-9); /* unexpected end of string */
-  	}
-  /* Prepare and send message to module */
-  sio_TXbuff[0] = '\0';
-  strcpy(sio_TXbuff,pLU[SS2LU[slot][sm]]->hdr);
-  strcat(sio_TXbuff,&s1[i1]);
-  strcat(sio_TXbuff,"\n");  
-  sio_TXlen = strlen(sio_TXbuff);
-  write(sio,sio_TXbuff,sio_TXlen);
-  if((status=msgget(sio_TXlen+50)) != MSGstat_HNDSHK) 
-/*** 27-Jul-2014 ***/
+  if(gpio > 31) bank = 1;
+  bit = (1<<(gpio&0x1F));
+  /* Bank = 0 is the 13teen register from the base */
+  return ((*(gpioReg + 13 + bank) & bit) == bit);
+  }
+
+
+/* ================================================================================
+ * 
+ * Checks for wait_sec for gpio pin to be set, sampling the level every 5 ms
+ *
+ * ================================================================================
+ */
+int IsGpioPoll(unsigned gpio, float wait_sec)
+  {
+  int ntry=0, iloop;
+   
+  ntry = wait_sec*200.0; /* we check pin status every 5 millisec or 200 times/sec */
+  
+  for(iloop=0; iloop < ntry; iloop++) 
+     {
+     if (attn_level(gpio)) return NORMAL;
+     clkSLEEP(5000); /* sleep for 5 milliseconds */
+     }
+   return ABNORMAL;
+   }
+
+
+/* ================================================================================
+ * 
+ * Checks for wait_sec for the ATTN line to be set, sleeping in poll() until the
+ * backend reports a rising edge (GPIO character device or fake line eventfd)
+ *
+ * ================================================================================
+ */
+int IsGpioEvent(unsigned gpio, float wait_sec)
+  {
+  struct pollfd pfd;
+  struct gpioevent_data event;
+  uint64_t count;
+  long long tnow, tend;
+  int nready;
+
+  pfd.fd = attn_fd;
+  pfd.events = POLLIN;
+
+  /* drop edges left over from previous transactions */
+  while(poll(&pfd, 1, 0) > 0)
+    {
+    if(attn_mode == ATTN_FAKE) read(attn_fd, &count, sizeof(count));
+    else read(attn_fd, &event, sizeof(event));
+    }
+
+  /* the module may have raised the line before we got here */
+  if(attn_level(gpio)) return NORMAL;
+
+  tend = usnow() + (long long)(wait_sec * 1.0e6);
+  while((tnow = usnow()) < tend)
+    {
+    nready = poll(&pfd, 1, (int)((tend - tnow + 999) / 1000));
+    if(nready < 0)
+      {
+      if(errno == EINTR) continue;
+      return ABNORMAL;
+      }
+    if(nready == 0) break; /* timeout */
+    if(attn_mode == ATTN_FAKE) read(attn_fd, &count, sizeof(count));
+    else read(attn_fd, &event, sizeof(event));
+    if(attn_level(gpio)) return NORMAL;
+    }
+
+  /* last look in case the edge and the timeout coincide */
+  if(attn_level(gpio)) return NORMAL;
+  return ABNORMAL;
+  }
+
+
+/* ================================================================================
+ * 
+ * Checks for wait_sec for gpio pin to be set  
+ *
+ * ================================================================================
+ */
+int IsGpioSet(unsigned gpio, float wait_sec)
+  {
+  int status;
+
+  if(attn_mode == ATTN_MMAP) status = IsGpioPoll(gpio, wait_sec);
+  else status = IsGpioEvent(gpio, wait_sec);
+  capREC(HVPI_CAP_ATTN, cap_slot, 0, status == NORMAL, NULL, 0);
+  return status;
+  }
+
+
+/* ================================================================================
+ * 
+ * Set the level of the fake ATTN line. A rising edge wakes up IsGpioEvent()
+ *
+ * ================================================================================
+ */
+void attn_fake_set(int level)
+  {
+  uint64_t one = 1;
+  int old;
+
+  old = attn_fake;
+  attn_fake = level;
+  if((old == 0) && (level != 0)) write(attn_fd, &one, sizeof(one));
+  }
+
+
+/* ================================================================================
+ * 
+ * Setup access to the ATTN* line. If the GPIO character device cannot deliver
+ * edge events we fall back to mapping the GPIO registers.
+ *
+ * ================================================================================
+ */
+void attn_open(void)
+  {
+  struct gpioevent_request req;
+  int fd;
+
+  if(attn_mode == ATTN_FAKE)
+    {
+    attn_fd = eventfd(0, EFD_NONBLOCK);
+    if(attn_fd < 0)
+      {
+      printf("Unable to create eventfd for fake ATTN line ....\n");
+      exit(-1);
+      }
+    return;
+    }
+
+  if(attn_mode == ATTN_CDEV)
+    {
+    /* request GPIO23 as input with rising-edge events */
+    fd = open(ATTN_CHIP, O_RDONLY);
+    if(fd >= 0)
+      {
+      memset(&req, 0, sizeof(req));
+      req.lineoffset = ATTN_GPIO;
+      req.handleflags = GPIOHANDLE_REQUEST_INPUT;
+      req.eventflags = GPIOEVENT_REQUEST_RISING_EDGE;
+      strcpy(req.consumer_label, "i2lchv-attn");
+      if(ioctl(fd, GPIO_GET_LINEEVENT_IOCTL, &req) == 0) attn_fd = req.fd;
+      close(fd);
+      }
+    if(attn_fd >= 0) return;
+    printf("Unable to get ATTN events from %s - using /dev/mem ....\n", ATTN_CHIP);
+    attn_mode = ATTN_MMAP;
+    }
+
+  /* ATTN* signal from HV module is routed to GPIO23
+   * Setup system to access GPIO registers
+   * Access GPIO23 as input, no interrupt, pull/down disabled (all are defaults)
+   * MAPPING REQUIRES ROOT PRIVILIGES OR CHANGING ACCESS PREVILIGES OF /dev/mem 
+   */   
+   if(attn_file != NULL)
+     {
+     /* register image kept by a crate simulator (i2lchv_sim) */
+     fd = open(attn_file, O_RDWR);
+     if(fd < 0)
+       {
+       printf("Unable to open %s ....\n", attn_file);
+       exit(-1);
+       }
+     gpioReg = mmap(0, 4096, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+     close(fd);
+     if(gpioReg == MAP_FAILED)
+       {
+       printf("Unable to map %s ....\n", attn_file);
+       exit(-1);
+       }
+     if(clk_virtual)
+       {
+       /* virtual time, ATTN* time and serial counts are shared with the simulator */
+       clk_vclk = (volatile int64_t *)(gpioReg + GPIO_VCLK);
+       clk_vattn = (volatile int64_t *)(gpioReg + GPIO_VATTN);
+       clk_vframe = (volatile int64_t *)(gpioReg + GPIO_VFRAME);
+       clk_vbyte = (volatile int64_t *)(gpioReg + GPIO_VBYTE);
+       *clk_vattn = 0;
+       *clk_vclk = clk_now;
+       sio_ntx = *clk_vframe; /* the input was flushed */
+       sio_nrx = *clk_vbyte;
+       }
+     return;
+     }
+
+   fd = open("/dev/mem", O_RDWR | O_SYNC); /* needs to run as root!! */
+   if(fd < 0)
+     {
+     printf("Unable to open /dev/mem ....\n");
+     exit(-1);
+     }
+
+   gpioReg = mmap
+      (
+      0,
+      0xB4,     /* length of GPIO registers */
+      PROT_READ|PROT_WRITE|PROT_EXEC,
+      MAP_SHARED|MAP_LOCKED,
+      fd,
+      0x20200000); /* beginning of GPIO registers in memory */
+
+   close(fd);
+  }
+
+
+/* ======================================================================================
+ *
+ * Classify the message accumulated in sio_MSGbuff
+ *
+ * Return codes are the same as msgget(), except that -2 is never returned
+ *
+ * ======================================================================================
+ */
+int msgchk(void)
+  {
+  /* check for end-of-message sequence */
+  if(
+    (sio_MSGlen < 2) ||
+    (sio_MSGbuff[sio_MSGlen - 2] != 0x0d) || /* byte before last should be CR */
+    (sio_MSGbuff[sio_MSGlen - 1] != 0x0a) /* last byte should be LF */
+    )
+    {
+    /* data has been received but the end-of-message sequence was not found */
+    return MSGstat_noEOM;
+    }
+
+  /* found end-of-message sequence */
+  /* check that 1st byte is the ACK (0x06).
+   * Module could signal that it is not ready by setting this byte to NAK (0x15)
+   */
+  if(sio_MSGbuff[0] != 0x06) return MSGstat_noACK; /* end-of-message sequence but no ACK */
+
+  /* check if this is a handshake - we already know that ACK,CR & LF are in the buffer.
+   * So, we only need to check that the buffer length is 3-bytes
+   */
+  if(sio_MSGlen == 3) return MSGstat_HNDSHK;
+
+  return MSGstat_OK; /* end-of-message sequence and ACK */
+  }
+
+
+/* ======================================================================================
+ *
+ * Write a frame to the serial port. The first byte addresses the module (255 - SLOT#);
+ * it is remembered for the capture of the response and ATTN* wait that follow
+ *
+ * ======================================================================================
+ */
+int sioSEND(unsigned char *buf, int len)
+  {
+  int i1;
+
+  if((len > 0) && (buf[0] > 255 - nSLOTS)) cap_slot = 255 - buf[0];
+  capREC(HVPI_CAP_TX, cap_slot, 0, 0, buf, len);
+  for(i1 = 0; i1 < len; i1++) if(buf[i1] == '\n') sio_ntx++; /* frames end with LF */
+  return write(sio, buf, len);
+  }
+
+
+/* ======================================================================================
+ *
+ * Retrieve a message from serial port buffer (fixed-wait version, used until Oct-2026).
+ * (A) It waits the equivalent of nchars * USCHAR before each buffer retrieve.
+ * (B) If no character is received on the first attempt, it returns with status -2
+ * (C) It then attempts multiple retrieves (10 maximum) until either it does not get
+ * any further response or it finds the sequence 0x0d,0x0a (CR,LF) used by the LeCroy
+ * HV modules to signal an end-of-message.
+ * (D) If an end-of-message terminator was found, it checks if the message received
+ * is the 3-byte handshake sequence 0x06,0x0d,0x0a (ACK,CR,LF).
+ * 
+ * Return codes: see msgget()
+ *
+ * =======================================================================================
+ */
+int msgget_fixed(int nchar)
+  {
+  /* nchar is the expected number of characters in the transaction */
+  int iloop, stat;
+   
+  iloop = 0;
+  stat = MSGstat_NONE;
+  sio_MSGbuff[0] = '\0';
+  sio_MSGlen = 0;
+  
+  while(iloop < NTRIES) /* attempt to get complete message */
+    {
+    sio_RXlen = 0;
+    sio_RXbuff[0] = '\0';
+    iloop = iloop + 1;
+    clkSLEEP(USCHAR * nchar);
+	sio_RXlen = read(sio,sio_RXbuff,L256-1);
+	if(sio_RXlen > 0 )
+      {
+      sio_nrx = sio_nrx + sio_RXlen;
+      sio_RXbuff[sio_RXlen] = '\0';
+      strcat(sio_MSGbuff,sio_RXbuff);
+      sio_MSGlen = strlen(sio_MSGbuff);
+      stat = msgchk();
+
+      /* we are done - exit while */
+      if(stat != MSGstat_noEOM) break;
+      }
+    else
+      {
+      /* no response at all - bail out */
+/*** 03-08-2014      break;  keep loop  ***/
+      }
+    }
+         
+  /* return */
+  capREC(HVPI_CAP_RX, cap_slot, 0, stat, sio_MSGbuff, sio_MSGlen);
+  return stat;  
+  };
+
+
+/* ======================================================================================
+ *
+ * Retrieve a message from serial port buffer.
+ * (A) It blocks in poll() on the serial port and reads characters as they arrive.
+ * (B) It stops as soon as the buffer ends with the sequence 0x0d,0x0a (CR,LF) used by
+ * the LeCroy HV modules to signal an end-of-message, or when the deadline expires.
+ * The deadline is the worst case of the fixed-wait reader: NTRIES * nchars * USCHAR.
+ * With the virtual clock there is no deadline: the simulator counts the frames it took
+ * and the characters it wrote back, we wait until it took our last frame and all it
+ * wrote is in (nothing at all from an empty slot), then charge the wire time.
+ * (C) If an end-of-message terminator was found, it checks if the message received
+ * is the 3-byte handshake sequence 0x06,0x0d,0x0a (ACK,CR,LF).
+ * 
+ * Return codes,
+ *  -2  = no message received / other error
+ *  -1  = incomplete transaction: end-of-message sequence not found
+ *   0  = transaction has end-of-message sequence but no acknowledge (asserted NAK [0x15] likely)
+ *   1  = normal transaction: ACK, content, end-of-message sequence
+ *   2  = message received is the 3-byte handshake sequence (content is 0 bytes)
+ *
+ * =======================================================================================
+ */
+int msgget(int nchar)
+  {
+  /* nchar is the expected number of characters in the transaction */
+  struct pollfd pfd;
+  long long tnow, tend;
+  int stat, nready, tmo;
+
+  if(sio_fixed) return msgget_fixed(nchar);
+
+  stat = MSGstat_NONE;
+  sio_MSGbuff[0] = '\0';
+  sio_MSGlen = 0;
+  tend = usreal() + (long long)NTRIES * USCHAR * nchar;
+  pfd.fd = sio;
+  pfd.events = POLLIN;
+
+  for(;;) /* attempt to get complete message */
+    {
+    tnow = usreal();
+    if(clk_virtual)
+      {
+      tmo = 0;
+      if(__atomic_load_n(clk_vframe, __ATOMIC_ACQUIRE) >= sio_ntx)
+        {
+        if(sio_nrx >= __atomic_load_n(clk_vbyte, __ATOMIC_ACQUIRE)) break; /* all in */
+        tmo = 1; /* on its way */
+        }
+      }
+    else if(tnow >= tend) break;
+    else tmo = (int)((tend - tnow + 999) / 1000);
+    nready = poll(&pfd, 1, tmo);
+    if(nready < 0)
+      {
+      if(errno == EINTR) continue;
+      break; /* serial port error - bail out */
+      }
+    if(nready == 0)
+      {
+      if(clk_virtual == 0) break; /* deadline expired */
+      sched_yield(); /* let the simulator get to our frame */
+      continue;
+      }
+
+    sio_RXlen = read(sio, sio_RXbuff, L256-1);
+    if(sio_RXlen <= 0)
+      {
+      if(clk_virtual) break; /* the simulator is gone */
+      continue;
+      }
+    sio_nrx = sio_nrx + sio_RXlen;
+    if(sio_MSGlen + sio_RXlen >= L4096) sio_RXlen = L4096 - 1 - sio_MSGlen;
+    memcpy(&sio_MSGbuff[sio_MSGlen], sio_RXbuff, sio_RXlen);
+    sio_MSGlen = sio_MSGlen + sio_RXlen;
+    sio_MSGbuff[sio_MSGlen] = '\0';
+
+    /* we are done as soon as the end-of-message sequence is in */
+    stat = msgchk();
+    if(stat != MSGstat_noEOM) break;
+    if(sio_MSGlen >= L4096 - 1) break; /* no room left */
+    }
+
+  capREC(HVPI_CAP_RX, cap_slot, 0, stat, sio_MSGbuff, sio_MSGlen);
+
+  /* virtual clock: the time the characters take on the wire, or the whole wait */
+  if(clk_virtual) clkSLEEP((stat == MSGstat_NONE) ? (long long)NTRIES * USCHAR * nchar : (long long)USCHAR * sio_MSGlen);
+  return stat;
+  }
+
+
+/* =====================================================================================
+ *
+ * Bus queue statistics (called by the bus thread for _BUS): totals, then per class
+ * queue depth, transactions, average & maximum queue wait [ms], deadline misses
+ *
+ * =====================================================================================
+ */
+void busSTATS(unsigned char *out)
+  {
+  long long tup;
+  int ic;
+
+  pthread_mutex_lock(&bus_mutex);
+  tup = usnow() - bus_t0;
+  sprintf(out,
+    "BUS TXN %ld DEPTH %d MAXDEPTH %d WAIT %.2f BUSY %.2f RATE %.1f UTIL %.1f\n",
+    bus_ntxn, bus_depth, bus_maxdepth,
+    (bus_ntxn > 0) ? bus_twait / 1000.0 / bus_ntxn : 0.0, /* average ms in queue */
+    (bus_ntxn > 0) ? bus_tbusy / 1000.0 / bus_ntxn : 0.0, /* average ms on the bus */
+    (tup > 0) ? bus_ntxn * 1.0e6 / tup : 0.0,             /* transactions per second */
+    (tup > 0) ? bus_tbusy * 100.0 / tup : 0.0);           /* % of time the bus was busy */
+  for(ic = 0; ic < nCLASS; ic++)
+    {
+    sprintf(&out[strlen(out)],
+      "CLASS %s DEPTH %d TXN %ld WAIT %.2f MAXWAIT %.2f MISS %ld DEADLINE %d\n",
+      bus_cname[ic], bus_cdepth[ic], bus_cntxn[ic],
+      (bus_cntxn[ic] > 0) ? bus_cwait[ic] / 1000.0 / bus_cntxn[ic] : 0.0, /* average ms in queue */
+      bus_cmaxwait[ic] / 1000.0, bus_cmiss[ic], bus_deadline[ic]);
+    }
+  sprintf(&out[strlen(out)], "SCHED ATTN %.2f BOOST %ld SHARED %ld SEALED %ld\n",
+    bus_attn / 1000.0, bus_nboost, bus_ncoal, bus_nseal);
+  pthread_mutex_unlock(&bus_mutex);
+  }
+
+
+/* =====================================================================================
+ *
+ * Split string s into space separated words (in place). Returns the number of words
+ *
+ * =====================================================================================
+ */
+int strWords(unsigned char *s, unsigned char *w[], int nmax)
+  {
+  int nw = 0;
+
+  for(;;)
+    {
+    while((*s == ' ') || (*s == '\t')) s++;
+    if((*s == '\0') || (*s == '\r') || (*s == '\n')) break;
+    if(nw >= nmax) break;
+    w[nw++] = s;
+    while((*s != ' ') && (*s != '\t') && (*s != '\0') && (*s != '\r') && (*s != '\n')) s++;
+    if(*s == '\0') break;
+    *s++ = '\0';
+    }
+  return nw;
+  }
+
+
+/* =====================================================================================
+ *
+ * Histogram bin of a time in us: exact below 4 us, then 4 bins per power of two
+ *
+ * =====================================================================================
+ */
+int statBIN(long long dt)
+  {
+  int e = 0;
+
+  if(dt < 4) return (dt < 0) ? 0 : (int)dt;
+  while((dt >> e) >= 8) e++;
+  e = 4 + 4 * e + (int)((dt >> e) & 3);
+  return (e < nHBIN) ? e : nHBIN - 1;
+  }
+
+
+/* Largest time in us that falls into bin ib */
+long long statBINMAX(int ib)
+  {
+  if(ib < 4) return ib;
+  return ((long long)(4 + (ib & 3) + 1) << ((ib - 4) / 4)) - 1;
+  }
+
+
+/* =====================================================================================
+ *
+ * Command verb index (stat_vname) of a module command
+ *
+ * =====================================================================================
+ */
+int statVERB(unsigned char *mcmd)
+  {
+  int iv, len;
+
+  while(*mcmd == ' ') mcmd++;
+  for(iv = 0; iv < nVERB - 1; iv++)
+    {
+    len = strlen(stat_vname[iv]);
+    if((strncmp(mcmd, stat_vname[iv], len) == 0) && ((mcmd[len] == ' ') || (mcmd[len] == '\0'))) break;
+    }
+  return iv;
+  }
+
+
+/* =====================================================================================
+ *
+ * Record dt us for stage ist of a command with verb iv to slot (slot < 0: verb only)
+ *
+ * =====================================================================================
+ */
+void statHIST(struct Hist *ph, long long dt)
+  {
+  uint32_t us = (dt > 0xffffffffLL) ? 0xffffffff : ((dt < 0) ? 0 : (uint32_t)dt);
+
+  __atomic_fetch_add(&ph->bin[statBIN(dt)], 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&ph->n, 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&ph->sum, us, __ATOMIC_RELAXED);
+  if(us > __atomic_load_n(&ph->max, __ATOMIC_RELAXED)) __atomic_store_n(&ph->max, us, __ATOMIC_RELAXED);
+  }
+
+void statREC(int ist, int iv, int slot, long long dt)
+  {
+  statHIST(&stat_verb[ist][iv], dt);
+  if((slot >= 0) && (slot < nSLOTS)) statHIST(&stat_slot[ist][slot], dt);
+  }
+
+
+/* Count a msgget() outcome (rsp: 0 = handshake, 1 = response) */
+void statMSG(int rsp, int status)
+  {
+  if((status >= MSGstat_NONE) && (status <= MSGstat_HNDSHK))
+    __atomic_fetch_add(&stat_msg[rsp][status - MSGstat_NONE], 1, __ATOMIC_RELAXED);
+  }
+
+
+/* Count an error return code (of cmdParse(), cmdEXE(), ...) - of slot if >= 0 */
+void statERR(int status, int slot)
+  {
+  int ie = -1;
+
+  if(status == NORMAL) return;
+  if((status <= ABNORMAL) && (status > ABNORMAL - 16)) ie = ABNORMAL - status;
+  else if((status >= MSGstat_NONE) && (status <= MSGstat_HNDSHK)) ie = 16 + status - MSGstat_NONE;
+  if(ie >= 0) __atomic_fetch_add(&stat_err[ie], 1, __ATOMIC_RELAXED);
+  if((slot >= 0) && (slot < nSLOTS)) __atomic_fetch_add(&stat_serr[slot], 1, __ATOMIC_RELAXED);
+  }
+
+
+/* =====================================================================================
+ *
+ * One line of stage statistics: transactions, average, percentiles & maximum in us.
+ * Returns the number of characters written
+ *
+ * =====================================================================================
+ */
+int statLINE(unsigned char *out, const char *label, struct Hist *ph)
+  {
+  uint32_t bin[nHBIN], n = 0, cum = 0, max;
+  long long p[3];
+  int ib, ip = 0;
+  double pq[3] = {0.50, 0.90, 0.99};
+
+  for(ib = 0; ib < nHBIN; ib++)
+    {
+    bin[ib] = __atomic_load_n(&ph->bin[ib], __ATOMIC_RELAXED);
+    n = n + bin[ib];
+    }
+  p[0] = p[1] = p[2] = 0;
+  for(ib = 0; (ib < nHBIN) && (ip < 3); ib++)
+    {
+    cum = cum + bin[ib];
+    while((ip < 3) && (cum > 0) && (cum >= pq[ip] * n)) p[ip++] = statBINMAX(ib);
+    }
+  /* the top of a bin may be beyond the largest time seen */
+  max = __atomic_load_n(&ph->max, __ATOMIC_RELAXED);
+  for(ip = 0; ip < 3; ip++) if(p[ip] > max) p[ip] = max;
+  return sprintf(out, "%s N %u AVG %.0f P50 %lld P90 %lld P99 %lld MAX %u\n", label, n,
+    (n > 0) ? (double)__atomic_load_n(&ph->sum, __ATOMIC_RELAXED) / n : 0.0,
+    p[0], p[1], p[2], max);
+  }
+
+
+/* =====================================================================================
+ *
+ * Statistics text (_STATS [VERB|SLOT#|CLEAR], SIGUSR1): without argument the stages over
+ * all commands, msgget() outcomes, error codes and one EXE line per slot; with a verb or
+ * a slot# the stages of that verb or slot. Times in us
+ *
+ * =====================================================================================
+ */
+int statTEXT(unsigned char *arg, unsigned char *out)
+  {
+  struct Hist sum;
+  unsigned char lbl[L256], c[L256], *w[2];
+  int ist, iv, ib, is, n = 0, nw;
+
+  if(strlen(arg) >= L256) return ABNORMAL;
+  strcpy(c, arg);
+  nw = strWords(c, w, 2);
+  if((nw > 0) && (strcmp(w[0], "CLEAR") == 0))
+    {
+    memset(stat_verb, 0, sizeof(stat_verb));
+    memset(stat_slot, 0, sizeof(stat_slot));
+    memset(stat_msg, 0, sizeof(stat_msg));
+    memset(stat_err, 0, sizeof(stat_err));
+    memset(stat_serr, 0, sizeof(stat_serr));
+    strcpy(out, "STATS CLEARED\n");
+    return NORMAL;
+    }
+  if((nw > 0) && isdigit(w[0][0]))
+    {
+    is = atoi(w[0]);
+    if(is >= nSLOTS) return ABNORMAL;
+    n += sprintf(&out[n], "STATS SLOT %d ERR %u [us]\n", is, stat_serr[is]);
+    for(ist = 0; ist < nSTAGE; ist++) n += statLINE(&out[n], stat_sname[ist], &stat_slot[ist][is]);
+    return NORMAL;
+    }
+  if(nw > 0)
+    {
+    iv = statVERB(w[0]);
+    if((iv == nVERB - 1) && (strcmp(w[0], stat_vname[iv]) != 0)) return ABNORMAL;
+    n += sprintf(&out[n], "STATS %s [us]\n", stat_vname[iv]);
+    for(ist = 0; ist < nSTAGE; ist++) n += statLINE(&out[n], stat_sname[ist], &stat_verb[ist][iv]);
+    return NORMAL;
+    }
+
+  /* all verbs together */
+  n += sprintf(&out[n], "STATS [us]\n");
+  for(ist = 0; ist < nSTAGE; ist++)
+    {
+    memset(&sum, 0, sizeof(sum));
+    for(iv = 0; iv < nVERB; iv++)
+      {
+      for(ib = 0; ib < nHBIN; ib++) sum.bin[ib] += __atomic_load_n(&stat_verb[ist][iv].bin[ib], __ATOMIC_RELAXED);
+      sum.sum += __atomic_load_n(&stat_verb[ist][iv].sum, __ATOMIC_RELAXED);
+      if(stat_verb[ist][iv].max > sum.max) sum.max = stat_verb[ist][iv].max;
+      }
+    n += statLINE(&out[n], stat_sname[ist], &sum);
+    }
+  for(iv = 0; iv < 2; iv++)
+    {
+    n += sprintf(&out[n], "MSG %s NONE %u NOEOM %u NOACK %u OK %u HNDSHK %u\n", (iv == 0) ? "HNDSHK" : "RSP",
+      stat_msg[iv][0], stat_msg[iv][1], stat_msg[iv][2], stat_msg[iv][3], stat_msg[iv][4]);
+    }
+  n += sprintf(&out[n], "ERR");
+  for(ib = 0; ib < nERRC; ib++)
+    {
+    if(stat_err[ib] == 0) continue;
+    if(ib < 16) n += sprintf(&out[n], " ABNORMAL-%d %u", ib, stat_err[ib]);
+    else n += sprintf(&out[n], " MSG%d %u", ib - 16 + MSGstat_NONE, stat_err[ib]);
+    }
+  n += sprintf(&out[n], "\n");
+  for(is = 0; is < nSLOTS; is++)
+    {
+    if((stat_slot[ST_EXE][is].n == 0) && (stat_serr[is] == 0)) continue;
+    sprintf(lbl, "SLOT %d ERR %u EXE", is, stat_serr[is]);
+    n += statLINE(&out[n], lbl, &stat_slot[ST_EXE][is]);
+    }
+  return NORMAL;
+  }
+
+
+/* SIGUSR1 - the event loop prints the statistics */
+void statSIG(int sig)
+  {
+  uint64_t one = 1;
+
+  stat_dump = 1;
+  if(net_wakefd >= 0) write(net_wakefd, &one, sizeof(one));
+  }
+
+
+/* =====================================================================================
+ *
+ * Index of property name in the cache of a logic unit; if add is set an unknown name
+ * gets the next free index. Returns -1 if not found (or no room). Call with cache_mutex
+ *
+ * =====================================================================================
+ */
+int cacheProp(struct LUnit *plu, unsigned char *name, int add)
+  {
+  int ip;
+
+  for(ip = 0; ip < plu->nprop; ip++)
+    {
+    if(strcmp(plu->pname[ip], name) == 0) return ip;
+    }
+  if((add == 0) || (plu->nprop >= nPROP) || (strlen(name) >= L16)) return -1;
+  ip = plu->nprop;
+  strcpy(plu->pname[ip], name);
+  plu->nval[ip] = 0;
+  plu->nprop = plu->nprop + 1;
+  return ip;
+  }
+
+
+/* =====================================================================================
+ *
+ * Store a value in the cache. Call with cache_mutex. Returns 1 if the value changed
+ *
+ * =====================================================================================
+ */
+int cacheSet(struct CVal *pv, unsigned char *txt, long long tnow)
+  {
+  int chg = (pv->tread == 0) || (strncmp(pv->txt, txt, L16 - 1) != 0);
+
+  strncpy(pv->txt, txt, L16 - 1);
+  pv->txt[L16 - 1] = '\0';
+  pv->val = atof(txt);
+  pv->tread = tnow;
+  return chg;
+  }
+
+
+/* =====================================================================================
+ *
+ * Create (or take over) the shared-memory file the crate state is published in
+ *
+ * =====================================================================================
+ */
+int shmOPEN(unsigned char *fname)
+  {
+  struct hvpi_shm *p;
+  int fd;
+
+  fd = open(fname, O_RDWR | O_CREAT, 0644);
+  if(fd < 0)
+    {
+    printf("shmOPEN - can't open %s: %s\n", fname, strerror(errno));
+    return ABNORMAL;
+    }
+  if(ftruncate(fd, sizeof(struct hvpi_shm)) != 0)
+    {
+    printf("shmOPEN - can't size %s: %s\n", fname, strerror(errno));
+    close(fd);
+    return ABNORMAL;
+    }
+  p = (struct hvpi_shm *)mmap(NULL, sizeof(struct hvpi_shm), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if(p == MAP_FAILED)
+    {
+    printf("shmOPEN - can't map %s: %s\n", fname, strerror(errno));
+    return ABNORMAL;
+    }
+
+  /* readers of a previous run may still have it mapped - magic goes last */
+  p->magic = 0;
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  memset(&p->version, 0, sizeof(struct hvpi_shm) - sizeof(p->magic));
+  p->version = HVPI_SHM_VERSION;
+  p->size = sizeof(struct hvpi_shm);
+  p->nlu = HVPI_NLU;
+  p->pid = getpid();
+  p->tstart = usnow();
+  __atomic_store_n(&p->magic, HVPI_SHM_MAGIC, __ATOMIC_RELEASE);
+  shm_base = p;
+  return NORMAL;
+  }
+
+
+/* =====================================================================================
+ *
+ * Publish logic unit plu (NULL = none) at index ilu of the shared-memory file. The
+ * sequence counter is odd while the record changes. Call with cache_mutex
+ *
+ * =====================================================================================
+ */
+void shmLU(int ilu, struct LUnit *plu)
+  {
+  struct hvpi_lu *p;
+  uint32_t seq;
+  int ip, ich;
+
+  if(shm_base == NULL) return;
+  p = &shm_base->lu[ilu];
+  seq = p->seq;
+  __atomic_store_n(&p->seq, seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+
+  p->present = (plu != NULL);
+  if(plu != NULL)
+    {
+    p->slot = plu->slot;
+    p->smod = plu->smod;
+    p->nsmod = plu->nsmod;
+    snprintf(p->type, sizeof p->type, "%s", LU_type[plu->lutype]);
+    snprintf(p->id, sizeof p->id, "%.*s", HVPI_LID - 1, plu->id);
+    p->nprop = plu->propok ? plu->nprop : 0;
+    for(ip = 0; ip < nPROP; ip++)
+      {
+      memcpy(p->pname[ip], plu->pname[ip], L16);
+      p->nval[ip] = plu->nval[ip];
+      for(ich = 0; ich < nCHAN; ich++)
+        {
+        p->val[ip][ich] = plu->val[ip][ich].val;
+        p->tread[ip][ich] = plu->val[ip][ich].tread;
+        }
+      p->psum[ip] = strtoul(plu->psum[ip].txt, NULL, 16);
+      }
+    p->npsum = plu->npsum;
+    p->tpsum = plu->psum[0].tread;
+    }
+  p->tupdate = usnow();
+
+  __atomic_store_n(&p->seq, seq + 2, __ATOMIC_RELEASE);
+  }
+
+
+/* =====================================================================================
+ *
+ * Publish the whole logic unit table (at start and when the crate changed; called by
+ * the bus thread, the only writer of the table, or before it runs)
+ *
+ * =====================================================================================
+ */
+void shmTOPO(void)
+  {
+  int is, ism;
+
+  if(shm_base == NULL) return;
+  pthread_mutex_lock(&cache_mutex);
+  for(is = 0; is < nSLOTS; is++)
+    {
+    for(ism = 0; ism < nSUBMOD; ism++)
+      {
+      shmLU(is * nSUBMOD + ism, (SS2LU[is][ism] >= 0) ? pLU[SS2LU[is][ism]] : NULL);
+      }
+    }
+  shm_base->ntopo = shm_base->ntopo + 1;
+  pthread_mutex_unlock(&cache_mutex);
+  }
+
+
+/* =====================================================================================
+ *
+ * Is the module command a read the cache can answer? RC <prop>, DMP <chan> and PSUM
+ *
+ * =====================================================================================
+ */
+int cacheRead(unsigned char *mcmd)
+  {
+  unsigned char c[L256], *w[4];
+  int nw;
+
+  if(strlen(mcmd) >= L256) return 0;
+  strcpy(c, mcmd);
+  nw = strWords(c, w, 4);
+  if((nw == 2) && (strcmp(w[0], "RC") == 0)) return 1;
+  if((nw == 2) && (strcmp(w[0], "DMP") == 0) && isdigit(w[1][0])) return 1;
+  if((nw == 1) && (strcmp(w[0], "PSUM") == 0)) return 1;
+  return 0;
+  }
+
+
+/* =====================================================================================
+ *
+ * Scheduling class of a module command: HVON/HVOFF, reads or other (writes)
+ *
+ * =====================================================================================
+ */
+int cmdClass(unsigned char *mcmd)
+  {
+  unsigned char c[L256], *w[2];
+
+  if(strlen(mcmd) >= L256) return CLS_IWRITE;
+  strcpy(c, mcmd);
+  if(strWords(c, w, 2) < 1) return CLS_IWRITE;
+  if((strcmp(w[0], "HVON") == 0) || (strcmp(w[0], "HVOFF") == 0)) return CLS_SAFETY;
+  if((strcmp(w[0], "RC") == 0) || (strcmp(w[0], "DMP") == 0) ||
+     (strcmp(w[0], "PSUM") == 0) || (strcmp(w[0], "PROP") == 0) ||
+     (strcmp(w[0], "ID") == 0) || (strcmp(w[0], "ATTR") == 0) ||
+     (strcmp(w[0], "HVSTATUS") == 0) || (strcmp(w[0], "SM") == 0)) return CLS_IREAD;
+  return CLS_IWRITE;
+  }
+
+
+/* =====================================================================================
+ *
+ * Feed the cache with a module transaction (called by the bus thread):
+ *   - RC, DMP and PSUM responses store the values with the time they were read
+ *   - PROP responses fix the property order (needed to decode DMP)
+ *   - LD invalidates the channels it loaded and the PSUM counters
+ *   - any other command that is not a plain read invalidates the whole logic unit
+ * ok is set when the module answered; a failed write invalidates all the same.
+ * A changed value wakes the event loop if there are subscriptions. The logic unit is
+ * published in the shared-memory file
+ *
+ * =====================================================================================
+ */
+void cacheUpdate(struct LUnit *plu, unsigned char *mcmd, unsigned char *rsp, int ok)
+  {
+  unsigned char c[L256], r[L4096], *wc[8], *wr[L256];
+  long long tnow;
+  uint64_t one = 1;
+  int nc, nr, ip, ich, i1, nchg = 0;
+
+  if(strlen(mcmd) >= L256) return;
+  strcpy(c, mcmd);
+  nc = strWords(c, wc, 8);
+  if(nc < 1) return;
+
+  pthread_mutex_lock(&cache_mutex);
+  if((strcmp(wc[0], "RC") == 0) || (strcmp(wc[0], "DMP") == 0) ||
+     (strcmp(wc[0], "PSUM") == 0) || (strcmp(wc[0], "PROP") == 0) ||
+     (strcmp(wc[0], "ID") == 0) || (strcmp(wc[0], "ATTR") == 0) ||
+     (strcmp(wc[0], "HVSTATUS") == 0) || (strcmp(wc[0], "SM") == 0))
+    {
+    /* read - response is "ticket# CMD [args] values" */
+    if(ok == 0) goto done;
+    strncpy(r, rsp, L4096 - 1);
+    r[L4096 - 1] = '\0';
+    nr = strWords(r, wr, L256);
+    if((nr < 2) || (strcmp(wr[1], wc[0]) != 0)) goto done;
+    tnow = usnow();
+
+    if(strcmp(wc[0], "ID") == 0)
+      {
+      if(strlen(rsp) < L256) strcpy(plu->rid, rsp);
+      }
+    else if((strcmp(wc[0], "ATTR") == 0) && (nc == 2) && (nr >= 3) && (strcmp(wr[2], wc[1]) == 0))
+      {
+      ip = cacheProp(plu, wc[1], 0);
+      if((ip >= 0) && (strlen(rsp) < L256)) strcpy(plu->rattr[ip], rsp);
+      }
+    else if(strcmp(wc[0], "PROP") == 0)
+      {
+      /* keep the values if the order did not change */
+      for(i1 = 2; i1 < nr; i1++)
+        {
+        if((i1 - 2 >= plu->nprop) || (strcmp(plu->pname[i1 - 2], wr[i1]) != 0)) break;
+        }
+      if((i1 < nr) || (nr - 2 != plu->nprop))
+        {
+        plu->nprop = 0;
+        plu->npsum = 0;
+        memset(plu->nval, 0, sizeof(plu->nval));
+        memset(plu->val, 0, sizeof(plu->val));
+        memset(plu->psum, 0, sizeof(plu->psum));
+        memset(plu->rattr, 0, sizeof(plu->rattr));
+        cache_ninval++;
+        for(i1 = 2; i1 < nr; i1++) cacheProp(plu, wr[i1], 1);
+        }
+      plu->propok = 1;
+      if(strlen(rsp) < L256) strcpy(plu->rprop, rsp);
+      }
+    else if((strcmp(wc[0], "RC") == 0) && (nc == 2) && (nr >= 3) && (strcmp(wr[2], wc[1]) == 0))
+      {
+      ip = cacheProp(plu, wc[1], 1);
+      if(ip < 0) goto done;
+      for(ich = 0; (ich < nCHAN) && (ich + 3 < nr); ich++) nchg += cacheSet(&plu->val[ip][ich], wr[ich + 3], tnow);
+      plu->nval[ip] = ich;
+      cache_nstore++;
+      }
+    else if((strcmp(wc[0], "DMP") == 0) && (nc == 2) && (nr >= 3) && (strcmp(wr[2], wc[1]) == 0))
+      {
+      /* one value per property, in PROP order */
+      ich = atoi(wc[1]);
+      if((plu->propok == 0) || (nr - 3 != plu->nprop) || (ich < 0) || (ich >= nCHAN)) goto done;
+      for(ip = 0; ip < plu->nprop; ip++)
+        {
+        nchg += cacheSet(&plu->val[ip][ich], wr[ip + 3], tnow);
+        if(plu->nval[ip] <= ich) plu->nval[ip] = ich + 1;
+        }
+      cache_nstore++;
+      }
+    else if((strcmp(wc[0], "PSUM") == 0) && (nc == 1))
+      {
+      /* a property whose change counter did not move since the previous PSUM still has
+       * the values read after that PSUM - they are good as of now
+       */
+      for(ip = 0; plu->propok && (ip < plu->nprop) && (ip < plu->npsum) && (ip + 2 < nr); ip++)
+        {
+        if((plu->psum[ip].tread == 0) || (strcmp(plu->psum[ip].txt, wr[ip + 2]) != 0)) continue;
+        for(ich = 0; ich < plu->nval[ip]; ich++)
+          {
+          if(plu->val[ip][ich].tread < plu->psum[ip].tread) break;
+          }
+        if(ich < plu->nval[ip]) continue;
+        for(ich = 0; ich < plu->nval[ip]; ich++) plu->val[ip][ich].tread = tnow;
+        }
+      for(i1 = 0; (i1 < nPROP) && (i1 + 2 < nr); i1++) cacheSet(&plu->psum[i1], wr[i1 + 2], tnow);
+      plu->npsum = i1;
+      cache_nstore++;
+      }
+    goto done;
+    }
+
+  cache_ninval++;
+  for(i1 = 0; i1 < plu->npsum; i1++) plu->psum[i1].tread = 0; /* counters will move */
+  if((strcmp(wc[0], "LD") == 0) && (nc >= 2) && ((ip = cacheProp(plu, wc[1], 0)) >= 0))
+    {
+    /* LD <prop> <first-channel> values... */
+    ich = 0;
+    i1 = nCHAN;
+    if((nc >= 3) && isdigit(wc[2][0]))
+      {
+      ich = atoi(wc[2]);
+      i1 = ich + ((nc > 3) ? nc - 3 : nCHAN);
+      }
+    for(; (ich < i1) && (ich < nCHAN); ich++) plu->val[ip][ich].tread = 0;
+    goto done;
+    }
+  for(ip = 0; ip < plu->nprop; ip++)
+    {
+    for(ich = 0; ich < nCHAN; ich++) plu->val[ip][ich].tread = 0;
+    }
+
+done:
+  shmLU(plu->slot * nSUBMOD + plu->smod, plu);
+  if((nchg > 0) && (sub_n > 0)) sub_gen++;
+  else nchg = 0;
+  pthread_mutex_unlock(&cache_mutex);
+  if((nchg > 0) && (net_wakefd >= 0)) write(net_wakefd, &one, sizeof(one));
+  }
+
+
+/* =====================================================================================
+ *
+ * Response prefix of a command to a logic unit: the ticket# of the command (first word
+ * of the header, the module echoes it) and a space. Returns the length
+ *
+ * =====================================================================================
+ */
+int luTICKET(struct LUnit *plu, unsigned char *out)
+  {
+  int n;
+
+  n = strcspn(&plu->hdr[2], " ");
+  memcpy(out, &plu->hdr[2], n);
+  out[n++] = ' ';
+  out[n] = '\0';
+  return n;
+  }
+
+
+/* =====================================================================================
+ *
+ * Logic unit at slot/submodule, returned with cache_mutex held (the unit can't be freed
+ * while we hold it). NULL = no logic unit there, cache_mutex not held
+ *
+ * =====================================================================================
+ */
+struct LUnit *luLOCK(int slot, int sm)
+  {
+  struct LUnit *plu;
+
+  pthread_rwlock_rdlock(&topo_lock);
+  plu = (SS2LU[slot][sm] >= 0) ? pLU[SS2LU[slot][sm]] : NULL;
+  if(plu != NULL) pthread_mutex_lock(&cache_mutex);
+  pthread_rwlock_unlock(&topo_lock);
+  return plu;
+  }
+
+
+/* =====================================================================================
+ *
+ * Answer a cacheable read from the cache if every value it returns was read from the
+ * hardware less than ptx->maxage ms ago (called by the event loop). Return codes,
+ *  0 = not in the cache (or too old) - the command has to go to the module
+ *  1 = response is in ptx->rsp
+ *
+ * =====================================================================================
+ */
+int cacheLookup(struct BusTxn *ptx)
+  {
+  struct LUnit *plu;
+  unsigned char c[L256], *w[4];
+  long long told;
+  int ip, ich, n = 0;
+
+  strcpy(c, &ptx->cmd[ptx->moff]); /* cacheRead() checked the length */
+  strWords(c, w, 4);
+  told = (ptx->maxage == CACHE_STALE) ? 0 : usnow() - (long long)ptx->maxage * 1000;
+  ptx->tdata = usnow();
+
+  plu = luLOCK(ptx->slot, ptx->sm);
+  if(plu == NULL) return 0;
+  n = luTICKET(plu, ptx->rsp);
+  if(strcmp(w[0], "RC") == 0)
+    {
+    ip = cacheProp(plu, w[1], 0);
+    if((ip < 0) || (plu->nval[ip] == 0)) goto miss;
+    n += sprintf(&ptx->rsp[n], "RC %s", w[1]);
+    for(ich = 0; ich < plu->nval[ip]; ich++)
+      {
+      if(plu->val[ip][ich].tread <= told) goto miss;
+      if(plu->val[ip][ich].tread < ptx->tdata) ptx->tdata = plu->val[ip][ich].tread;
+      n += sprintf(&ptx->rsp[n], " %s", plu->val[ip][ich].txt);
+      }
+    }
+  else if(strcmp(w[0], "DMP") == 0)
+    {
+    ich = atoi(w[1]);
+    if((plu->propok == 0) || (plu->nprop == 0) || (ich >= nCHAN)) goto miss;
+    n += sprintf(&ptx->rsp[n], "DMP %s", w[1]);
+    for(ip = 0; ip < plu->nprop; ip++)
+      {
+      if(plu->val[ip][ich].tread <= told) goto miss;
+      if(plu->val[ip][ich].tread < ptx->tdata) ptx->tdata = plu->val[ip][ich].tread;
+      n += sprintf(&ptx->rsp[n], " %s", plu->val[ip][ich].txt);
+      }
+    }
+  else
+    {
+    if(plu->npsum == 0) goto miss;
+    n += sprintf(&ptx->rsp[n], "PSUM");
+    for(ich = 0; ich < plu->npsum; ich++)
+      {
+      if(plu->psum[ich].tread <= told) goto miss;
+      if(plu->psum[ich].tread < ptx->tdata) ptx->tdata = plu->psum[ich].tread;
+      n += sprintf(&ptx->rsp[n], " %s", plu->psum[ich].txt);
+      }
+    }
+  strcpy(&ptx->rsp[n], "\r\n");
+  ptx->rsplen = n + 2;
+  cache_nhit++;
+  pthread_mutex_unlock(&cache_mutex);
+  return 1;
+
+miss:
+  cache_nmiss++;
+  pthread_mutex_unlock(&cache_mutex);
+  ptx->rsp[0] = '\0';
+  ptx->rsplen = 0;
+  return 0;
+  }
+
+
+/* =====================================================================================
+ *
+ * Answer ID, PROP and ATTR <prop> from the module metadata collected at discovery
+ * (called by the event loop), with the ticket# of this command. Return codes,
+ *  0 = not known - the command has to go to the module
+ *  1 = response is in ptx->rsp
+ *
+ * =====================================================================================
+ */
+int metaLookup(struct BusTxn *ptx)
+  {
+  struct LUnit *plu;
+  unsigned char c[L256], *w[4], *pm = NULL;
+  int nw, ip, n;
+
+  if(strlen(&ptx->cmd[ptx->moff]) >= L256) return 0;
+  strcpy(c, &ptx->cmd[ptx->moff]);
+  nw = strWords(c, w, 4);
+
+  plu = luLOCK(ptx->slot, ptx->sm);
+  if(plu == NULL) return 0;
+  if((nw == 1) && (strcmp(w[0], "ID") == 0)) pm = plu->rid;
+  else if((nw == 1) && (strcmp(w[0], "PROP") == 0) && plu->propok) pm = plu->rprop;
+  else if((nw == 2) && (strcmp(w[0], "ATTR") == 0) && plu->propok)
+    {
+    ip = cacheProp(plu, w[1], 0);
+    if(ip >= 0) pm = plu->rattr[ip];
+    }
+  if((pm == NULL) || (pm[0] == '\0'))
+    {
+    pthread_mutex_unlock(&cache_mutex);
+    return 0;
+    }
+  /* the stored response starts with the ticket# of the command that read it */
+  pm = pm + strcspn(pm, " ");
+  n = luTICKET(plu, ptx->rsp);
+  strcpy(&ptx->rsp[n], pm + strspn(pm, " "));
+  ptx->rsplen = strlen(ptx->rsp);
+  cache_nmeta++;
+  pthread_mutex_unlock(&cache_mutex);
+  return 1;
+  }
+
+
+/* =====================================================================================
+ *
+ * Value cache statistics (_CACHE)
+ *
+ * =====================================================================================
+ */
+void cacheSTATS(unsigned char *out)
+  {
+  pthread_mutex_lock(&cache_mutex);
+  sprintf(out, "CACHE HIT %ld MISS %ld STORE %ld INVAL %ld META %ld SWEEP %ld PSUM %ld RC %ld\n",
+    cache_nhit, cache_nmiss, cache_nstore, cache_ninval, cache_nmeta,
+    poll_nsweep, poll_npsum, poll_nrc);
+  pthread_mutex_unlock(&cache_mutex);
+  }
+
+
+/* =====================================================================================
+ *
+ * Circuit breaker: may this module command go to the bus? Always while the module
+ * answers; once it is degraded, only one trial every brk_probe ms (ptx->brk is set).
+ * Return codes,
+ *  0 = no - answer from the cache or fail
+ *  1 = yes
+ *
+ * =====================================================================================
+ */
+int brkALLOW(struct BusTxn *ptx)
+  {
+  struct Health *ph;
+  long long tnow;
+  int ok = 1;
+
+  ptx->brk = 0;
+  if((brk_nfail <= 0) || (ptx->slot < 0) || (ptx->slot >= nSLOTS)) return 1;
+  ph = &brk_slot[ptx->slot];
+  pthread_mutex_lock(&brk_mutex);
+  if(ph->state != BRK_CLOSED)
+    {
+    tnow = usnow();
+    if(tnow >= ph->tprobe)
+      {
+      ph->state = BRK_TRIAL;
+      ph->tprobe = tnow + brk_probe * 1000LL;
+      ph->ntrial++;
+      ptx->brk = 1;
+      }
+    else ok = 0;
+    }
+  pthread_mutex_unlock(&brk_mutex);
+  return ok;
+  }
+
+
+/* =====================================================================================
+ *
+ * Circuit breaker, in the bus thread: a command queued before its module was degraded
+ * does not go on the bus, unless it is the trial. Returns 1 if it may go
+ *
+ * =====================================================================================
+ */
+int brkPASS(struct BusTxn *ptx)
+  {
+  int ok;
+
+  if((brk_nfail <= 0) || ptx->brk) return 1;
+  pthread_mutex_lock(&brk_mutex);
+  ok = (brk_slot[ptx->slot].state == BRK_CLOSED);
+  if(ok == 0) __atomic_fetch_add(&brk_slot[ptx->slot].nfast, 1, __ATOMIC_RELAXED);
+  pthread_mutex_unlock(&brk_mutex);
+  return ok;
+  }
+
+
+/* =====================================================================================
+ *
+ * Circuit breaker: outcome of a module command executed on the bus. No handshake, no
+ * ATTN*, no response, a NAK or a handshake out of place counts against the module; a
+ * response closes the breaker
+ *
+ * =====================================================================================
+ */
+void brkDONE(struct BusTxn *ptx)
+  {
+  struct Health *ph;
+  int fail;
+
+  if(brk_nfail <= 0) return;
+  fail = (ptx->status == MSGstat_NONE) || (ptx->status == MSGstat_noEOM) || (ptx->status == ABNORMAL-11) ||
+    (ptx->status == ABNORMAL-13) || (ptx->status == ABNORMAL-14) || (ptx->status == ABNORMAL-15);
+  if((fail == 0) && (ptx->status != NORMAL)) return; /* not the module's doing */
+  ph = &brk_slot[ptx->slot];
+  pthread_mutex_lock(&brk_mutex);
+  if(fail == 0)
+    {
+    ph->nfail = 0;
+    ph->tok = usnow();
+    if(ph->state != BRK_CLOSED)
+      {
+      ph->state = BRK_CLOSED;
+      logMSG(LOG_ERR, "slot %d answers again - back in service", ptx->slot);
+      }
+    }
+  else
+    {
+    ph->nfail++;
+    if((ph->state == BRK_TRIAL) || ((ph->state == BRK_CLOSED) && (ph->nfail >= brk_nfail)))
+      {
+      if(ph->state == BRK_CLOSED)
+        {
+        ph->ntrip++;
+        logMSG(LOG_ERR, "slot %d degraded after %d failures", ptx->slot, ph->nfail);
+        }
+      ph->state = BRK_OPEN;
+      ph->tprobe = usnow() + brk_probe * 1000LL;
+      }
+    }
+  pthread_mutex_unlock(&brk_mutex);
+  }
+
+
+/* =====================================================================================
+ *
+ * Health of the slots (_HEALTH): one line per slot with a module or a past trip -
+ * state, failures in a row, trips, trials, commands failed at once, stale answers
+ * and ms since the module last answered (-1 = never)
+ *
+ * =====================================================================================
+ */
+void brkSTATS(unsigned char *out)
+  {
+  static const char *sname[3] = {"OK", "DEGRADED", "TRIAL"};
+  struct Health *ph;
+  long long tnow;
+  int is, n;
+
+  tnow = usnow();
+  n = sprintf(out, "HEALTH FAILS %d PROBE %d\n", brk_nfail, brk_probe);
+  pthread_rwlock_rdlock(&topo_lock);
+  pthread_mutex_lock(&brk_mutex);
+  for(is = 0; is < nSLOTS; is++)
+    {
+    ph = &brk_slot[is];
+    if((SS2LU[is][0] < 0) && (ph->ntrip == 0)) continue;
+    n += sprintf(&out[n], "SLOT %d %s FAIL %d TRIPS %u TRIALS %u FAST %u STALE %u LAST %lld\n",
+      is, sname[ph->state], ph->nfail, ph->ntrip, ph->ntrial, ph->nfast, ph->nstale,
+      (ph->tok > 0) ? (tnow - ph->tok) / 1000 : -1LL);
+    }
+  pthread_mutex_unlock(&brk_mutex);
+  pthread_rwlock_unlock(&topo_lock);
+  }
+
+
+/* =====================================================================================
+ *
+ * Basic command parsing (called by the event loop, before the command is queued):
+ *   - upper-case the command, strip CR and leading spaces
+ *   - take an optional @<ms> max-age prefix
+ *   - recognise global commands (e.g. _Q, _LL, ....)
+ *   - check for expected number of arguments
+ *   - check that requested module/submodule exists
+ *
+ * Return codes,
+ *  -1 = command failed = ABNORMAL (-n: which check failed)
+ *   0 = command OK = NORMAL
+ * =====================================================================================
+ */
+int cmdParse(struct BusTxn *ptx)
+  {
+  unsigned char *s1 = ptx->cmd;
+  unsigned char s2[L4096];
+  int slot, sm, i1, i2, i3;
+  int status;
+
+
+  status = ABNORMAL; /* set status to fail by default */
+  ptx->type = TXN_MOD;
+  ptx->cls = CLS_IREAD;
+  ptx->rdonly = 0;
+  ptx->nocoal = 0;
+  ptx->quit = 0;
+  ptx->cread = 0;
+  ptx->brk = 0;
+  ptx->tdata = 0;
+  ptx->maxage = -1; /* no prefix - use the connection default */
+  ptx->rsp[0] = '\0';
+  ptx->rsplen = 0;
+  ptx->cmd[ptx->cmdlen] = '\0';
+
+  /* Commands must be in upper-case characters */
+  for(i1=0;i1<ptx->cmdlen;i1++) s1[i1] = toupper(s1[i1]);
+  for(i1=0;i1<ptx->cmdlen;i1++)
+    {
+    if((s1[i1] == '\r') || (s1[i1] == '\n')) s1[i1] = '\0'; /* terminate string at CR */
+    }
+  i1=0;
+  while(s1[i1] == ' ') /* get rid of leading spacings */
+  	{
+  	i1 = i1+1;
+  	if(s1[i1] == '\0') return status; /* unexpected end of string */
+  	}
+
+  /* @<ms> = answer from the cache if the data is younger than ms */
+  if(s1[i1] == '@')
+    {
+    i1 = i1+1;
+    if(isdigit(s1[i1]) == 0) return status;
+    ptx->maxage = atoi(&s1[i1]);
+    while(isdigit(s1[i1])) i1 = i1+1;
+    while(s1[i1] == ' ') i1 = i1+1;
+    if(s1[i1] == '\0') return status; /* unexpected end of string */
+    }
+  memmove(s1, &s1[i1], strlen(&s1[i1]) + 1);
+  ptx->cmdlen = strlen(s1);
+  i1 = 0;
+
+  /* is this the quit command? */
+  if(strncmp(&s1[i1],"_Q",2) == 0)
+    {
+    ptx->type = TXN_Q;
+    ptx->quit = 1;
+    return NORMAL;
+    }
+
+  /* global commands */
+  if(strncmp(&s1[i1],"_LL",3) == 0) ptx->type = TXN_LL;
+  else if(strncmp(&s1[i1],"_BUS",4) == 0) ptx->type = TXN_BUS;
+  else if(strncmp(&s1[i1],"_CLI",4) == 0) ptx->type = TXN_CLI;
+  else if(strncmp(&s1[i1],"_MAXAGE",7) == 0) ptx->type = TXN_MAXAGE;
+  else if(strncmp(&s1[i1],"_CACHE",6) == 0) ptx->type = TXN_CACHE;
+  else if(strncmp(&s1[i1],"_RESCAN",7) == 0) ptx->type = TXN_RESCAN;
+  else if(strncmp(&s1[i1],"_ALL ",5) == 0) ptx->type = TXN_BATCH;
+  else if(strncmp(&s1[i1],"_RCL ",5) == 0) ptx->type = TXN_BATCH;
+  else if(strncmp(&s1[i1],"_SUB",4) == 0) ptx->type = TXN_SUB;
+  else if(strncmp(&s1[i1],"_UNSUB",6) == 0) ptx->type = TXN_UNSUB;
+  else if(strncmp(&s1[i1],"_STATS",6) == 0) ptx->type = TXN_STATS;
+  else if(strncmp(&s1[i1],"_HEALTH",7) == 0) ptx->type = TXN_HEALTH;
+  if(ptx->type == TXN_CLI) ptx->cls = CLS_IWRITE;
+  if(ptx->type != TXN_MOD) return NORMAL;
+
+  /* if this a properly composed message, this substring must be the slot# */
+  i2 = i1; /* index in s1 where we are */
+  while(s1[i2] != ' ')
+    {
+    i3 = s1[i2]; /* get character */
+    if(isdigit(i3) == 0) return (status-1); /* should be a digit */
+    i2 = i2+1;
+    if(s1[i2] == '\0') return (status-2); /* unexpected end of string */
+    }
+  s2[0] = '\0';
+  strncpy(s2,&s1[i1],i2-i1);
+  s2[i2-i1] = '\0';
+  sscanf(s2,"%d",&slot); /* slot number */
+  if((slot < 0) || (slot >= nSLOTS)) return (status-3); /* out of range slot# */
+
+  /* get rid of space(s) between slot# and submodule# */
+  i1 = i2;
+  while(s1[i1] == ' ')
+  	{
+  	i1 = i1+1;
+  	if(s1[i1] == '\0') return (status-4); /* unexpected end of string */
+  	}
+
+  /* the next substring must be the submodule# */
+  i2 = i1; /* index in s1 where we are */
+  while(s1[i2] != ' ')
+    {
+    i3 = s1[i2]; /* get character */
+    if(isdigit(i3) == 0) return (status-5); /* should be a digit */
+    i2 = i2+1;
+    if(s1[i2] == '\0') return (status-6); /* unexpected end of string */
+    }
+  s2[0] = '\0';
+  strncpy(s2,&s1[i1],i2-i1);
+  s2[i2-i1] = '\0';
+  sscanf(s2,"%d",&sm); /* submodule number */
+  if((sm < 0) || (sm >= nSUBMOD)) return (status-7); /* out of range submodule# */
+
+  /* check that there is a ubit at this slot/submodule address */
+  pthread_rwlock_rdlock(&topo_lock);
+  i3 = (SS2LU[slot][sm] < 0) ? 0 : strlen(pLU[SS2LU[slot][sm]]->hdr);
+  pthread_rwlock_unlock(&topo_lock);
+  if(i3 == 0) return (status-8);
+
+  /* get rid of space(s) between submodule# and module-cmd-syntax
+   * the space is already stored in the module header
+   */
+  i1 = i2;
+  while(s1[i1] == ' ')
+  	{
+  	i1 = i1+1;
+  	if(s1[i1] == '\0') return (status-9); /* unexpected end of string */
+  	}
+
+  /* module header + command + LF must fit in the serial TX buffer */
+  if(i3 + strlen(&s1[i1]) + 2 > L256) return (status-10);
+
+  ptx->slot = slot;
+  ptx->sm = sm;
+  ptx->moff = i1;
+  ptx->cread = cacheRead(&s1[i1]);
+  ptx->cls = cmdClass(&s1[i1]);
+  ptx->rdonly = (ptx->cls == CLS_IREAD);
+  return NORMAL;
+  }
+
+
+/* =====================================================================================
+ *
+ * Send the transfer frame to a module and drop what it answers: a response it holds
+ * (and the ATTN* it keeps up for it) is cleared, or it answers the handshake
+ *
+ * =====================================================================================
+ */
+void cmdDRAIN(struct LUnit *plu)
+  {
+  sio_TXbuff[0] = '\0';
+  strcpy(sio_TXbuff,plu->ack);
+  sio_TXlen = strlen(sio_TXbuff);
+  sioSEND(sio_TXbuff,sio_TXlen);
+
+  /* response may be an ACK sequence if nothing to xfer
+   * Set time wait = equivalent to 50 characters xfer (~ 13ms)
+   */
+  msgget(50);
+  }
+
+
+/* =====================================================================================
+ *
+ * Command execution (called by the bus thread) for a command accepted by cmdParse()
+ *
+ * Return codes,
+ *  -1 = command failed = ABNORMAL
+ *   0 = command OK = NORMAL
+ *  ABNORMAL-8  = no logic unit at the address any more
+ *  ABNORMAL-11 = no ATTN* within 2 s
+ *  ABNORMAL-13 = NAK - the module refused the command or the transfer
+ *  ABNORMAL-14 = a message instead of the handshake
+ *  ABNORMAL-15 = the handshake instead of the response (ATTN* was up for another module)
+ *  MSGstat_NONE, MSGstat_noEOM = no handshake or response, or one cut short
+ * After a NAK or a missed ATTN* the module is drained (cmdDRAIN()), so that a response
+ * it still holds does not keep ATTN* up for every other module.
+ * =====================================================================================
+ */
+int cmdEXE(struct BusTxn *ptx)
+  {
+  unsigned char tmp[L4096];
+  struct LUnit *plu;
+  long long tattn, t0, t1, t2;
+  int i2, iv;
+  int status;
+
+
+  ptx->rsp[0] = '\0';
+  ptx->rsplen = 0;
+
+  /* is this the dump module/submodule summary command? */
+  if(ptx->type == TXN_LL)
+    {
+    ptx->rsp[0] = '\0';
+    for(i2 = 0; i2 <= lstLU ; i2++)
+      {
+      tmp[0] = '\0';
+      sprintf(tmp,"%d %s\n",pLU[i2]->slot,pLU[i2]->id);
+      strcat(ptx->rsp,tmp);
+      }
+    ptx->rsplen = strlen(ptx->rsp);
+    return NORMAL;
+    }
+
+  /* is this the bus queue statistics command? */
+  if(ptx->type == TXN_BUS)
+    {
+    busSTATS(ptx->rsp);
+    ptx->rsplen = strlen(ptx->rsp);
+    return NORMAL;
+    }
+
+  /* is this a request to clear all modules response buffers?
+   * this will clear any module holding the ATN* line with a message to be delivered
+   */
+  if(ptx->type == TXN_CLI)
+    {
+    for(i2 = 0; i2 < nMOD; i2++) /* loop over slots with modules */
+      {
+      /* get buffer content of module (if any)
+       * return status does not matter - we are just forcing a buffer dump
+       */
+      cmdDRAIN(pLU[SS2LU[SLOTwMOD[i2]][0]]);
+      }
+    return NORMAL;
+    }
+  if(ptx->type != TXN_MOD) return NORMAL;
+
+  /* the module may have gone since the command was parsed */
+  if(SS2LU[ptx->slot][ptx->sm] < 0) return (ABNORMAL-8);
+
+  /* Prepare and send message to module */
+  plu = pLU[SS2LU[ptx->slot][ptx->sm]];
+  iv = statVERB(&ptx->cmd[ptx->moff]);
+  t0 = usnow();
+  sio_TXbuff[0] = '\0';
+  strcpy(sio_TXbuff,plu->hdr);
+  strcat(sio_TXbuff,&ptx->cmd[ptx->moff]);
+  strcat(sio_TXbuff,"\n");
+  sio_TXlen = strlen(sio_TXbuff);
+  sioSEND(sio_TXbuff,sio_TXlen);
+  t1 = usnow();
+  statREC(ST_TX, iv, ptx->slot, t1 - t0);
+  status=msgget(sio_TXlen+50);
+  statMSG(0, status);
+  tattn = usnow();
+  statREC(ST_HNDSHK, iv, ptx->slot, tattn - t1);
+  if(status != MSGstat_HNDSHK)
+/*** 27-Jul-2014 ***/
+  {
+    logREC(LOG_ERR, EV_EXE, ptx->slot, iv, status, usnow() - t0, "check handshake ERROR", -1);
+    cacheUpdate(plu, &ptx->cmd[ptx->moff], NULL, 0);
+    if(status == MSGstat_noACK)
+      {
+      cmdDRAIN(plu); /* NAK - it may still hold an earlier response */
+      status = ABNORMAL-13;
+      }
+    else if(status == MSGstat_OK) status = ABNORMAL-14;
+    statREC(ST_EXE, iv, ptx->slot, usnow() - t0);
+    return (status); /* get handshake */
+   }
+
+  /* wait up-to 2 sec for module to indicate is ready to send response to previous command */
+  if(IsGpioSet(23,2.0) != NORMAL)
+    {
+    cacheUpdate(plu, &ptx->cmd[ptx->moff], NULL, 0);
+    cmdDRAIN(plu); /* a late response would hold ATTN* up */
+    statREC(ST_EXE, iv, ptx->slot, usnow() - t0);
+    return (ABNORMAL-11);
+    }
+  t1 = usnow();
+  tattn = t1 - tattn;
+  statREC(ST_ATTN, iv, ptx->slot, tattn);
+  pthread_mutex_lock(&bus_mutex);
+  bus_attn = (7 * bus_attn + tattn) / 8; /* for the cost estimate of the scheduler */
+  pthread_mutex_unlock(&bus_mutex);
+
+  sio_TXbuff[0] = '\0';
+  strcpy(sio_TXbuff,plu->ack);
+  sio_TXlen = strlen(sio_TXbuff);
+  sioSEND(sio_TXbuff,sio_TXlen);
+  t2 = usnow();
+  statREC(ST_ACK, iv, ptx->slot, t2 - t1);
+  status=msgget(50);
+  statMSG(1, status);
+  t1 = usnow();
+  statREC(ST_RSP, iv, ptx->slot, t1 - t2);
+  statREC(ST_EXE, iv, ptx->slot, t1 - t0);
+  if(status == MSGstat_OK) /* 50 char wait (13ms) */
+    {
+    ptx->rsp[0] = '\0';
+    strcpy(ptx->rsp,&sio_MSGbuff[1]); /* skip ACK byte */
+/*** 12-May-2014 *
+    tmp[0] = '\0';
+    sprintf(tmp,"(%d,%d): ", slot, sm);
+    strcat(tmp, ptx->rsp);
+***/
+    ptx->rsplen = strlen(ptx->rsp);
+    cacheUpdate(plu, &ptx->cmd[ptx->moff], ptx->rsp, 1);
+    return NORMAL;
+    } else
+	{
+  	   logREC(LOG_ERR, EV_EXE, ptx->slot, iv, status, t1 - t0, "msgget() 1 status", -1);
+	   cacheUpdate(plu, &ptx->cmd[ptx->moff], NULL, 0);
+	   if(status == MSGstat_noACK)
+	     {
+	     cmdDRAIN(plu);
+	     status = ABNORMAL-13;
+	     }
+	   else if(status == MSGstat_HNDSHK) status = ABNORMAL-15;
+	   return status;
+	}
+
+  return status;
+  }
+
+/* ======================================================================================
+ *
+ * Collect the module metadata of a logic unit: ID, PROP and the ATTR of every property.
+ * Called at discovery (before the bus thread is started) or by the bus thread itself;
+ * the responses are stored by cmdEXE().
+ *
+ * ======================================================================================
+ */
+void metaFETCH(struct LUnit *plu)
+  {
+  static struct BusTxn tx;
+  unsigned char pname[nPROP][L16];
+  int ip, np;
+
+  sprintf(tx.cmd, "%d %d ID", plu->slot, plu->smod);
+  tx.cmdlen = strlen(tx.cmd);
+  if(cmdParse(&tx) == NORMAL) cmdEXE(&tx);
+  sprintf(tx.cmd, "%d %d PROP", plu->slot, plu->smod);
+  tx.cmdlen = strlen(tx.cmd);
+  if((cmdParse(&tx) != NORMAL) || (cmdEXE(&tx) != NORMAL))
+    {
+    printf("metaFETCH - no property list @ slot = %d, smod = %d\n", plu->slot, plu->smod);
+    return;
+    }
+
+  pthread_mutex_lock(&cache_mutex);
+  np = plu->nprop;
+  for(ip = 0; ip < np; ip++) strcpy(pname[ip], plu->pname[ip]);
+  pthread_mutex_unlock(&cache_mutex);
+
+  for(ip = 0; ip < np; ip++)
+    {
+    sprintf(tx.cmd, "%d %d ATTR %s", plu->slot, plu->smod, pname[ip]);
+    tx.cmdlen = strlen(tx.cmd);
+    if(cmdParse(&tx) == NORMAL) cmdEXE(&tx);
+    }
+  }
+
+
+/* ======================================================================================
+ *
+ * Create the structure of a logic unit (NULL if malloc failed)
+ *
+ * ======================================================================================
+ */
+struct LUnit *luNEW(int slot, int nsm, int smod, int lutype, unsigned char *id)
+  {
+  struct LUnit *plu;
+  unsigned char ga = 255 - slot; /* geographical address of slot */
+
+  plu = (struct LUnit *)calloc(1, sizeof(struct LUnit)); /* empty value cache */
+  if(plu == NULL)
+    {
+    printf("luNEW - malloc failed!, slot = %d, smod = %d\n", slot, smod);
+    return NULL;
+    }
+
+  /* store - basic header for commands */
+  plu->hdr[0] = ga;
+  plu->hdr[1] = 0x06;
+  if(nsm <= 1)
+    {
+    /* One sub-module, commands do not include sub-module address
+     * The slot# is used as the transaction#
+     */
+    sprintf(&plu->hdr[2],"%d ",slot);
+    }
+  else
+    {
+    /*sub-module smod of [ 0 -> (nsm-1)]
+     * The slot# is used as the transaction#
+     */
+    sprintf(&plu->hdr[2],"%d %d ",slot,smod);
+    }
+
+  /* store - ack message */
+  plu->ack[0] = ga;
+  plu->ack[1] = 0x06;
+  plu->ack[2] = '\n';
+  plu->ack[3] = '\0';
+
+  plu->lutype = lutype; /* logic unit type index */
+  plu->slot = slot;     /* slot number */
+  plu->nsmod = nsm;     /* number of submodules */
+  plu->smod = smod;     /* submodule number */
+  strncpy(plu->id, id, L256 - 1); /* module/submodule id */
+  return plu;
+  }
+
+
+/* ======================================================================================
+ *
+ * Probe one slot: handshake, SM and the ID of every submodule. The logic units found
+ * are returned in found[] (indexed by submodule); bad[] flags the submodules whose ID
+ * failed (state unknown - skipped, the other submodule is still probed). Return codes,
+ *  -1 = the slot answered but SM failed (state unknown)
+ *  >= 0 = number of logic units found (0 = empty slot)
+ *
+ * ======================================================================================
+ */
+int slotPROBE(int slot, struct LUnit *found[nSUBMOD], int bad[nSUBMOD])
+  {
+  unsigned char ga, s1[L256], s2[L256], s3[L256], *ps1;
+  int nsm, nfound = 0, i1, i2, i3;
+
+  for(i3 = 0; i3 < nSUBMOD; i3++)
+    {
+    found[i3] = NULL;
+    bad[i3] = 0;
+    }
+
+  /* Send handshake message to the slot to determine if it has a module.
+   * This will also clear a module holding the ATTN* line (it has a pending response
+   * in its output buffer)
+   */
+  ga = 255 - slot;  /* geographical address of slot */
+  sio_TXbuff[0] = ga;
+  sio_TXbuff[1] = 0x06;  /* ACK */
+  sio_TXbuff[2] = '\n';
+  sio_TXbuff[3] = '\0';
+  sioSEND(sio_TXbuff,strlen(sio_TXbuff));
+  if(msgget(50) <= MSGstat_NONE) return 0; /* 50 char wait - empty slot */
+
+  /* get number of submodules in this module */
+  sio_TXbuff[0] = ga;
+  sio_TXbuff[1] = 0x06;
+  sio_TXbuff[2] = '\0';
+  /* Note: we choose to use the slot# as the transation ticket# */
+  sprintf(s1,"%d SM\n",slot);
+  strcat(sio_TXbuff,s1);
+  sio_TXlen = strlen(sio_TXbuff);
+  sioSEND(sio_TXbuff,sio_TXlen); /* send message */
+  if(msgget(sio_TXlen+50) != MSGstat_HNDSHK) return -1; /* get handshake */
+
+  /* wait up-to 2 sec for module to indicate is ready to send response to previous command */
+  if(IsGpioSet(23,2.0) != NORMAL) return -1;
+
+  /* Module has response ready - send handshake sequence to start xfer
+   * The slot geographical address & 0x06 (ACK) are
+   * already in the buffer - we just add the LF and a NULL
+   */
+  sio_TXbuff[2] = '\n';
+  sio_TXbuff[3] = '\0';
+  sio_TXlen = strlen(sio_TXbuff);
+  sioSEND(sio_TXbuff,strlen(sio_TXbuff)); /* send handshake */
+  if(msgget(50) != MSGstat_OK) return -1; /* 50 char wait (13ms) */
+
+  /* decode message */
+  sio_MSGbuff[sio_MSGlen] = '\0';
+  sio_MSGbuff[0] = ' '; /* convert ACK char into SPACE for decoding */
+
+  /* message terminates with CRLF */
+  ps1 = strchr(sio_MSGbuff,'\r');   /* search for CR */
+  if(ps1 != NULL) *ps1 = '\0';       /* replace CR by NULL to terminate string */
+  if(sscanf(sio_MSGbuff,"%d %s %d",&i1,s1,&nsm) != 3) return -1;
+
+  /* Check that the ticket-number field matches the slot# (we sent this value)
+   * & the command is "SM"
+   */
+  if((i1 != slot) || (strcmp(s1,"SM") != 0)) return -1; /* error */
+  if(nsm > nSUBMOD) nsm = nSUBMOD;
+
+  /* get module ID & submodule information (e.g number of channels & properties) */
+  for(i3 = 0;  i3 < nsm;  i3++)
+    {
+    sio_TXbuff[2] = '\0';
+    if(nsm <= 1)
+      {
+      /* one sub-module, commands do not include sub-module address
+       * Use the slot# as the transation ticket#
+       */
+      sprintf(s1,"%d ID\n",slot);
+      }
+    else
+      {
+      /* sub-module i3 of [ 0 -> (nsm-1)]
+       * Use the slot# as the transation ticket#
+       */
+      sprintf(s1,"%d %d ID\n",slot,i3);
+      }
+    strcat(sio_TXbuff,s1);
+    sio_TXlen = strlen(sio_TXbuff);
+    sioSEND(sio_TXbuff,sio_TXlen); /* send command */
+    if(msgget(sio_TXlen+50) != MSGstat_HNDSHK) goto skip_submodule; /* get handshake */
+
+    /* wait up-to 2 sec for module to indicate is ready to send response to previous command */
+    if(IsGpioSet(23,2.0) != NORMAL) goto skip_submodule;
+
+    /* module ready - send handshake sequence to start xfer
+     * The slot geographical address & 0x06 (ACK) are
+     * already in the buffer - we just add the LF and a NULL
+     */
+    sio_TXbuff[2] = '\n';
+    sio_TXbuff[3] = '\0';
+    sio_TXlen = strlen(sio_TXbuff);
+    sioSEND(sio_TXbuff,sio_TXlen);
+    if(msgget(50) != MSGstat_OK) goto skip_submodule; /* 50 char wait (13ms) */
+
+    /* decode response  - response should start with "YXX ID " where Y = 0x06 &
+     * XX = transation ticket# = slot# (one or 2 characters)
+     * Skip over the number of bytes taken by preamble (ACK, slot# & command) */
+    i1 = 1;
+    if(slot > 9) i1 = 2;
+    i1 = i1+5; /* 5 bytes = ACK + " ID " */
+    strcpy(s1,&sio_MSGbuff[i1]);
+
+    ps1 = strchr(s1,'\r');  /* end-of-message sequence is CRLF. Search for CR */
+    if(ps1 != NULL) *ps1 = '\0';  /* replace CR by NULL to terminate string */
+    s2[0] = '\0';
+    sscanf(s1,"%s",s2);  /* s2 should be the module type */
+    sprintf(s3,"S%d",i3);  /*submodule number */
+    strcat(s2,s3);    /* logic unit type  */
+
+    /* search for logic unit type */
+    i2 = -1;
+    for(i1 = 0; i1 < nLUTYP; i1++)
+      {
+      if(strcmp(&LU_type[i1][0],s2) == 0) i2 = i1;
+      }
+
+    /* skip if no matching logic unit found */
+    if(i2 < 0)
+      {
+      printf("slotPROBE - unknown logic unit type %s @ slot = %d\n",s2,slot);
+      continue;
+      }
+
+    /* found logic unit type - create structure to store this logic unit info */
+    found[i3] = luNEW(slot, nsm, i3, i2, s1);
+    if(found[i3] != NULL) nfound++;
+    continue;
+
+skip_submodule:
+    printf("slotPROBE - no ID from slot = %d submodule = %d\n",slot,i3);
+    bad[i3] = 1;
+    }
+  return nfound;
+  }
+
+
+/* ======================================================================================
+ *
+ * Install the logic units of a slot (found[] indexed by submodule, NULL = none) and
+ * rebuild pLU, SS2LU and SLOTwMOD in slot/submodule order. Call with topo_lock held for
+ * writing once other threads are running. The logic units of the slot not in found[]
+ * are freed, taking cache_mutex: with both locks held no other thread can be using them
+ *
+ * ======================================================================================
+ */
+void topoSET(int slot, struct LUnit *found[nSUBMOD])
+  {
+  struct LUnit *all[nSLOTS][nSUBMOD], *gone[nSUBMOD];
+  int is, ism, iany, i1;
+
+  for(is = 0; is < nSLOTS; is++)
+    {
+    for(ism = 0; ism < nSUBMOD; ism++)
+      {
+      all[is][ism] = (SS2LU[is][ism] >= 0) ? pLU[SS2LU[is][ism]] : NULL;
+      }
+    }
+  for(ism = 0; ism < nSUBMOD; ism++)
+    {
+    gone[ism] = all[slot][ism];
+    for(i1 = 0; i1 < nSUBMOD; i1++) if(gone[ism] == found[i1]) gone[ism] = NULL;
+    all[slot][ism] = found[ism];
+    }
+
+  lstLU = -1;
+  nMOD = 0;
+  for(is = 0; is < nSLOTS; is++)
+    {
+    iany = 0;
+    for(ism = 0; ism < nSUBMOD; ism++)
+      {
+      SS2LU[is][ism] = -1;
+      if(all[is][ism] == NULL) continue;
+      lstLU = lstLU + 1;
+      pLU[lstLU] = all[is][ism];
+      SS2LU[is][ism] = lstLU;
+      iany = 1;
+      }
+    /* _CLI talks to submodule 0 of every slot listed here */
+    if(iany && (SS2LU[is][0] >= 0)) SLOTwMOD[nMOD++] = is;
+    }
+  for(is = lstLU + 1; is < nLU; is++) pLU[is] = NULL;
+
+  pthread_mutex_lock(&cache_mutex);
+  for(ism = 0; ism < nSUBMOD; ism++) if(gone[ism] != NULL) free(gone[ism]);
+  pthread_mutex_unlock(&cache_mutex);
+  }
+
+
+/* ======================================================================================
+ *
+ * Save the logic unit table and module metadata to the topology file
+ *
+ * ======================================================================================
+ */
+void topoSAVE(unsigned char *fname)
+  {
+  struct TopoHdr th;
+  struct TopoRec tr;
+  unsigned char tname[L256];
+  struct LUnit *plu;
+  FILE *fp;
+  int ilu;
+
+  if((fname == NULL) || (strcmp(fname, "-") == 0)) return;
+  snprintf(tname, L256, "%s.tmp", fname);
+  fp = fopen(tname, "wb");
+  if(fp == NULL)
+    {
+    printf("topoSAVE - can't write %s: %s\n", tname, strerror(errno));
+    return;
+    }
+
+  pthread_rwlock_rdlock(&topo_lock);
+  th.magic = TOPO_MAGIC;
+  th.version = TOPO_VERSION;
+  th.recsize = sizeof(struct TopoRec);
+  th.nrec = lstLU + 1;
+  fwrite(&th, sizeof(th), 1, fp);
+  for(ilu = 0; ilu <= lstLU; ilu++)
+    {
+    plu = pLU[ilu];
+    memset(&tr, 0, sizeof(tr));
+    tr.slot = plu->slot;
+    tr.nsmod = plu->nsmod;
+    tr.smod = plu->smod;
+    tr.lutype = plu->lutype;
+    strcpy(tr.id, plu->id);
+    pthread_mutex_lock(&cache_mutex);
+    if(plu->propok)
+      {
+      tr.nprop = plu->nprop;
+      memcpy(tr.pname, plu->pname, sizeof(tr.pname));
+      memcpy(tr.rprop, plu->rprop, sizeof(tr.rprop));
+      memcpy(tr.rattr, plu->rattr, sizeof(tr.rattr));
+      }
+    memcpy(tr.rid, plu->rid, sizeof(tr.rid));
+    pthread_mutex_unlock(&cache_mutex);
+    fwrite(&tr, sizeof(tr), 1, fp);
+    }
+  pthread_rwlock_unlock(&topo_lock);
+
+  if(fclose(fp) != 0)
+    {
+    printf("topoSAVE - can't write %s: %s\n", tname, strerror(errno));
+    return;
+    }
+  if(rename(tname, fname) != 0) printf("topoSAVE - can't rename %s: %s\n", tname, strerror(errno));
+  }
+
+
+/* ======================================================================================
+ *
+ * Load the logic unit table saved by topoSAVE() (before any thread is started).
+ * Return codes,
+ *  -1 = no usable file = ABNORMAL
+ *   0 = table loaded = NORMAL
+ *
+ * ======================================================================================
+ */
+int topoLOAD(unsigned char *fname)
+  {
+  struct TopoHdr th;
+  struct TopoRec tr;
+  struct LUnit *found[nSLOTS][nSUBMOD];
+  struct LUnit *plu;
+  FILE *fp;
+  int irec, is, ism, ip, nok = 0;
+
+  if((fname == NULL) || (strcmp(fname, "-") == 0)) return ABNORMAL;
+  fp = fopen(fname, "rb");
+  if(fp == NULL) return ABNORMAL;
+  if((fread(&th, sizeof(th), 1, fp) != 1) || (th.magic != TOPO_MAGIC) ||
+     (th.version != TOPO_VERSION) || (th.recsize != sizeof(struct TopoRec)) ||
+     (th.nrec > nLU))
+    {
+    printf("topoLOAD - %s is not a topology file of this version\n", fname);
+    fclose(fp);
+    return ABNORMAL;
+    }
+
+  for(is = 0; is < nSLOTS; is++)
+    {
+    for(ism = 0; ism < nSUBMOD; ism++) found[is][ism] = NULL;
+    }
+  for(irec = 0; irec < th.nrec; irec++)
+    {
+    if(fread(&tr, sizeof(tr), 1, fp) != 1) break;
+    if((tr.slot < 0) || (tr.slot >= nSLOTS) || (tr.smod < 0) || (tr.smod >= nSUBMOD) ||
+       (tr.lutype < 0) || (tr.lutype >= nLUTYP) || (tr.nprop < 0) || (tr.nprop > nPROP)) break;
+    if(found[tr.slot][tr.smod] != NULL) break; /* same slot/submodule twice */
+    tr.id[L256 - 1] = '\0';
+    plu = luNEW(tr.slot, tr.nsmod, tr.smod, tr.lutype, tr.id);
+    if(plu == NULL) break;
+    for(ip = 0; ip < tr.nprop; ip++)
+      {
+      tr.pname[ip][L16 - 1] = '\0';
+      tr.rattr[ip][L256 - 1] = '\0';
+      cacheProp(plu, tr.pname[ip], 1);
+      strcpy(plu->rattr[ip], tr.rattr[ip]);
+      }
+    plu->propok = (tr.nprop > 0);
+    tr.rid[L256 - 1] = '\0';
+    tr.rprop[L256 - 1] = '\0';
+    strcpy(plu->rid, tr.rid);
+    strcpy(plu->rprop, tr.rprop);
+    found[tr.slot][tr.smod] = plu;
+    nok++;
+    }
+  fclose(fp);
+  if((nok != th.nrec) || (nok == 0))
+    {
+    printf("topoLOAD - %s is damaged\n", fname);
+    for(is = 0; is < nSLOTS; is++)
+      {
+      for(ism = 0; ism < nSUBMOD; ism++) if(found[is][ism] != NULL) free(found[is][ism]);
+      }
+    return ABNORMAL;
+    }
+
+  for(is = 0; is < nSLOTS; is++) topoSET(is, found[is]);
+  return NORMAL;
+  }
+
+
+/* ======================================================================================
+ *
+ * Revalidate one slot (called by the bus thread for a TXN_PROBE transaction): probe it
+ * and patch the logic unit table if the modules found differ from the ones we have.
+ * A submodule that did not answer ID keeps the logic unit we have. New logic units get
+ * their metadata right away.
+ *
+ * ======================================================================================
+ */
+int topoPROBE(struct BusTxn *ptx)
+  {
+  struct LUnit *found[nSUBMOD], *had[nSUBMOD];
+  int bad[nSUBMOD], ism, nfound, same = 1;
+
+  nfound = slotPROBE(ptx->slot, found, bad);
+  if(nfound < 0) return ABNORMAL; /* sick module - keep what we have */
+
+  /* the bus thread is the only writer of the table - no lock needed to read it */
+  for(ism = 0; ism < nSUBMOD; ism++)
+    {
+    had[ism] = (SS2LU[ptx->slot][ism] >= 0) ? pLU[SS2LU[ptx->slot][ism]] : NULL;
+    if(bad[ism]) found[ism] = had[ism]; /* state unknown - keep it */
+    else if((had[ism] != NULL) && (found[ism] != NULL) && (had[ism]->lutype == found[ism]->lutype) &&
+            (strcmp(had[ism]->id, found[ism]->id) == 0))
+      {
+      /* same module - keep its cache */
+      free(found[ism]);
+      found[ism] = had[ism];
+      }
+    if(found[ism] != had[ism]) same = 0;
+    }
+  if(same) return NORMAL;
+
+  logMSG(LOG_INFO, "topoPROBE - slot %d changed, %d logic unit(s) now", ptx->slot, nfound);
+  pthread_rwlock_wrlock(&topo_lock);
+  topoSET(ptx->slot, found);
+  pthread_rwlock_unlock(&topo_lock);
+  for(ism = 0; ism < nSUBMOD; ism++)
+    {
+    if((found[ism] != NULL) && (found[ism] != had[ism])) metaFETCH(found[ism]);
+    }
+  shmTOPO();
+  topo_dirty = 1;
+  return NORMAL;
+  }
+
+
+/* =====================================================================================
+ *
+ * Estimated bus time of a transaction (us): characters sent plus a 50 character
+ * response at USCHAR each, plus the ATTN* wait. Call with bus_mutex
+ *
+ * =====================================================================================
+ */
+long long busCost(struct BusTxn *ptx)
+  {
+  if(ptx->type == TXN_MOD) return (ptx->cmdlen - ptx->moff + 8 + 50) * USCHAR + bus_attn;
+  if(ptx->type == TXN_CLI) return nMOD * 50 * USCHAR;
+  if(ptx->type == TXN_PROBE) return 3 * 50 * USCHAR + 2 * bus_attn; /* ACK, SM, ID */
+  return 0;
+  }
+
+
+/* =====================================================================================
+ *
+ * Keep the request order of a connection: before a transaction is queued in its class,
+ * the queued transactions of the same connection in lower priority classes are moved
+ * up to that class, in their order. A pipelined HVOFF then pulls the reads queued
+ * ahead of it along instead of overtaking them. Call with bus_mutex
+ *
+ * =====================================================================================
+ */
+void busBoost(struct BusTxn *ptx)
+  {
+  struct BusTxn *pup[nPIPE], *pt, *pprev, *pnext;
+  int ic, nup = 0, i1, i2;
+
+  for(ic = ptx->cls + 1; ic < nCLASS; ic++)
+    {
+    pprev = NULL;
+    for(pt = bus_qhead[ic]; pt != NULL; pt = pnext)
+      {
+      pnext = pt->next;
+      if((pt->owner != ptx->owner) || (nup >= nPIPE))
+        {
+        pprev = pt;
+        continue;
+        }
+      /* unlink */
+      if(pprev == NULL) bus_qhead[ic] = pnext;
+      else pprev->next = pnext;
+      if(bus_qtail[ic] == pt) bus_qtail[ic] = pprev;
+      bus_cdepth[ic] = bus_cdepth[ic] - 1;
+      pup[nup++] = pt;
+      }
+    }
+
+  /* submission order */
+  for(i1 = 1; i1 < nup; i1++)
+    {
+    pt = pup[i1];
+    for(i2 = i1; (i2 > 0) && (pup[i2 - 1]->seq > pt->seq); i2--) pup[i2] = pup[i2 - 1];
+    pup[i2] = pt;
+    }
+  for(i1 = 0; i1 < nup; i1++)
+    {
+    pt = pup[i1];
+    pt->cls = ptx->cls;
+    pt->next = NULL;
+    if(bus_qtail[pt->cls] == NULL) bus_qhead[pt->cls] = pt;
+    else bus_qtail[pt->cls]->next = pt;
+    bus_qtail[pt->cls] = pt;
+    bus_cdepth[pt->cls] = bus_cdepth[pt->cls] + 1;
+    bus_nboost++;
+    }
+  }
+
+
+/* =====================================================================================
+ *
+ * Does the connection of ptx have an earlier transaction queued in a class above ic?
+ * Call with bus_mutex
+ *
+ * =====================================================================================
+ */
+int busEarlier(struct BusTxn *ptx, int ic)
+  {
+  struct BusTxn *pt;
+  int i1;
+
+  if(ptx->owner == NULL) return 0;
+  for(i1 = 0; i1 < ic; i1++)
+    {
+    for(pt = bus_qhead[i1]; pt != NULL; pt = pt->next)
+      {
+      if((pt->owner == ptx->owner) && (pt->seq < ptx->seq)) return 1;
+      }
+    }
+  return 0;
+  }
+
+
+/* =====================================================================================
+ *
+ * Move a queued transaction to the FIFO of class ic. Call with bus_mutex
+ *
+ * =====================================================================================
+ */
+void busMove(struct BusTxn *ptx, int ic)
+  {
+  struct BusTxn *pt, *pprev = NULL;
+
+  for(pt = bus_qhead[ptx->cls]; (pt != NULL) && (pt != ptx); pt = pt->next) pprev = pt;
+  if(pt == NULL) return;
+  if(pprev == NULL) bus_qhead[ptx->cls] = ptx->next;
+  else pprev->next = ptx->next;
+  if(bus_qtail[ptx->cls] == ptx) bus_qtail[ptx->cls] = pprev;
+  bus_cdepth[ptx->cls] = bus_cdepth[ptx->cls] - 1;
+
+  ptx->cls = ic;
+  ptx->next = NULL;
+  if(bus_qtail[ic] == NULL) bus_qhead[ic] = ptx;
+  else bus_qtail[ic]->next = ptx;
+  bus_qtail[ic] = ptx;
+  bus_cdepth[ic] = bus_cdepth[ic] + 1;
+  }
+
+
+/* =====================================================================================
+ *
+ * Single-flight reads. A module read attaches to an identical read (same slot,
+ * submodule and command) that is queued or on the bus, and gets a copy of its response.
+ * Any write to the logic unit seals the reads queued before it: later reads start a new
+ * transaction, so nobody gets a response older than a write queued ahead of the read.
+ * Call with bus_mutex. Return codes,
+ *  0 = ptx has to be queued
+ *  1 = ptx shares the response of another transaction
+ *
+ * =====================================================================================
+ */
+int busShare(struct BusTxn *ptx)
+  {
+  struct BusTxn *pl, *pprev, *pnext;
+
+  if((ptx->type == TXN_MOD) && ptx->rdonly)
+    {
+    if(ptx->nocoal) return 0;
+    for(pl = bus_lead; pl != NULL; pl = pl->lnext)
+      {
+      if((pl->slot == ptx->slot) && (pl->sm == ptx->sm) &&
+         (strcmp(&pl->cmd[pl->moff], &ptx->cmd[ptx->moff]) == 0)) break;
+      }
+    if(pl == NULL)
+      {
+      /* first of its kind - others may attach */
+      ptx->fhead = NULL;
+      ptx->lead = 1;
+      ptx->lnext = bus_lead;
+      bus_lead = ptx;
+      return 0;
+      }
+    ptx->fnext = pl->fhead;
+    pl->fhead = ptx;
+    bus_ncoal++;
+    /* the shared transaction runs at the better of the two priorities and deadlines */
+    if((pl->run == 0) && (ptx->cls < pl->cls)) busMove(pl, ptx->cls);
+    if((ptx->tdead != 0) && ((pl->tdead == 0) || (ptx->tdead < pl->tdead))) pl->tdead = ptx->tdead;
+    return 1;
+    }
+
+  /* write (or _CLI, slot probe) - seal the reads of the logic units it touches */
+  if((ptx->type != TXN_MOD) && (ptx->type != TXN_CLI) && (ptx->type != TXN_PROBE)) return 0;
+  pprev = NULL;
+  for(pl = bus_lead; pl != NULL; pl = pnext)
+    {
+    pnext = pl->lnext;
+    if((ptx->type == TXN_MOD) && ((pl->slot != ptx->slot) || (pl->sm != ptx->sm)))
+      {
+      pprev = pl;
+      continue;
+      }
+    if((ptx->type == TXN_PROBE) && (pl->slot != ptx->slot))
+      {
+      pprev = pl;
+      continue;
+      }
+    if(pprev == NULL) bus_lead = pnext;
+    else pprev->lnext = pnext;
+    pl->lead = 0;
+    bus_nseal++;
+    }
+  return 0;
+  }
+
+
+/* =====================================================================================
+ *
+ * Queue a transaction for the bus thread in the FIFO of its class. Its complete()
+ * function is called from the bus thread once the module response (or error status)
+ * is in the transaction.
+ *
+ * =====================================================================================
+ */
+void busSubmit(struct BusTxn *ptx)
+  {
+  ptx->done = 0;
+  ptx->rel = 0;
+  ptx->next = NULL;
+  ptx->tqueue = usnow();
+  if((ptx->cls < 0) || (ptx->cls >= nCLASS)) ptx->cls = CLS_IREAD;
+
+  pthread_mutex_lock(&bus_mutex);
+  bus_seq = bus_seq + 1;
+  ptx->seq = bus_seq;
+  ptx->cost = busCost(ptx);
+  ptx->tdead = 0;
+  if(bus_deadline[ptx->cls] > 0) ptx->tdead = ptx->tqueue + bus_deadline[ptx->cls] * 1000LL;
+  ptx->run = 0;
+  ptx->lead = 0;
+  ptx->fhead = NULL;
+  if(busShare(ptx))
+    {
+    pthread_mutex_unlock(&bus_mutex);
+    return;
+    }
+  if(ptx->owner != NULL) busBoost(ptx);
+  if(bus_qtail[ptx->cls] == NULL) bus_qhead[ptx->cls] = ptx;
+  else bus_qtail[ptx->cls]->next = ptx;
+  bus_qtail[ptx->cls] = ptx;
+  bus_cdepth[ptx->cls] = bus_cdepth[ptx->cls] + 1;
+  bus_depth = bus_depth + 1;
+  if(bus_depth > bus_maxdepth) bus_maxdepth = bus_depth;
+  if(bus_idle)
+    {
+    bus_idle = 0;
+    clkRUN();
+    }
+  pthread_cond_signal(&bus_cond);
+  pthread_mutex_unlock(&bus_mutex);
+  }
+
+
+/* =====================================================================================
+ *
+ * Take the next transaction to execute (call with bus_mutex, queue not empty):
+ * the head of the highest priority class, unless the head of a lower class would miss
+ * its deadline by waiting for it - then the most urgent of those (earliest deadline).
+ * A high priority head that would itself miss its deadline is never passed over, and
+ * a connection's transactions never overtake each other.
+ *
+ * =====================================================================================
+ */
+struct BusTxn *busPick(void)
+  {
+  struct BusTxn *pbest = NULL, *purg = NULL, *ph;
+  long long tnow = usnow();
+  int ic, ibest = 0;
+
+  for(ic = 0; ic < nCLASS; ic++)
+    {
+    if(bus_qhead[ic] == NULL) continue;
+    pbest = bus_qhead[ic];
+    ibest = ic;
+    break;
+    }
+  if((pbest->tdead == 0) || (pbest->tdead - tnow - pbest->cost > 0))
+    {
+    for(ic = ibest + 1; ic < nCLASS; ic++)
+      {
+      ph = bus_qhead[ic];
+      if((ph == NULL) || (ph->tdead == 0)) continue;
+      if(ph->tdead - tnow - ph->cost >= pbest->cost) continue; /* can still wait */
+      if(busEarlier(ph, ic)) continue; /* would overtake its own connection */
+      if((purg == NULL) || (ph->tdead < purg->tdead)) purg = ph;
+      }
+    if(purg != NULL) pbest = purg;
+    }
+
+  pbest->run = 1;
+  ic = pbest->cls;
+  bus_qhead[ic] = pbest->next;
+  if(bus_qhead[ic] == NULL) bus_qtail[ic] = NULL;
+  bus_cdepth[ic] = bus_cdepth[ic] - 1;
+  bus_depth = bus_depth - 1;
+  return pbest;
+  }
+
+
+/* =====================================================================================
+ *
+ * Bus Task - the only owner of the serial port and the ATTN line. Executes queued
+ * transactions one at a time, in the order chosen by busPick()
+ *
+ * =====================================================================================
+ */
+void *busTSK(void *arg)
+  {
+  struct BusTxn *ptx, *pf, *pl, *pprev;
+  long long twait;
+
+  for(;;)
+    {
+    pthread_mutex_lock(&bus_mutex);
+    while(bus_depth == 0)
+      {
+      if(clk_virtual && (bus_idle == 0))
+        {
+        bus_idle = 1;
+        clkIDLE();
+        }
+      pthread_cond_wait(&bus_cond, &bus_mutex);
+      }
+    ptx = busPick();
+    pthread_mutex_unlock(&bus_mutex);
+
+    ptx->tstart = usnow();
+    if(ptx->type == TXN_PROBE) ptx->status = topoPROBE(ptx);
+    else if((ptx->type == TXN_MOD) && (brkPASS(ptx) == 0)) ptx->status = ABNORMAL-12;
+    else ptx->status = cmdEXE(ptx);
+    ptx->tdone = usnow();
+    if(ptx->type == TXN_MOD)
+      {
+      brkDONE(ptx);
+      statREC(ST_QUEUE, statVERB(&ptx->cmd[ptx->moff]), ptx->slot, ptx->tstart - ptx->tqueue);
+      statERR(ptx->status, ptx->slot);
+      logREC(LOG_DEBUG, EV_EXE, ptx->slot, statVERB(&ptx->cmd[ptx->moff]), ptx->status,
+        ptx->tdone - ptx->tstart, &ptx->cmd[ptx->moff], -1);
+      }
+
+    pthread_mutex_lock(&bus_mutex);
+    twait = ptx->tstart - ptx->tqueue;
+    bus_ntxn = bus_ntxn + 1;
+    bus_twait = bus_twait + twait;
+    bus_tbusy = bus_tbusy + (ptx->tdone - ptx->tstart);
+    bus_cntxn[ptx->cls] = bus_cntxn[ptx->cls] + 1;
+    bus_cwait[ptx->cls] = bus_cwait[ptx->cls] + twait;
+    if(twait > bus_cmaxwait[ptx->cls]) bus_cmaxwait[ptx->cls] = twait;
+    if((ptx->tdead != 0) && (ptx->tdone > ptx->tdead)) bus_cmiss[ptx->cls] = bus_cmiss[ptx->cls] + 1;
+    if(ptx->lead)
+      {
+      /* no more sharing - the response is out */
+      pprev = NULL;
+      for(pl = bus_lead; (pl != NULL) && (pl != ptx); pl = pl->lnext) pprev = pl;
+      if(pprev == NULL) bus_lead = ptx->lnext;
+      else pprev->lnext = ptx->lnext;
+      ptx->lead = 0;
+      }
+    pf = ptx->fhead;
+    ptx->fhead = NULL;
+    pthread_mutex_unlock(&bus_mutex);
+
+    /* identical reads that attached to this one get a copy of the response */
+    while(pf != NULL)
+      {
+      struct BusTxn *pnext = pf->fnext;
+      pf->status = ptx->status;
+      memcpy(pf->rsp, ptx->rsp, ptx->rsplen + 1);
+      pf->rsplen = ptx->rsplen;
+      pf->tstart = ptx->tstart;
+      pf->tdone = ptx->tdone;
+      pf->complete(pf);
+      pf = pnext;
+      }
+
+    ptx->complete(ptx);
+    }
+  return NULL;
+  }
+
+
+/* =====================================================================================
+ *
+ * Completion of a transaction queued by a background thread (called by the bus thread)
+ *
+ * =====================================================================================
+ */
+void pollDONE(struct BusTxn *ptx)
+  {
+  if(clk_virtual)
+    {
+    pthread_mutex_lock(&bus_mutex);
+    clkRUN(); /* the requester goes on */
+    pthread_mutex_unlock(&bus_mutex);
+    }
+  pthread_mutex_lock(&poll_mutex);
+  ptx->done = 1;
+  pthread_cond_broadcast(&poll_cond); /* refresher & topology thread */
+  pthread_mutex_unlock(&poll_mutex);
+  }
+
+
+/* =====================================================================================
+ *
+ * Queue a transaction behind the client commands and wait for the bus thread to
+ * execute it (background threads)
+ *
+ * =====================================================================================
+ */
+int busCALL(struct BusTxn *ptx)
+  {
+  ptx->complete = pollDONE;
+  ptx->owner = NULL;
+  busSubmit(ptx);
+  if(clk_virtual)
+    {
+    pthread_mutex_lock(&bus_mutex);
+    clkIDLE(); /* until pollDONE() */
+    pthread_mutex_unlock(&bus_mutex);
+    }
+
+  pthread_mutex_lock(&poll_mutex);
+  while(ptx->done == 0) pthread_cond_wait(&poll_cond, &poll_mutex);
+  pthread_mutex_unlock(&poll_mutex);
+  return ptx->status;
+  }
+
+
+/* =====================================================================================
+ *
+ * Run one module command for the refresher. Return codes,
+ *  -1 = command failed = ABNORMAL
+ *   0 = command OK = NORMAL
+ *
+ * =====================================================================================
+ */
+int pollTXN(struct BusTxn *ptx, int slot, int sm, unsigned char *mcmd)
+  {
+  sprintf(ptx->cmd, "%d %d %s", slot, sm, mcmd);
+  ptx->cmdlen = strlen(ptx->cmd);
+  if(cmdParse(ptx) != NORMAL) return ABNORMAL;
+  ptx->cls = CLS_POLL;
+  if(brkALLOW(ptx) == 0) return ABNORMAL-12; /* degraded - the trials are paced */
+  return busCALL(ptx);
+  }
+
+
+/* =====================================================================================
+ *
+ * Refresher Task - every poll_ms sweeps PSUM over all logic units and re-reads (RC)
+ * only the properties whose change counter moved, or whose cached values are missing
+ * or were invalidated. The responses feed the value cache through cmdEXE(), so that
+ * clients reading with a max-age are answered without bus traffic. Bus load follows
+ * what changes in the crate, not how many clients poll it.
+ *
+ * =====================================================================================
+ */
+void *pollTSK(void *arg)
+  {
+  static struct BusTxn tx;
+  unsigned char rcp[nPROP][L16], mcmd[L256];
+  struct LUnit *plu;
+  long long tsweep, dt;
+  int ilu, ip, ich, nrc, slot, sm, propok;
+
+  for(;;)
+    {
+    tsweep = usnow();
+    for(ilu = 0; ; ilu++)
+      {
+      pthread_rwlock_rdlock(&topo_lock);
+      plu = (ilu <= lstLU) ? pLU[ilu] : NULL;
+      if(plu != NULL)
+        {
+        slot = plu->slot;
+        sm = plu->smod;
+        }
+      pthread_rwlock_unlock(&topo_lock);
+      if(plu == NULL) break;
+
+      /* the property order is needed to match PSUM words to properties */
+      plu = luLOCK(slot, sm);
+      if(plu == NULL) continue;
+      propok = plu->propok;
+      pthread_mutex_unlock(&cache_mutex);
+      if((propok == 0) && (pollTXN(&tx, slot, sm, "PROP") != NORMAL)) continue;
+      if(pollTXN(&tx, slot, sm, "PSUM") != NORMAL) continue;
+
+      /* properties whose values are not good as of this PSUM */
+      nrc = 0;
+      plu = luLOCK(slot, sm);
+      if(plu == NULL) continue;
+      poll_npsum++;
+      for(ip = 0; (ip < plu->nprop) && (ip < plu->npsum); ip++)
+        {
+        for(ich = 0; ich < plu->nval[ip]; ich++)
+          {
+          if(plu->val[ip][ich].tread < plu->psum[ip].tread) break;
+          }
+        if((plu->nval[ip] == 0) || (ich < plu->nval[ip])) strcpy(rcp[nrc++], plu->pname[ip]);
+        }
+      pthread_mutex_unlock(&cache_mutex);
+
+      for(ip = 0; ip < nrc; ip++)
+        {
+        snprintf(mcmd, sizeof mcmd, "RC %.*s", L16 - 1, rcp[ip]);
+        pollTXN(&tx, slot, sm, mcmd);
+        }
+      pthread_mutex_lock(&cache_mutex);
+      poll_nrc = poll_nrc + nrc;
+      pthread_mutex_unlock(&cache_mutex);
+      }
+
+    pthread_mutex_lock(&cache_mutex);
+    poll_nsweep++;
+    pthread_mutex_unlock(&cache_mutex);
+    dt = usnow() - tsweep;
+    if(dt < poll_ms * 1000LL) clkSLEEP(poll_ms * 1000LL - dt);
+    }
+  return NULL;
+  }
+
+
+/* =====================================================================================
+ *
+ * Probe slot through the bus, in the discovery class
+ *
+ * =====================================================================================
+ */
+void topoSLOT(int slot)
+  {
+  static struct BusTxn tx;
+
+  tx.type = TXN_PROBE;
+  tx.cls = CLS_DISC;
+  tx.slot = slot;
+  busCALL(&tx);
+  pthread_mutex_lock(&topo_mutex);
+  topo_nprobe++;
+  pthread_mutex_unlock(&topo_mutex);
+  }
+
+
+/* =====================================================================================
+ *
+ * Topology Task - keeps the logic unit table in step with the crate while clients stay
+ * connected. All probes go through the bus at low priority:
+ *   - after a warm start from the topology file every slot is revalidated
+ *   - every topo_rescan seconds the slots without logic unit (empty, failed or unknown
+ *     module) are probed, so a module plugged in or powered later shows up
+ *   - _RESCAN probes all slots (or the one given) right away, to catch a swapped module
+ * The table is saved whenever it changed
+ *
+ * =====================================================================================
+ */
+void *topoTSK(void *arg)
+  {
+  struct timespec tend;
+  int slot, req, empty;
+
+  req = topo_warm ? nSLOTS : -1;
+  for(;;)
+    {
+    if(req < 0)
+      {
+      /* wait for a _RESCAN or the next periodic rescan */
+      if(clk_virtual) clkUNTIL((topo_rescan > 0) ? usnow() + topo_rescan * 1000000LL : 0, &topo_req);
+      pthread_mutex_lock(&topo_mutex);
+      clock_gettime(CLOCK_REALTIME, &tend);
+      tend.tv_sec = tend.tv_sec + ((topo_rescan > 0) ? topo_rescan : 3600);
+      while((topo_req < 0) && (clk_virtual == 0))
+        {
+        if(pthread_cond_timedwait(&topo_cond, &topo_mutex, &tend) != 0) break;
+        }
+      req = topo_req;
+      topo_req = -1;
+      pthread_mutex_unlock(&topo_mutex);
+      if((req < 0) && (topo_rescan <= 0)) continue;
+      }
+
+    for(slot = 0; slot < nSLOTS; slot++)
+      {
+      if((req >= 0) && (req < nSLOTS) && (slot != req)) continue;
+      if(req < 0)
+        {
+        /* periodic rescan - only slots without logic unit */
+        pthread_rwlock_rdlock(&topo_lock);
+        empty = (SS2LU[slot][0] < 0) && (SS2LU[slot][1] < 0);
+        pthread_rwlock_unlock(&topo_lock);
+        if(empty == 0) continue;
+        }
+      topoSLOT(slot);
+      }
+
+    pthread_mutex_lock(&topo_mutex);
+    topo_nscan++;
+    if(topo_dirty) topo_nchange++;
+    pthread_mutex_unlock(&topo_mutex);
+    if(topo_dirty)
+      {
+      logMSG(LOG_INFO, "topoTSK - logic unit table changed, %d logic units", lstLU + 1);
+      topo_dirty = 0;
+      topoSAVE(topo_file);
+      }
+    req = -1;
+    }
+  return NULL;
+  }
+
+
+/* =====================================================================================
+ *
+ * Queue a rescan for the topology thread (_RESCAN [slot]) and report its counters
+ *
+ * =====================================================================================
+ */
+int topoRESCAN(unsigned char *arg, unsigned char *out)
+  {
+  int slot = nSLOTS, n;
+
+  if((sscanf(arg, "%d", &slot) == 1) && ((slot < 0) || (slot >= nSLOTS))) return (ABNORMAL-3);
+  pthread_mutex_lock(&topo_mutex);
+  if((topo_req >= 0) && (topo_req != slot)) slot = nSLOTS; /* two requests - do all */
+  topo_req = slot;
+  pthread_cond_signal(&topo_cond);
+  if(slot < nSLOTS) n = sprintf(out, "RESCAN SLOT %d", slot);
+  else n = sprintf(out, "RESCAN ALL");
+  sprintf(&out[n], " SCANS %ld PROBES %ld CHANGES %ld\n", topo_nscan, topo_nprobe, topo_nchange);
+  pthread_mutex_unlock(&topo_mutex);
+  clkKICK();
+  return NORMAL;
+  }
+
+
+/* =====================================================================================
+ *
+ * Completion of a transaction queued by a connection (called by the bus thread).
+ * The transaction is handed to the event loop, which owns the connections.
+ *
+ * =====================================================================================
+ */
+void connDONE(struct BusTxn *ptx)
+  {
+  uint64_t one = 1;
+
+  pthread_mutex_lock(&net_mutex);
+  ptx->done = 1;
+  ptx->next = net_done;
+  net_done = ptx;
+  pthread_mutex_unlock(&net_mutex);
+  write(net_wakefd, &one, sizeof(one));
+  }
+
+
+/* =====================================================================================
+ *
+ * Close a connection. The structure is freed by the event loop once the current
+ * events are handled, or once its last transaction comes back from the bus
+ *
+ * =====================================================================================
+ */
+void connClose(struct Conn *pc)
+  {
+  if(pc->fd >= 0)
+    {
+    epoll_ctl(net_epfd, EPOLL_CTL_DEL, pc->fd, NULL);
+    close(pc->fd);
+    pc->fd = -1;
+    net_nconn = net_nconn - 1;
+    }
+  if(pc->npend > 0)
+    {
+    pc->gone = 1;
+    return;
+    }
+  if(pc->state == CONN_DEAD) return; /* already on the list */
+
+  /* other events for this connection may still be pending in this epoll batch */
+  pc->state = CONN_DEAD;
+  pc->next = net_dead;
+  net_dead = pc;
+  }
+
+
+/* =====================================================================================
+ *
+ * Wait for input while there is room in the input buffer, and for the socket to
+ * become writable while there is output queued
+ *
+ * =====================================================================================
+ */
+void connEvents(struct Conn *pc)
+  {
+  struct epoll_event ev;
+
+  ev.events = 0;
+  if(pc->inlen < L4096 - 1) ev.events |= EPOLLIN;
+  if(pc->outpos < pc->outlen) ev.events |= EPOLLOUT;
+  if(ev.events == pc->events) return;
+  ev.data.ptr = pc;
+  epoll_ctl(net_epfd, EPOLL_CTL_MOD, pc->fd, &ev);
+  pc->events = ev.events;
+  }
+
+
+/* =====================================================================================
+ *
+ * Send as much of the output queue as the socket takes. Return codes,
+ *  -1 = connection was closed
+ *   0 = OK
+ *
+ * =====================================================================================
+ */
+int connFlush(struct Conn *pc)
+  {
+  int nsent;
+
+  while(pc->outpos < pc->outlen)
+    {
+    nsent = send(pc->fd, &pc->out[pc->outpos], pc->outlen - pc->outpos, MSG_NOSIGNAL);
+    if(nsent < 0)
+      {
+      if(errno == EINTR) continue;
+      if((errno == EAGAIN) || (errno == EWOULDBLOCK)) break;
+      logMSG(LOG_INFO, "connFlush - error sending message: %s", strerror(errno));
+      connClose(pc);
+      return -1;
+      }
+    pc->outpos = pc->outpos + nsent;
+    }
+
+  if(pc->outpos >= pc->outlen)
+    {
+    /* everything went out */
+    pc->outpos = 0;
+    pc->outlen = 0;
+    if(pc->state == CONN_CLOSING)
+      {
+      connClose(pc);
+      return -1;
+      }
+    }
+  connEvents(pc);
+  return 0;
+  }
+
+
+/* =====================================================================================
+ *
+ * Append a message to the output queue of a connection
+ *
+ * =====================================================================================
+ */
+void connQueue(struct Conn *pc, unsigned char *msg, int len)
+  {
+  unsigned char *pnew;
+  int nsize;
+
+  if(pc->outlen + len > pc->outsize)
+    {
+    nsize = pc->outsize;
+    if(nsize < L256) nsize = L256;
+    while(pc->outlen + len > nsize) nsize = 2 * nsize;
+    pnew = (unsigned char *)realloc(pc->out, nsize);
+    if(pnew == NULL)
+      {
+      logMSG(LOG_ERR, "connQueue - realloc failed!");
+      return;
+      }
+    pc->out = pnew;
+    pc->outsize = nsize;
+    }
+  memcpy(&pc->out[pc->outlen], msg, len);
+  pc->outlen = pc->outlen + len;
+  }
+
+
+/* =====================================================================================
+ *
+ * Answer a module command without the bus if possible: ID/PROP/ATTR from the metadata,
+ * RC/DMP/PSUM from the value cache if fresh enough - unless a write of the connection
+ * is queued ahead of it. Return codes,
+ *  0 = the command has to go to the bus
+ *  1 = response is in ptx->rsp
+ *
+ * =====================================================================================
+ */
+int cmdLocal(struct Conn *pc, struct BusTxn *ptx)
+  {
+  int n;
+
+  if(metaLookup(ptx)) return 1;
+  /* a read queued behind our own write must see the result of the write */
+  if(ptx->cread && (ptx->maxage > 0) && (pc->nwrite == 0) && cacheLookup(ptx)) return 1;
+  ptx->nocoal = (pc->nwrite > 0);
+  if(brkALLOW(ptx)) return 0;
+
+  /* degraded module: the last values read, marked "STALE age-ms", or fail at once */
+  ptx->maxage = CACHE_STALE;
+  if(ptx->cread && (pc->bin == 0) && cacheLookup(ptx))
+    {
+    n = ptx->rsplen - 2; /* before CR LF */
+    ptx->rsplen = n + sprintf(&ptx->rsp[n], " STALE %lld\r\n", (usnow() - ptx->tdata) / 1000);
+    __atomic_fetch_add(&brk_slot[ptx->slot].nstale, 1, __ATOMIC_RELAXED);
+    return 1;
+    }
+  __atomic_fetch_add(&brk_slot[ptx->slot].nfast, 1, __ATOMIC_RELAXED);
+  ptx->status = ABNORMAL-12;
+  return 1;
+  }
+
+
+/* =====================================================================================
+ *
+ * Compose the response of a batch once all its commands are done: a "BATCH n" line,
+ * then the n module responses in request order ("? SLOT# SUBMODULE#" for a command
+ * that failed). The commands are freed
+ *
+ * =====================================================================================
+ */
+void batchEND(struct BusTxn *ptx)
+  {
+  struct BusTxn *pk;
+  int ik, n, len;
+
+  n = sprintf(ptx->rsp, "BATCH %d\r\n", ptx->nkid);
+  for(ik = 0; ik < ptx->nkid; ik++)
+    {
+    pk = ptx->kid[ik];
+    len = (pk->status == NORMAL) ? pk->rsplen : 0;
+    if(n + len + L16 >= L4096 - L16) len = 0; /* no room left (prompt comes after) */
+    if(len > 0)
+      {
+      memcpy(&ptx->rsp[n], pk->rsp, len);
+      n = n + len;
+      }
+    else n = n + sprintf(&ptx->rsp[n], "? %d %d\r\n", pk->slot, pk->sm);
+    free(pk);
+    ptx->kid[ik] = NULL;
+    }
+  ptx->rsp[n] = '\0';
+  ptx->rsplen = n;
+  ptx->nkid = 0;
+  }
+
+
+/* =====================================================================================
+ *
+ * Completion of a command of a batch (called by the bus thread). The last one hands
+ * the batch to the event loop.
+ *
+ * =====================================================================================
+ */
+void batchDONE(struct BusTxn *pk)
+  {
+  struct BusTxn *ptx = pk->parent;
+  int nleft;
+
+  pthread_mutex_lock(&net_mutex);
+  pk->done = 1;
+  ptx->nleft = ptx->nleft - 1;
+  nleft = ptx->nleft;
+  pthread_mutex_unlock(&net_mutex);
+  if(nleft > 0) return;
+
+  batchEND(ptx);
+  connDONE(ptx);
+  }
+
+
+/* =====================================================================================
+ *
+ * Start a batch (called by the event loop):
+ *   _ALL module-cmd-syntax                  the read on every logic unit
+ *   _RCL SLOT# SUBMODULE# PROP [PROP ...]   RC of each property of one logic unit
+ * Every command is answered from memory if possible, otherwise queued for the bus
+ * (where it may share an identical read). The batch completes when the last one is done
+ *
+ * =====================================================================================
+ */
+void batchSTART(struct Conn *pc, struct BusTxn *ptx)
+  {
+  unsigned char c[L4096], *w[nBATCH + 3];
+  int lslot[nBATCH], lsm[nBATCH];
+  struct BusTxn *pk, *pbus[nBATCH];
+  int nw, ik, nk = 0, nbus = 0;
+
+  strcpy(c, ptx->cmd);
+  nw = strWords(c, w, nBATCH + 3);
+  ptx->nkid = 0;
+  if(strcmp(w[0], "_ALL") == 0)
+    {
+    /* a read on all logic units */
+    if((nw < 2) || (cmdClass(&ptx->cmd[5]) != CLS_IREAD))
+      {
+      ptx->status = ABNORMAL;
+      return;
+      }
+    pthread_rwlock_rdlock(&topo_lock);
+    for(ik = 0; (ik <= lstLU) && (ik < nBATCH); ik++)
+      {
+      lslot[ik] = pLU[ik]->slot;
+      lsm[ik] = pLU[ik]->smod;
+      }
+    nk = ik;
+    pthread_rwlock_unlock(&topo_lock);
+    }
+  else
+    {
+    /* properties of one logic unit */
+    if((nw < 4) || (isdigit(w[1][0]) == 0) || (isdigit(w[2][0]) == 0))
+      {
+      ptx->status = ABNORMAL;
+      return;
+      }
+    nk = nw - 3;
+    }
+
+  for(ik = 0; ik < nk; ik++)
+    {
+    pk = (struct BusTxn *)calloc(1, sizeof(struct BusTxn)); /* fields not set below are 0 */
+    if(pk == NULL)
+      {
+      logMSG(LOG_ERR, "batchSTART - calloc failed!");
+      break;
+      }
+    if(strcmp(w[0], "_ALL") == 0) sprintf(pk->cmd, "%d %d %.4000s", lslot[ik], lsm[ik], &ptx->cmd[5]);
+    else sprintf(pk->cmd, "%s %s RC %s", w[1], w[2], w[ik + 3]);
+    pk->cmdlen = strlen(pk->cmd);
+    pk->status = cmdParse(pk);
+    pk->maxage = ptx->maxage;
+    pk->parent = ptx;
+    pk->owner = pc;
+    pk->complete = batchDONE;
+    pk->done = 1;
+    if(pk->status != NORMAL)
+      {
+      /* keep the address for the "?" line */
+      pk->slot = (strcmp(w[0], "_ALL") == 0) ? lslot[ik] : atoi(w[1]);
+      pk->sm = (strcmp(w[0], "_ALL") == 0) ? lsm[ik] : atoi(w[2]);
+      }
+    else if(cmdLocal(pc, pk) == 0) pk->done = 0;
+    ptx->kid[ptx->nkid++] = pk;
+    }
+
+  /* queue the ones that need the bus - the batch is done when the last one is. The
+   * batch belongs to the bus thread from the first submit on (the last completion
+   * frees the commands), so take the list first
+   */
+  for(ik = 0; ik < ptx->nkid; ik++) if(ptx->kid[ik]->done == 0) pbus[nbus++] = ptx->kid[ik];
+  ptx->nleft = nbus;
+  if(nbus == 0)
+    {
+    batchEND(ptx);
+    return;
+    }
+  ptx->done = 0;
+  ptx->rel = 0;
+  for(ik = 0; ik < nbus; ik++) busSubmit(pbus[ik]);
+  }
+
+
+/* =====================================================================================
+ *
+ * Little-endian fields of the binary protocol
+ *
+ * =====================================================================================
+ */
+int binGet16(unsigned char *p)
+  {
+  return p[0] | (p[1] << 8);
+  }
+
+void binPut16(unsigned char *p, int v)
+  {
+  p[0] = v & 0xff;
+  p[1] = (v >> 8) & 0xff;
+  }
+
+void binPutF32(unsigned char *p, float f)
+  {
+  uint32_t u;
+
+  memcpy(&u, &f, 4);
+  p[0] = u & 0xff;
+  p[1] = (u >> 8) & 0xff;
+  p[2] = (u >> 16) & 0xff;
+  p[3] = (u >> 24) & 0xff;
+  }
+
+float binGetF32(unsigned char *p)
+  {
+  uint32_t u;
+  float f;
+
+  u = p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+  memcpy(&f, &u, 4);
+  return f;
+  }
+
+
+/* =====================================================================================
+ *
+ * Put the header of a binary frame in front of the n values already stored at
+ * p[BIN_HDR]. Returns the length of the frame
+ *
+ * =====================================================================================
+ */
+int binHDR(unsigned char *p, int id, int op, int st, int lu, int prop, int fmt, int n)
+  {
+  int len = n;
+
+  if(fmt == BFMT_F32) len = 4 * n;
+  else if(fmt == BFMT_U16) len = 2 * n;
+  else if(fmt == BFMT_CHF32) len = 5 * n;
+  else if(fmt == BFMT_NONE) len = 0;
+  binPut16(&p[0], BIN_HDR + len);
+  binPut16(&p[2], id);
+  p[4] = op;
+  p[5] = st;
+  p[6] = lu;
+  p[7] = prop;
+  p[8] = fmt;
+  p[9] = 0;
+  binPut16(&p[10], n);
+  return BIN_HDR + len;
+  }
+
+void binFRAME(struct BusTxn *ptx, int st, int fmt, int n)
+  {
+  ptx->rsplen = binHDR(ptx->rsp, ptx->bid, ptx->bop, st, ptx->blu, ptx->bprop, fmt, n);
+  ptx->bready = 1;
+  }
+
+
+/* =====================================================================================
+ *
+ * Turn the module response of a binary request into its binary response (called by
+ * the event loop): the values of RC, DMP and PSUM are packed, other commands only
+ * return the status; the text of 7 (and of a module error) is sent as it is
+ *
+ * =====================================================================================
+ */
+void binRSP(struct BusTxn *ptx)
+  {
+  unsigned char r[L4096], c[L256], *w[nCHAN + 3], *wc[2], *pv;
+  int nw, n, i1, st;
+
+  if(ptx->bready) return;
+  if(ptx->status != NORMAL)
+    {
+    st = (ptx->bst != BST_OK) ? ptx->bst : ((ptx->status == ABNORMAL-8) ? BST_ELU : BST_EMOD);
+    binFRAME(ptx, st, BFMT_NONE, 0);
+    return;
+    }
+
+  strcpy(r, ptx->rsp);
+  strcpy(c, &ptx->cmd[ptx->moff]); /* cmdParse() checked the length */
+  strWords(c, wc, 2);
+  nw = strWords(r, w, nCHAN + 3);
+  pv = &ptx->rsp[BIN_HDR];
+  if((ptx->bop == BOP_CMD) || (nw < 2) || (strcmp(w[1], wc[0]) != 0))
+    {
+    /* text as received, without the line end */
+    n = strcspn(ptx->rsp, "\r\n");
+    if(n > L4096 - BIN_HDR) n = L4096 - BIN_HDR;
+    memmove(pv, ptx->rsp, n);
+    binFRAME(ptx, (ptx->bop == BOP_CMD) ? BST_OK : BST_EMOD, BFMT_TEXT, n);
+    return;
+    }
+
+  n = 0;
+  if((ptx->bop == BOP_RC) || (ptx->bop == BOP_DMP))
+    {
+    /* "ticket# RC|DMP prop|chan values" */
+    for(i1 = 3; i1 < nw; i1++) binPutF32(&pv[4 * n++], strtod(w[i1], NULL));
+    binFRAME(ptx, BST_OK, BFMT_F32, n);
+    }
+  else if(ptx->bop == BOP_PSUM)
+    {
+    /* "ticket# PSUM words" - hex */
+    for(i1 = 2; i1 < nw; i1++) binPut16(&pv[2 * n++], strtoul(w[i1], NULL, 16));
+    binFRAME(ptx, BST_OK, BFMT_U16, n);
+    }
+  else binFRAME(ptx, BST_OK, BFMT_NONE, 0);
+  }
+
+
+/* =====================================================================================
+ *
+ * Deadband of a property from the precision of its ATTR response
+ * ("ticket# ATTR MV Meas_V V M N 7 %7.1lf" -> 0.1), 0 if there is none. Call with cache_mutex
+ *
+ * =====================================================================================
+ */
+float subDB(struct LUnit *plu, int ip)
+  {
+  unsigned char *pf;
+  float db = 1.0;
+  int prec;
+
+  pf = strrchr(plu->rattr[ip], '%');
+  if(pf != NULL) pf = strchr(pf, '.');
+  if(pf == NULL) return 0.0;
+  prec = atoi(pf + 1);
+  if((prec < 0) || (prec > 9)) return 0.0;
+  while(prec-- > 0) db = db / 10.0;
+  return db;
+  }
+
+
+/* =====================================================================================
+ *
+ * Drop the subscriptions of a connection to property prop of a logic unit, or all of
+ * them (slot < 0). Returns the number dropped
+ *
+ * =====================================================================================
+ */
+int subDROP(struct Conn *pc, int slot, int sm, unsigned char *prop)
+  {
+  struct Sub **pps, *ps;
+  int n = 0;
+
+  pps = &sub_list;
+  while(*pps != NULL)
+    {
+    ps = *pps;
+    if((ps->pc != pc) ||
+       ((slot >= 0) && ((ps->slot != slot) || (ps->sm != sm) || (strcmp(ps->prop, prop) != 0))))
+      {
+      pps = &ps->next;
+      continue;
+      }
+    *pps = ps->next;
+    free(ps);
+    n++;
+    }
+  pc->nsub = pc->nsub - n;
+  pthread_mutex_lock(&cache_mutex);
+  sub_n = sub_n - n;
+  pthread_mutex_unlock(&cache_mutex);
+  return n;
+  }
+
+
+/* =====================================================================================
+ *
+ * Subscribe a connection to channels ch0..ch1 of property prop of a logic unit, replacing
+ * an earlier subscription to the same property. db < 0 takes the deadband from ATTR.
+ * Returns NULL if there is no such logic unit or property
+ *
+ * =====================================================================================
+ */
+struct Sub *subADD(struct Conn *pc, int slot, int sm, unsigned char *prop, int ch0, int ch1, float db, int bid)
+  {
+  struct LUnit *plu;
+  struct Sub *ps;
+  int ip;
+
+  if((slot < 0) || (slot >= nSLOTS) || (sm < 0) || (sm >= nSUBMOD)) return NULL;
+  if(ch1 >= nCHAN) ch1 = nCHAN - 1;
+  if((ch0 < 0) || (ch0 > ch1) || (strlen(prop) >= L16)) return NULL;
+  pthread_rwlock_rdlock(&topo_lock);
+  ip = SS2LU[slot][sm];
+  pthread_rwlock_unlock(&topo_lock);
+  if(ip < 0) return NULL;
+
+  subDROP(pc, slot, sm, prop);
+  if(pc->nsub >= nSUB) return NULL;
+  ps = (struct Sub *)calloc(1, sizeof(struct Sub));
+  if(ps == NULL) return NULL;
+
+  plu = luLOCK(slot, sm);
+  if(plu == NULL)
+    {
+    free(ps);
+    return NULL;
+    }
+  ip = plu->propok ? cacheProp(plu, prop, 0) : -1;
+  if(ip < 0)
+    {
+    pthread_mutex_unlock(&cache_mutex);
+    free(ps);
+    return NULL;
+    }
+  if(db < 0) db = subDB(plu, ip);
+  sub_n = sub_n + 1;
+  sub_gen = sub_gen + 1; /* first push: the values known now */
+  pthread_mutex_unlock(&cache_mutex);
+
+  ps->pc = pc;
+  ps->slot = slot;
+  ps->sm = sm;
+  strcpy(ps->prop, prop);
+  ps->ch0 = ch0;
+  ps->ch1 = ch1;
+  ps->db = db;
+  ps->bid = bid;
+  ps->next = sub_list;
+  sub_list = ps;
+  pc->nsub = pc->nsub + 1;
+  return ps;
+  }
+
+
+/* =====================================================================================
+ *
+ * _SUB [SLOT# SUBMODULE# PROP [FIRST [LAST [DEADBAND]]]] - subscribe, or list the
+ * subscriptions of the connection
+ *
+ * =====================================================================================
+ */
+int subCMD(struct Conn *pc, unsigned char *arg, unsigned char *out)
+  {
+  unsigned char c[L256], *w[6];
+  struct Sub *ps;
+  int nw, n;
+
+  if(strlen(arg) >= L256) return ABNORMAL;
+  strcpy(c, arg);
+  nw = strWords(c, w, 6);
+  if(nw == 0)
+    {
+    n = sprintf(out, "SUB %d PUSH %ld\n", pc->nsub, sub_npush);
+    for(ps = sub_list; ps != NULL; ps = ps->next)
+      {
+      if(ps->pc != pc) continue;
+      n += sprintf(&out[n], "SUB %d %d %s %d %d %g\n", ps->slot, ps->sm, ps->prop, ps->ch0, ps->ch1, ps->db);
+      }
+    return NORMAL;
+    }
+
+  if((nw < 3) || (isdigit(w[0][0]) == 0) || (isdigit(w[1][0]) == 0)) return ABNORMAL;
+  ps = subADD(pc, atoi(w[0]), atoi(w[1]), w[2], (nw > 3) ? atoi(w[3]) : 0,
+    (nw > 4) ? atoi(w[4]) : nCHAN - 1, (nw > 5) ? atof(w[5]) : -1.0, 0);
+  if(ps == NULL) return ABNORMAL;
+  sprintf(out, "SUB %d %d %s %d %d %g\n", ps->slot, ps->sm, ps->prop, ps->ch0, ps->ch1, ps->db);
+  return NORMAL;
+  }
+
+
+/* =====================================================================================
+ *
+ * _UNSUB [SLOT# SUBMODULE# PROP] - drop one subscription or all of them
+ *
+ * =====================================================================================
+ */
+int unsubCMD(struct Conn *pc, unsigned char *arg, unsigned char *out)
+  {
+  unsigned char c[L256], *w[4];
+  int nw, n;
+
+  if(strlen(arg) >= L256) return ABNORMAL;
+  strcpy(c, arg);
+  nw = strWords(c, w, 4);
+  if(nw == 0) n = subDROP(pc, -1, 0, NULL);
+  else if((nw == 3) && isdigit(w[0][0]) && isdigit(w[1][0])) n = subDROP(pc, atoi(w[0]), atoi(w[1]), w[2]);
+  else return ABNORMAL;
+  sprintf(out, "UNSUB %d\n", n);
+  return NORMAL;
+  }
+
+
+/* =====================================================================================
+ *
+ * Push what changed to the subscribers (called by the event loop once the cache counted
+ * a change): every channel whose cached value moved by at least the deadband since it
+ * was pushed last. A text connection gets a "!" line, a binary one an opcode 11 frame
+ *
+ * =====================================================================================
+ */
+void subPUSH(void)
+  {
+  unsigned char out[L4096];
+  struct LUnit *plu;
+  struct Sub *ps;
+  struct CVal *pv;
+  float d;
+  long gen;
+  int ip = -1, ich, n, len;
+
+  if(sub_list == NULL) return;
+  pthread_mutex_lock(&cache_mutex);
+  gen = sub_gen;
+  pthread_mutex_unlock(&cache_mutex);
+  if(gen == sub_seen) return;
+  sub_seen = gen;
+
+  for(ps = sub_list; ps != NULL; ps = ps->next)
+    {
+    if((ps->pc->fd < 0) || (ps->pc->state != CONN_IDLE)) continue;
+    plu = luLOCK(ps->slot, ps->sm);
+    if(plu == NULL) continue;
+
+    n = 0;
+    len = (ps->pc->bin) ? BIN_HDR : sprintf(out, "! %d %d %s", ps->slot, ps->sm, ps->prop);
+    ip = cacheProp(plu, ps->prop, 0);
+    for(ich = ps->ch0; (ip >= 0) && (ich <= ps->ch1) && (ich < plu->nval[ip]); ich++)
+      {
+      pv = &plu->val[ip][ich];
+      if(pv->tread == 0) continue;
+      d = pv->val - ps->last[ich];
+      if(d < 0) d = -d;
+      if(ps->have[ich] && ((d == 0) || (d < ps->db))) continue;
+      ps->have[ich] = 1;
+      ps->last[ich] = pv->val;
+      if(ps->pc->bin)
+        {
+        out[len] = ich;
+        binPutF32(&out[len + 1], pv->val);
+        len = len + 5;
+        }
+      else len += sprintf(&out[len], " %d %s", ich, pv->txt);
+      n++;
+      }
+    pthread_mutex_unlock(&cache_mutex);
+    if(n == 0) continue;
+
+    if(ps->pc->bin) len = binHDR(out, ps->bid, BOP_PUSH, BST_OK, ps->slot * nSUBMOD + ps->sm, ip, BFMT_CHF32, n);
+    else len += sprintf(&out[len], "\r\n");
+    connQueue(ps->pc, out, len);
+    connFlush(ps->pc);
+    sub_npush++;
+    }
+  }
+
+
+/* =====================================================================================
+ *
+ * Send back the responses at the head of the request list of a connection that are
+ * complete (from the bus, the cache or the event loop itself). Responses are queued in
+ * request order, each followed by the prompt; a response that is ready before an
+ * earlier one waits for it. A transaction back from the bus is only taken once the
+ * event loop has taken it off net_done (rel).
+ *
+ * =====================================================================================
+ */
+void cmdRelease(struct Conn *pc)
+  {
+  struct BusTxn *ptx;
+
+  while((pc->phead != NULL) && (pc->phead->rel))
+    {
+    ptx = pc->phead;
+    pc->phead = ptx->cnext;
+    if(pc->phead == NULL) pc->ptail = NULL;
+    pc->npend = pc->npend - 1;
+    if(ptx->write) pc->nwrite = pc->nwrite - 1;
+    capREC(HVPI_CAP_RSP, -1, pc->id, ptx->status, NULL, 0);
+
+    if(pc->bin && (pc->gone == 0) && (pc->state == CONN_IDLE))
+      {
+      /* binary frame, no prompt */
+      binRSP(ptx);
+      connQueue(pc, ptx->rsp, ptx->rsplen);
+      logREC((ptx->status != NORMAL) ? LOG_INFO : LOG_DEBUG, EV_RSP, -1, 0, ptx->status,
+        usnow() - ptx->trecv, NULL, 0);
+      }
+    else if((pc->gone == 0) && (pc->state == CONN_IDLE))
+      {
+      if(ptx->status != NORMAL) /* command execution had an error */
+        {
+        logREC(LOG_INFO, EV_RSP, -1, 0, ptx->status, usnow() - ptx->trecv, ptx->cmd, ptx->cmdlen);
+        strcpy(ptx->rsp,"?\r\n");
+        }
+
+      if(ptx->quit)
+        {
+        /* received command to quit - drop the rest and close once the output is out */
+        pc->state = CONN_CLOSING;
+        pc->inlen = 0;
+        }
+      else
+        {
+        /* send replay back, add prompt */
+        strcat(ptx->rsp, prompt);
+        ptx->rsplen = strlen(ptx->rsp);
+        connQueue(pc, ptx->rsp, ptx->rsplen);
+        if(ptx->status == NORMAL)
+          logREC(LOG_DEBUG, EV_RSP, -1, 0, ptx->status, usnow() - ptx->trecv, ptx->rsp, ptx->rsplen);
+        }
+      }
+    free(ptx);
+    }
+  }
+
+
+/* =====================================================================================
+ *
+ * Command Task - splits the input buffer of a connection into command lines and queues
+ * every complete one for the bus thread, which re-directs it to the high-voltage modules.
+ * A line ends with CR, LF or CR-LF (telnet may send CR-NUL). Whatever follows the
+ * last terminator stays in the buffer until more input arrives.
+ * Commands that need no bus (_Q, _MAXAGE, _CACHE, _SUB, _STATS, syntax errors, reads the cache can
+ * answer) are completed right here, in order with the others. A batch (_ALL, _RCL)
+ * is one request of the connection; its module commands are queued one by one.
+ *
+ * =====================================================================================
+ */
+void cmdTSK(struct Conn *pc)
+  {
+  struct BusTxn *ptx;
+  long long tparse;
+  int i1, i2, len;
+
+  i1 = 0;
+  while((pc->state == CONN_IDLE) && (pc->quit == 0) && (pc->npend < nPIPE))
+    {
+    /* a LF (or telnet NUL) right after a CR belongs to the previous line */
+    if(pc->lastcr)
+      {
+      if(i1 >= pc->inlen) break;
+      if((pc->in[i1] == '\n') || (pc->in[i1] == '\0')) i1 = i1 + 1;
+      pc->lastcr = 0;
+      continue;
+      }
+
+    /* search for the end of the line */
+    for(i2 = i1; i2 < pc->inlen; i2++)
+      {
+      if((pc->in[i2] == '\r') || (pc->in[i2] == '\n')) break;
+      }
+    if(i2 >= pc->inlen)
+      {
+      /* incomplete line - wait for the rest, unless it can never fit */
+      if((i1 > 0) || (pc->inlen < L4096 - 1)) break;
+      }
+    len = i2 - i1;
+
+    ptx = (struct BusTxn *)malloc(sizeof(struct BusTxn));
+    if(ptx == NULL)
+      {
+      logMSG(LOG_ERR, "cmdTSK - malloc failed!");
+      break;
+      }
+    memcpy(ptx->cmd, &pc->in[i1], len);
+    ptx->cmd[len] = '\0';
+    ptx->cmdlen = len;
+    if(i2 < pc->inlen) pc->lastcr = (pc->in[i2] == '\r');
+    i1 = i2 + 1;
+    ptx->trecv = usnow();
+    logREC(LOG_DEBUG, EV_CMD, -1, 0, 0, 0, ptx->cmd, ptx->cmdlen);
+    capREC(HVPI_CAP_REQ, -1, pc->id, len, ptx->cmd, len);
+
+    /* keep the request order of this connection */
+    ptx->complete = connDONE;
+    ptx->owner = pc;
+    ptx->cnext = NULL;
+    ptx->write = 0;
+    if(pc->ptail == NULL) pc->phead = ptx;
+    else pc->ptail->cnext = ptx;
+    pc->ptail = ptx;
+    pc->npend = pc->npend + 1;
+
+    tparse = usnow();
+    ptx->status = cmdParse(ptx);
+    statERR(ptx->status, -1);
+    if((ptx->status == NORMAL) && (ptx->type == TXN_MOD))
+      statREC(ST_PARSE, statVERB(&ptx->cmd[ptx->moff]), ptx->slot, usnow() - tparse);
+    if(ptx->maxage < 0) ptx->maxage = pc->maxage;
+    ptx->done = 1; /* unless it goes to the bus */
+    ptx->rel = 1;
+    if(ptx->status != NORMAL) continue;
+    switch(ptx->type)
+      {
+      case TXN_Q:
+        /* nothing after _Q is executed, even if it comes while earlier commands are on the bus */
+        pc->quit = 1;
+        continue;
+      case TXN_MAXAGE:
+        /* set (or show) the default max-age of this connection */
+        if(sscanf(&ptx->cmd[7], "%d", &len) == 1) pc->maxage = (len > 0) ? len : 0;
+        sprintf(ptx->rsp, "MAXAGE %d\n", pc->maxage);
+        continue;
+      case TXN_CACHE:
+        cacheSTATS(ptx->rsp);
+        continue;
+      case TXN_RESCAN:
+        /* the probes run in the topology thread - answer now */
+        ptx->status = topoRESCAN(&ptx->cmd[7], ptx->rsp);
+        continue;
+      case TXN_SUB:
+        ptx->status = subCMD(pc, &ptx->cmd[4], ptx->rsp);
+        continue;
+      case TXN_STATS:
+        ptx->status = statTEXT(&ptx->cmd[6], ptx->rsp);
+        continue;
+      case TXN_HEALTH:
+        brkSTATS(ptx->rsp);
+        continue;
+      case TXN_UNSUB:
+        ptx->status = unsubCMD(pc, &ptx->cmd[6], ptx->rsp);
+        continue;
+      case TXN_BATCH:
+        /* the commands of the batch go to the bus on their own */
+        batchSTART(pc, ptx);
+        continue;
+      case TXN_MOD:
+        if(cmdLocal(pc, ptx)) continue;
+        if(ptx->cread == 0)
+          {
+          ptx->write = 1;
+          pc->nwrite = pc->nwrite + 1;
+          }
+        break;
+      }
+    busSubmit(ptx);
+    }
+
+  /* drop what has been taken */
+  if(pc->quit || (i1 > pc->inlen)) i1 = pc->inlen;
+  if(i1 > 0)
+    {
+    memmove(pc->in, &pc->in[i1], pc->inlen - i1);
+    pc->inlen = pc->inlen - i1;
+    }
+
+  cmdRelease(pc);
+  }
+
+
+/* =====================================================================================
+ *
+ * Binary request parsing (called by the event loop): the frame in ptx->cmd is turned
+ * into the module command "SLOT# SUBMODULE# module-cmd-syntax" and goes through
+ * cmdParse() like a text command. The list of logic units is answered right here.
+ *
+ * Return codes,
+ *  -1 = request refused = ABNORMAL (ptx->bst tells why)
+ *   0 = request OK = NORMAL
+ * =====================================================================================
+ */
+int binParse(struct BusTxn *ptx)
+  {
+  unsigned char req[BIN_MAXREQ], m[L256], name[L16];
+  struct LUnit *plu;
+  int len, ich, n, i1, iv, status;
+  float db, v;
+
+  len = ptx->cmdlen;
+  memcpy(req, ptx->cmd, len);
+  ptx->bid = binGet16(&req[2]);
+  ptx->bop = req[4];
+  ptx->blu = req[5];
+  ptx->bprop = req[6];
+  ich = req[7];
+  n = binGet16(&req[10]);
+  ptx->bst = BST_OK;
+  ptx->bready = 0;
+  ptx->type = TXN_MOD;
+  ptx->quit = 0;
+  ptx->cread = 0;
+
+  if(ptx->bop == BOP_LUS)
+    {
+    pthread_rwlock_rdlock(&topo_lock);
+    for(i1 = 0; i1 <= lstLU; i1++) ptx->rsp[BIN_HDR + i1] = pLU[i1]->slot * nSUBMOD + pLU[i1]->smod;
+    pthread_rwlock_unlock(&topo_lock);
+    binFRAME(ptx, BST_OK, BFMT_U8, i1);
+    return NORMAL;
+    }
+
+  if((ptx->bop == BOP_UNSUB) && (ptx->blu == 0xff))
+    {
+    subDROP(ptx->owner, -1, 0, NULL);
+    binFRAME(ptx, BST_OK, BFMT_NONE, 0);
+    return NORMAL;
+    }
+
+  /* the logic unit - and the name of the property for RC, LD and subscriptions */
+  if(ptx->blu >= nLU)
+    {
+    ptx->bst = BST_ELU;
+    return ABNORMAL;
+    }
+  plu = luLOCK(ptx->blu / nSUBMOD, ptx->blu % nSUBMOD);
+  if(plu == NULL)
+    {
+    ptx->bst = BST_ELU;
+    return ABNORMAL;
+    }
+  name[0] = '\0';
+  if(plu->propok && (ptx->bprop < plu->nprop)) strcpy(name, plu->pname[ptx->bprop]);
+  pthread_mutex_unlock(&cache_mutex);
+
+  ptx->bst = BST_EREQ;
+  if((ptx->bop == BOP_SUB) || (ptx->bop == BOP_UNSUB))
+    {
+    if(name[0] == '\0')
+      {
+      ptx->bst = BST_EPROP;
+      return ABNORMAL;
+      }
+    if(ptx->bop == BOP_UNSUB) subDROP(ptx->owner, ptx->blu / nSUBMOD, ptx->blu % nSUBMOD, name);
+    else
+      {
+      db = (len >= BIN_HDR + 4) ? binGetF32(&req[BIN_HDR]) : -1.0;
+      if(subADD(ptx->owner, ptx->blu / nSUBMOD, ptx->blu % nSUBMOD, name, ich, (n > 0) ? ich + n - 1 : nCHAN - 1, db, ptx->bid) == NULL) return ABNORMAL;
+      }
+    binFRAME(ptx, BST_OK, BFMT_NONE, 0);
+    return NORMAL;
+    }
+  switch(ptx->bop)
+    {
+    case BOP_RC:
+    case BOP_LD:
+      if(name[0] == '\0')
+        {
+        ptx->bst = BST_EPROP;
+        return ABNORMAL;
+        }
+      if(ptx->bop == BOP_RC)
+        {
+        sprintf(m, "RC %s", name);
+        break;
+        }
+      if((n < 1) || (ich + n > nCHAN) || (len < BIN_HDR + 4 * n)) return ABNORMAL;
+      i1 = snprintf(m, sizeof m, "LD %s %d", name, ich);
+      for(iv = 0; iv < n; iv++)
+        {
+        /* values from the network - nothing a module could not take */
+        v = binGetF32(&req[BIN_HDR + 4 * iv]);
+        if((isfinite(v) == 0) || (fabsf(v) >= BIN_LDMAX)) return ABNORMAL;
+        i1 += snprintf(&m[i1], sizeof m - i1, " %.3f", v);
+        if(i1 >= (int)sizeof m) return ABNORMAL; /* cut short */
+        }
+      break;
+    case BOP_DMP:
+      if(ich >= nCHAN) return ABNORMAL;
+      sprintf(m, "DMP %d", ich);
+      break;
+    case BOP_PSUM:
+      strcpy(m, "PSUM");
+      break;
+    case BOP_HVON:
+      strcpy(m, "HVON");
+      break;
+    case BOP_HVOFF:
+      strcpy(m, "HVOFF");
+      break;
+    case BOP_CMD:
+      if((len <= BIN_HDR) || (len - BIN_HDR >= L256 - L16)) return ABNORMAL;
+      memcpy(m, &req[BIN_HDR], len - BIN_HDR);
+      m[len - BIN_HDR] = '\0';
+      if(strcspn(m, "\r\n") != len - BIN_HDR) return ABNORMAL;
+      break;
+    default:
+      ptx->bst = BST_EOP;
+      return ABNORMAL;
+    }
+
+  ptx->cmdlen = sprintf(ptx->cmd, "%d %d %s", ptx->blu / nSUBMOD, ptx->blu % nSUBMOD, m);
+  status = cmdParse(ptx);
+  ptx->maxage = binGet16(&req[8]);
+  if(status == ABNORMAL-8) ptx->bst = BST_ELU;
+  else if(status == NORMAL) ptx->bst = BST_OK;
+  return status;
+  }
+
+
+/* =====================================================================================
+ *
+ * Answer a binary request without the bus if possible (called by the event loop).
+ * RC, DMP and PSUM are packed straight from the cached values when fresh enough (of a
+ * degraded module: any cached values, status BST_STALE), anything else goes through
+ * cmdLocal(). Return codes,
+ *  0 = the request has to go to the bus
+ *  1 = response is in ptx->rsp
+ *
+ * =====================================================================================
+ */
+int binLookup(struct Conn *pc, struct BusTxn *ptx)
+  {
+  struct LUnit *plu;
+  unsigned char *pv = &ptx->rsp[BIN_HDR];
+  long long told;
+  int ip, ich, n = 0, fmt, stale = 0;
+
+  if((ptx->bop != BOP_RC) && (ptx->bop != BOP_DMP) && (ptx->bop != BOP_PSUM)) return cmdLocal(pc, ptx);
+  ptx->nocoal = (pc->nwrite > 0);
+  /* a read queued behind our own write must see the result of the write */
+  if((ptx->maxage <= 0) || (pc->nwrite > 0)) goto bus;
+
+  told = usnow() - (long long)ptx->maxage * 1000;
+  plu = luLOCK(ptx->slot, ptx->sm);
+  if(plu == NULL) return 0;
+
+again:
+  n = 0;
+  if(ptx->bop == BOP_RC)
+    {
+    ip = ptx->bprop;
+    if((plu->propok == 0) || (ip >= plu->nprop) || (plu->nval[ip] == 0)) goto miss;
+    for(ich = 0; ich < plu->nval[ip]; ich++)
+      {
+      if(plu->val[ip][ich].tread <= told) goto miss;
+      binPutF32(&pv[4 * n++], plu->val[ip][ich].val);
+      }
+    fmt = BFMT_F32;
+    }
+  else if(ptx->bop == BOP_DMP)
+    {
+    ich = atoi(&ptx->cmd[ptx->moff + 4]);
+    if((plu->propok == 0) || (plu->nprop == 0)) goto miss;
+    for(ip = 0; ip < plu->nprop; ip++)
+      {
+      if(plu->val[ip][ich].tread <= told) goto miss;
+      binPutF32(&pv[4 * n++], plu->val[ip][ich].val);
+      }
+    fmt = BFMT_F32;
+    }
+  else
+    {
+    if(plu->npsum == 0) goto miss;
+    for(ip = 0; ip < plu->npsum; ip++)
+      {
+      if(plu->psum[ip].tread <= told) goto miss;
+      binPut16(&pv[2 * n++], strtoul(plu->psum[ip].txt, NULL, 16));
+      }
+    fmt = BFMT_U16;
+    }
+  cache_nhit++;
+  pthread_mutex_unlock(&cache_mutex);
+  binFRAME(ptx, stale ? BST_STALE : BST_OK, fmt, n);
+  if(stale) __atomic_fetch_add(&brk_slot[ptx->slot].nstale, 1, __ATOMIC_RELAXED);
+  return 1;
+
+miss:
+  cache_nmiss++;
+  pthread_mutex_unlock(&cache_mutex);
+  if(stale)
+    {
+    /* nothing cached either */
+    __atomic_fetch_add(&brk_slot[ptx->slot].nfast, 1, __ATOMIC_RELAXED);
+    ptx->status = ABNORMAL-12;
+    return 1;
+    }
+
+bus:
+  if(brkALLOW(ptx)) return 0;
+  /* degraded module: whatever values were last read */
+  plu = luLOCK(ptx->slot, ptx->sm);
+  if(plu == NULL) return 0;
+  told = 0;
+  stale = 1;
+  goto again;
+  }
+
+
+/* =====================================================================================
+ *
+ * Binary Task - cmdTSK() for a connection on the binary port: splits the input buffer
+ * into frames (the first two bytes are the length) and queues every complete one.
+ * A frame of impossible length ends the connection, there is no way to find the next.
+ *
+ * =====================================================================================
+ */
+void binTSK(struct Conn *pc)
+  {
+  struct BusTxn *ptx;
+  long long tparse;
+  int i1, len;
+
+  i1 = 0;
+  while((pc->state == CONN_IDLE) && (pc->npend < nPIPE))
+    {
+    if(pc->inlen - i1 < 2) break;
+    len = binGet16(&pc->in[i1]);
+    if((len < BIN_HDR) || (len > BIN_MAXREQ))
+      {
+      logMSG(LOG_INFO, "binTSK - bad frame length %d, closing connection", len);
+      pc->state = CONN_CLOSING;
+      i1 = pc->inlen;
+      break;
+      }
+    if(pc->inlen - i1 < len) break;
+
+    ptx = (struct BusTxn *)malloc(sizeof(struct BusTxn));
+    if(ptx == NULL)
+      {
+      logMSG(LOG_ERR, "binTSK - malloc failed!");
+      break;
+      }
+    memcpy(ptx->cmd, &pc->in[i1], len);
+    ptx->cmdlen = len;
+    i1 = i1 + len;
+    capREC(HVPI_CAP_BREQ, -1, pc->id, 0, ptx->cmd, len);
+
+    /* keep the request order of this connection */
+    ptx->complete = connDONE;
+    ptx->owner = pc;
+    ptx->cnext = NULL;
+    ptx->write = 0;
+    if(pc->ptail == NULL) pc->phead = ptx;
+    else pc->ptail->cnext = ptx;
+    pc->ptail = ptx;
+    pc->npend = pc->npend + 1;
+
+    tparse = usnow();
+    ptx->trecv = tparse;
+    ptx->status = binParse(ptx);
+    statERR(ptx->status, -1);
+    if((ptx->status == NORMAL) && (ptx->bready == 0))
+      statREC(ST_PARSE, statVERB(&ptx->cmd[ptx->moff]), ptx->slot, usnow() - tparse);
+    ptx->done = 1; /* unless it goes to the bus */
+    ptx->rel = 1;
+    if((ptx->status != NORMAL) || ptx->bready) continue;
+    if(binLookup(pc, ptx)) continue;
+    if(ptx->cread == 0)
+      {
+      ptx->write = 1;
+      pc->nwrite = pc->nwrite + 1;
+      }
+    busSubmit(ptx);
+    }
+
+  /* drop what has been taken */
+  if(i1 > 0)
+    {
+    memmove(pc->in, &pc->in[i1], pc->inlen - i1);
+    pc->inlen = pc->inlen - i1;
+    }
+
+  cmdRelease(pc);
+  }
+
+
+/* =====================================================================================
+ *
+ * Command Response - a transaction of connection pc came back from the bus thread.
+ * Send back what is ready and take more lines now that there is room on the bus.
+ *
+ * =====================================================================================
+ */
+void cmdRSP(struct Conn *pc)
+  {
+  cmdRelease(pc);
+  if(pc->gone)
+    {
+    /* nobody to answer to */
+    if(pc->npend == 0) connClose(pc);
+    return;
+    }
+
+  /* room on the bus again - take more lines */
+  if(pc->bin) binTSK(pc);
+  else cmdTSK(pc);
+  connFlush(pc);
+  }
+
+
+/* =====================================================================================
+ *
+ * Read whatever the socket has into the input buffer of the connection and queue the
+ * complete command lines
+ *
+ * =====================================================================================
+ */
+void connRead(struct Conn *pc)
   {
-    printf("cmdEXE: check handshake ERROR: %d\n", status);
-    return (status); /* get handshake */
-   }
-         
-  /* wait up-to 2 sec for module to indicate is ready to send response to previous command */
-  if(IsGpioSet(23,2.0) != NORMAL) return (ABNORMAL-11);
-  
-  sio_TXbuff[0] = '\0';
-  strcpy(sio_TXbuff,pLU[SS2LU[slot][sm]]->ack);
-  sio_TXlen = strlen(sio_TXbuff);
-  write(sio,sio_TXbuff,sio_TXlen);
-  status=msgget(50);
-  if(status == MSGstat_OK) /* 50 char wait (13ms) */
+  int nread;
+
+  while(pc->inlen < L4096 - 1)
     {
-    nio_TXbuff[0] = '\0';
-    strcpy(nio_TXbuff,&sio_MSGbuff[1]); /* skip ACK byte */
-/*** 12-May-2014 *
-    tmp[0] = '\0';      
-    sprintf(tmp,"(%d,%d): ", slot, sm);
-    strcat(tmp, nio_TXbuff);
-***/
-    nio_TXlen = strlen(nio_TXbuff);
-    return NORMAL;
-    } else 
-	{
-  	   printf("cmdEXE: msgget() 1 status : %d\n",status);
-	   return status;
-	}
-   
-  return status;
+    nread = read(pc->fd, &pc->in[pc->inlen], L4096 - 1 - pc->inlen);
+    if(nread < 0)
+      {
+      if(errno == EINTR) continue;
+      if((errno == EAGAIN) || (errno == EWOULDBLOCK)) break;
+      }
+    if(nread <= 0)
+      {
+      /* either the client closed the connection or there is a problem
+       * with the connection - bail out
+       */
+      connClose(pc);
+      return;
+      }
+    pc->inlen = pc->inlen + nread;
+    if(pc->state != CONN_IDLE) pc->inlen = 0; /* closing - ignore input */
+    if(pc->bin) binTSK(pc);
+    else cmdTSK(pc);
+    }
+
+  /* send what the cache answered; stop reading while the buffer is full
+   * (too many commands on the bus)
+   */
+  connFlush(pc);
   }
 
 
 /* =====================================================================================
  *
- * Command Task - commands arriving through the network connection are re-directed to
- * the high-voltage modules. Module responses are sent back through the same network
- * connection
+ * Accept all pending connections on a listening socket (bin: the binary protocol one)
  *
  * =====================================================================================
  */
-static void cmdTSK(int connection_fd)
+void connAccept(int mySock, int bin)
   {
-int cmdStat=0;
+  struct sockaddr_in remAddr;
+  struct epoll_event ev;
+  struct Conn *pc;
+  socklen_t addrlen;
+  int connection;
+
   for(;;)
     {
-	memset(nio_RXbuff, 0, sizeof(nio_RXbuff));
-	nio_RXlen = read(connection_fd, nio_RXbuff, L4096-1);
-	/* nio_RXlen = read(fd, nio_RXbuff, 1); */
-	
-	if(nio_RXlen <= 0)
+	addrlen = sizeof(remAddr);
+	connection = accept(mySock, (struct sockaddr *)&remAddr, &addrlen);
+	if(connection < 0)
 	  {
-	  /* either the client closed the connection before sending any data or
-	   * there is a problem with the connection - bail out
-	   *
-	   * printf("cmdTSK - error receiving message....\n");
-	   */
-	  break;
+	  if((errno == EAGAIN) || (errno == EWOULDBLOCK)) return;
+	  if((errno == EINTR) || (errno == ECONNABORTED)) continue;
+	  logMSG(LOG_ERR, "NetServer - Can't accept new connection: %s", strerror(errno));
+	  return;
 	  }
-    else
+    fcntl(connection, F_SETFL, fcntl(connection, F_GETFL) | O_NONBLOCK);
+
+    pc = (struct Conn *)calloc(1, sizeof(struct Conn));
+    if(pc == NULL)
+      {
+      logMSG(LOG_ERR, "NetServer - malloc failed for new connection");
+      close(connection);
+      continue;
+      }
+    pc->fd = connection;
+    pc->bin = bin;
+    pc->id = ++cap_nconn;
+    pc->state = CONN_IDLE;
+    pc->events = EPOLLIN;
+    ev.events = EPOLLIN;
+    ev.data.ptr = pc;
+    if(epoll_ctl(net_epfd, EPOLL_CTL_ADD, connection, &ev) < 0)
+      {
+      logMSG(LOG_ERR, "NetServer - Can't watch new connection: %s", strerror(errno));
+      close(connection);
+      free(pc);
+      continue;
+      }
+    net_nconn = net_nconn + 1;
+    }
+  }
+
+
+
+/* ======================================================================================
+ *
+ * Bus latency benchmark - times ntimes transactions of each command type on every
+ * logic unit, first with the fixed-wait reader and then with the event-driven reader.
+ * The ACK row is the bare handshake exchange used by _CLI.
+ *
+ * ======================================================================================
+ */
+#define  nBENCH  5 /* number of command types in the benchmark */
+
+void benchBUS(int ntimes)
+  {
+  char bcmd[nBENCH][L16] = {"ACK", "HVSTATUS", "ID", "PSUM", "RC MV"};
+  static struct BusTxn tx;
+  double tsum[2][nBENCH], tmax[2][nBENCH];
+  int nok[2][nBENCH], nerr[2][nBENCH];
+  long long t0, dt;
+  int imode, icmd, ilu, itry, stat;
+
+  for(imode = 0; imode < 2; imode++)
+    {
+    sio_fixed = (imode == 0); /* first the fixed-wait reader, then poll() */
+    for(icmd = 0; icmd < nBENCH; icmd++)
       {
-	  /* pass command to module */
-/**** 01-May-2014 just send back */	
-	printf("cmdTSK : got(%d) : %s \n", nio_RXlen, nio_RXbuff);
-/**	strcpy(nio_TXbuff, nio_RXbuff);
-	nio_TXlen = nio_RXlen;
-****/
-
-/**** 27-Jul-2014 ****/	
-	if(1) {
-	cmdStat=cmdEXE();
-	if(cmdStat != NORMAL) /* command execution had an error */
+      tsum[imode][icmd] = 0.0;
+      tmax[imode][icmd] = 0.0;
+      nok[imode][icmd] = 0;
+      nerr[imode][icmd] = 0;
+      for(ilu = 0; ilu <= lstLU; ilu++)
         {
-        nio_TXbuff[0] = '\0';
-	/* tmp[0]='\0'; */
-	printf("cmdEXE : ERROR status : %d\n",cmdStat);
-        strcpy(nio_TXbuff,"?\r\n");
-        nio_TXlen = strlen(nio_TXbuff);
+        for(itry = 0; itry < ntimes; itry++)
+          {
+          t0 = usnow();
+          if(icmd == 0)
+            {
+            sio_TXlen = strlen(pLU[ilu]->ack);
+            sioSEND(pLU[ilu]->ack, sio_TXlen);
+            stat = (msgget(50) > MSGstat_NONE) ? NORMAL : ABNORMAL;
+            }
+          else
+            {
+            sprintf(tx.cmd, "%d %d %s\r", pLU[ilu]->slot, pLU[ilu]->smod, bcmd[icmd]);
+            tx.cmdlen = strlen(tx.cmd);
+            stat = cmdParse(&tx);
+            if(stat == NORMAL) stat = cmdEXE(&tx);
+            }
+          dt = usnow() - t0;
+          if(stat != NORMAL)
+            {
+            nerr[imode][icmd]++;
+            continue;
+            }
+          nok[imode][icmd]++;
+          tsum[imode][icmd] += dt / 1000.0;
+          if(dt / 1000.0 > tmax[imode][icmd]) tmax[imode][icmd] = dt / 1000.0;
+          }
         }
-       }/*if(1)*/
-
-      /* received command to quit - bail out of this loop */
-      if(nio_quit)
-	    {
-	    nio_quit = 0;
-	    return;
-	    }
-
-	  /* send replay back */	  
-	  /* add prompt */
-	  strcat(nio_TXbuff, prompt);
-	  nio_TXlen = strlen(nio_TXbuff);
-	  if(send(connection_fd, nio_TXbuff, nio_TXlen, 0) < 0)
-	    {
-		printf("cmdTSK - error sending message....\n");
-		}
-	  printf("cmdTSK : sentback: %s\n", nio_TXbuff);
+      }
+    }
+  sio_fixed = 0;
 
-	  }
-	}
+  printf("\nbus latency [ms] over %d logic units x %d tries\n", lstLU + 1, ntimes);
+  printf("%-10s %10s %10s %6s %10s %10s %6s %8s\n", "command",
+    "fixed-avg", "fixed-max", "err", "poll-avg", "poll-max", "err", "speedup");
+  for(icmd = 0; icmd < nBENCH; icmd++)
+    {
+    for(imode = 0; imode < 2; imode++)
+      {
+      if(nok[imode][icmd] > 0) tsum[imode][icmd] /= nok[imode][icmd];
+      }
+    printf("%-10s %10.2f %10.2f %6d %10.2f %10.2f %6d %8.2f\n", bcmd[icmd],
+      tsum[0][icmd], tmax[0][icmd], nerr[0][icmd],
+      tsum[1][icmd], tmax[1][icmd], nerr[1][icmd],
+      (tsum[1][icmd] > 0.0) ? tsum[0][icmd] / tsum[1][icmd] : 0.0);
+    }
   }
 
 
 
 /* ======================================================================================
  *
- * Network Server
+ * ATTN wait benchmark on the fake line - a helper thread raises the line after a
+ * random delay of up to 20 ms and we measure how late the waiter wakes up, first
+ * with the 5 ms level sampling of IsGpioPoll() and then with IsGpioEvent().
  *
  * ======================================================================================
  */
-static void NetServer(unsigned short port)
+long long attn_traise; /* time the helper thread raised the fake line */
+
+void *attn_raiser(void *arg)
   {
-  pid_t child_pid;
-  int mySock, connection, yes=1;
-  struct sockaddr_in myAddr, remAddr;
-  socklen_t addrlen;
+  usleep(*(int *)arg);
+  attn_traise = usnow();
+  attn_fake_set(1);
+  return NULL;
+  }
+
+void benchATTN(int ntimes)
+  {
+  char bmode[2][L16] = {"5ms-poll", "event"};
+  double tsum, tmax, dt;
+  pthread_t thr;
+  int imode, itry, delay, nerr;
+
+  attn_mode = ATTN_FAKE;
+  attn_open();
+  srand(12345);
+
+  printf("\nATTN wake-up latency [ms] over %d tries (fake line)\n", ntimes);
+  printf("%-10s %10s %10s %6s\n", "wait", "avg", "max", "err");
+  for(imode = 0; imode < 2; imode++)
+    {
+    tsum = 0.0;
+    tmax = 0.0;
+    nerr = 0;
+    for(itry = 0; itry < ntimes; itry++)
+      {
+      attn_fake_set(0);
+      delay = rand() % 20000;
+      pthread_create(&thr, NULL, attn_raiser, &delay);
+      if(imode == 0) nerr += (IsGpioPoll(ATTN_GPIO, 2.0) != NORMAL);
+      else nerr += (IsGpioEvent(ATTN_GPIO, 2.0) != NORMAL);
+      dt = (usnow() - attn_traise) / 1000.0;
+      pthread_join(thr, NULL);
+      tsum += dt;
+      if(dt > tmax) tmax = dt;
+      }
+    printf("%-10s %10.3f %10.3f %6d\n", bmode[imode], tsum / ntimes, tmax, nerr);
+    }
+  }
+
+
+/* ======================================================================================
+ *
+ * Network Server - a single epoll event loop serves all connections. Commands are
+ * executed by the bus thread; completed transactions come back through an eventfd
+ *
+ * ======================================================================================
+ */
+#define  nEVENTS   64 /* events handled per epoll_wait() */
+
+/* ======================================================================================
+ *
+ * Open a non-blocking listening socket on port. Return codes,
+ *  -1 = failed
+ *  socket descriptor
+ *
+ * ======================================================================================
+ */
+int netLISTEN(unsigned short port)
+  {
+  struct sockaddr_in myAddr;
+  int mySock, yes=1;
 
   /* Create socket */
   mySock = socket (AF_INET, SOCK_STREAM, 0);
   if(mySock < 0)
     {
     printf("NetServer - Can't create socket ...\n");
-    exit(1);
+    return -1;
     }
   
   /* Allow socket address reuse */
   if(setsockopt(mySock, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(int)) == -1)
     {
     printf("NetServer - Setsockopt error .....");
-    exit(1);
+    close(mySock);
+    return -1;
     }
  
   /* Bind socket */
@@ -515,68 +5473,180 @@ static void NetServer(unsigned short port)
   if(bind(mySock, (struct sockaddr *)&myAddr, sizeof(myAddr)) != 0)
 	{
 	printf("NetServer - Can't bind to socket: %s", strerror (errno));
-	exit(1);
+	close(mySock);
+	return -1;
 	}
 		
   /* Listen for connections */
-  if(listen(mySock, 10) < 0) /* maximum of 10 pending connections */
+  if(listen(mySock, 128) < 0) /* maximum of 128 pending connections */
     {
     printf("NetServer - Can't listen on socket: %s", strerror (errno));
+    close(mySock);
+    return -1;
+    }
+  fcntl(mySock, F_SETFL, fcntl(mySock, F_GETFL) | O_NONBLOCK);
+  return mySock;
+  }
+
+
+static void NetServer(unsigned short port)
+  {
+  struct epoll_event ev, events[nEVENTS];
+  struct BusTxn *ptx, *pdone;
+  struct Conn *pc;
+  struct rlimit rl;
+  uint64_t count;
+  int mySock, binSock, nev, iev;
+
+  /* text protocol - and the binary one on the next port */
+  mySock = netLISTEN(port);
+  if(mySock < 0) exit(1);
+  binSock = netLISTEN(port + 1);
+  if(binSock < 0) printf("NetServer - no binary protocol on port %d\n", port + 1);
+
+  /* hundreds of clients may connect - allow as many descriptors as we can */
+  if(getrlimit(RLIMIT_NOFILE, &rl) == 0)
+    {
+    rl.rlim_cur = rl.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &rl);
+    }
+
+  /* Event loop: listening socket + bus thread completions */
+  net_epfd = epoll_create1(0);
+  net_wakefd = eventfd(0, EFD_NONBLOCK);
+  if((net_epfd < 0) || (net_wakefd < 0))
+    {
+    printf("NetServer - Can't create event loop: %s\n", strerror(errno));
     exit(1);
     }
-		
-  /* Accept connection */		
+  net_listen.fd = mySock;
+  ev.events = EPOLLIN;
+  ev.data.ptr = &net_listen;
+  epoll_ctl(net_epfd, EPOLL_CTL_ADD, mySock, &ev);
+  if(binSock >= 0)
+    {
+    net_blisten.fd = binSock;
+    ev.events = EPOLLIN;
+    ev.data.ptr = &net_blisten;
+    epoll_ctl(net_epfd, EPOLL_CTL_ADD, binSock, &ev);
+    }
+  net_wake.fd = net_wakefd;
+  ev.events = EPOLLIN;
+  ev.data.ptr = &net_wake;
+  epoll_ctl(net_epfd, EPOLL_CTL_ADD, net_wakefd, &ev);
+
+  /* kill -USR1 prints the latency statistics */
+  signal(SIGUSR1, statSIG);
+
+  /* Start the bus thread - it owns the serial port from now on. The bus, topology and
+   * refresher threads drive the virtual clock from here, the event loop does not
+   */
+  pthread_mutex_lock(&bus_mutex);
+  clk_nrun = clk_nrun - 1 + 2 + ((poll_ms > 0) ? 1 : 0);
+  pthread_mutex_unlock(&bus_mutex);
+  bus_t0 = usnow();
+  if(pthread_create(&bus_thread, NULL, busTSK, NULL) != 0)
+    {
+    printf("NetServer - Can't start bus thread ...\n");
+    exit(1);
+    }
+
+  /* Start the topology thread (revalidation after a warm start, rescans) */
+  if(pthread_create(&topo_thread, NULL, topoTSK, NULL) != 0)
+    {
+    printf("NetServer - Can't start topology thread ...\n");
+    exit(1);
+    }
+
+  /* Start the background refresher */
+  if((poll_ms > 0) && (pthread_create(&poll_thread, NULL, pollTSK, NULL) != 0))
+    {
+    printf("NetServer - Can't start refresher thread ...\n");
+    exit(1);
+    }
+
   for(;;)
     {
-	addrlen = sizeof(remAddr);
-	connection = accept(mySock, (struct sockaddr *)&remAddr, &addrlen);
-	if(connection < 0)
-	  {
-	  printf("NetServer - Can't accept new connection: %s", strerror(errno));
-	  exit(1);
-	  }
-	/* else
-	  {
-	  printf ("ACCEPTED:%lX\n", ntohl (farAddr.sin_addr.s_addr));
-	  }
-	 */
-	  
-    /* fork a child process to handle connection */
-	child_pid = fork();
-	if(child_pid == 0)
-	  {
-	  /* this is the child process.
-	   * the listeing socket is not needed by this process - close it
-	   */
-	  close(mySock);
-	
-      /* Handle requests coming throught the connection - the child has a copy of the
-         connected socket descriptor */
-	  cmdTSK(connection);
-	  
-	  /* if we are here - all it is done: close the connection socket and end the child process */
-	  close(connection);
-	  exit(0);
-	  }
-	else
-	  {
-	  if(child_pid > 0)
-	    {
-		/* this is the parent process. The child process handles the connection
-		 * so we can close this copy of the
-		 * socket descriptor. The parent then continues with the loop over connections and
-		 * accepts a new connection ..
-		 */
-	    close(connection);
-		}
-	  else
-		{
-		/* failed to fork child process */
-		printf("NetServer - Failed to fork child process to handle new connection: %s", strerror(errno));
-		exit(0);
-		}
-	  }
-	}
+    nev = epoll_wait(net_epfd, events, nEVENTS, -1);
+    if(nev < 0)
+      {
+      if(errno == EINTR) continue;
+      printf("NetServer - epoll_wait failed: %s\n", strerror(errno));
+      exit(1);
+      }
+
+    for(iev = 0; iev < nev; iev++)
+      {
+      pc = events[iev].data.ptr;
+      if(pc == &net_listen)
+        {
+        connAccept(mySock, 0);
+        }
+      else if(pc == &net_blisten)
+        {
+        connAccept(binSock, 1);
+        }
+      else if(pc == &net_wake)
+        {
+        /* take all completed transactions - oldest first */
+        read(net_wakefd, &count, sizeof(count));
+        pthread_mutex_lock(&net_mutex);
+        pdone = net_done;
+        net_done = NULL;
+        pthread_mutex_unlock(&net_mutex);
+        ptx = NULL;
+        while(pdone != NULL)
+          {
+          struct BusTxn *pnext = pdone->next;
+          pdone->next = ptx;
+          ptx = pdone;
+          pdone = pnext;
+          }
+        while(ptx != NULL)
+          {
+          /* released one by one - a later one of the list is not freed before its turn */
+          pdone = ptx->next;
+          pc = ptx->owner;
+          ptx->rel = 1;
+          cmdRSP(pc);
+          ptx = pdone;
+          }
+        }
+      else
+        {
+        if(pc->fd < 0) continue; /* closed by an earlier event */
+        if(events[iev].events & EPOLLOUT)
+          {
+          if(connFlush(pc) < 0) continue;
+          }
+        if(events[iev].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) connRead(pc);
+        }
+      }
+
+    /* changes for the subscribers */
+    subPUSH();
+
+    /* kill -USR1: statistics to the log */
+    if(stat_dump)
+      {
+      unsigned char dump[L4096];
+
+      stat_dump = 0;
+      statTEXT("", dump);
+      fwrite(dump, 1, strlen(dump), log_fp);
+      fflush(log_fp);
+      }
+
+    /* free connections closed during this batch */
+    while(net_dead != NULL)
+      {
+      pc = net_dead;
+      net_dead = pc->next;
+      if(pc->nsub > 0) subDROP(pc, -1, 0, NULL);
+      if(pc->out != NULL) free(pc->out);
+      free(pc);
+      }
+    }
   }
 
 
@@ -587,15 +5657,77 @@ static void NetServer(unsigned short port)
  *
  * =======================================================================================
  */
-int main(void)
+int main(int argc, char *argv[])
   {
-  char LU_type[nLUTYP][L16] = {"1461PS0", "1461NS0", "1469PS0", "1469PS1",
-  "1469NS0", "1469NS1", "1471PS0", "1471NS0"};
-   
-  unsigned char ga, tbuff[L256], rbuff[L256], s1[L256], s2[L256], s3[L256], sdum[L256], *ps1;
-  int imod, slot, nsm, sm, i1, i2, i3, i4;
+  struct LUnit *found[nSUBMOD];
+  int bad[nSUBMOD];
+  char *ps1;
+  int slot, i1, i2;
   
-  int fd;
+  int opt, nbench = 0, nbattn = 0;
+
+  /* command line options */
+  while((opt = getopt(argc, argv, "wb:a:B:r:t:s:D:m:v:L:d:g:VC:k:")) != -1)
+    {
+    switch(opt)
+      {
+      case 'w': sio_fixed = 1; break; /* old fixed-wait serial reader */
+      case 'b': nbench = atoi(optarg); break; /* bus latency benchmark */
+      case 'B': nbattn = atoi(optarg); break; /* ATTN wait benchmark */
+      case 'r': poll_ms = atoi(optarg); break; /* refresher sweep period */
+      case 't': topo_file = optarg; break; /* saved logic unit table */
+      case 's': topo_rescan = atoi(optarg); break; /* rescan period of empty slots */
+      case 'm': shm_file = optarg; break; /* shared-memory crate state */
+      case 'v': log_level = atoi(optarg); break; /* log level */
+      case 'L': log_fname = optarg; break; /* log file */
+      case 'd': sio_dev = optarg; break; /* serial device */
+      case 'g': attn_file = optarg; attn_mode = ATTN_MMAP; break; /* GPIO register file */
+      case 'V': clk_virtual = 1; break; /* virtual clock */
+      case 'C': cap_fname = optarg; break; /* traffic capture */
+      case 'k': /* circuit breaker */
+        brk_nfail = atoi(optarg);
+        if((ps1 = strchr(optarg, ',')) != NULL) brk_probe = atoi(ps1 + 1);
+        if(brk_probe < 1) brk_probe = 1;
+        break;
+      case 'D': /* class deadlines */
+        ps1 = optarg;
+        for(i1 = 0; (i1 < nCLASS) && (ps1 != NULL); i1++)
+          {
+          bus_deadline[i1] = atoi(ps1);
+          ps1 = strchr(ps1, ',');
+          if(ps1 != NULL) ps1++;
+          }
+        break;
+      case 'a': /* ATTN backend */
+        if(strcmp(optarg, "mmap") == 0) attn_mode = ATTN_MMAP;
+        else if(strcmp(optarg, "cdev") == 0) attn_mode = ATTN_CDEV;
+        else if(strcmp(optarg, "fake") == 0) attn_mode = ATTN_FAKE;
+        else
+          {
+          printf("unknown ATTN backend %s (mmap, cdev or fake)\n", optarg);
+          exit(1);
+          }
+        break;
+      default:
+        printf("usage: %s [-w] [-b N] [-a mmap|cdev|fake] [-B N] [-r MS] [-t FILE] [-s SEC] [-D MS,MS,..] [-m FILE] [-v LEVEL] [-L FILE] [-d DEV] [-g FILE] [-V] [-C FILE] [-k N[,MS]]\n", argv[0]);
+        exit(1);
+      }
+    }
+  if(clk_virtual && ((attn_file == NULL) || (attn_mode != ATTN_MMAP)))
+    {
+    printf("the virtual clock (-V) needs the simulator's GPIO file (-g)\n");
+    exit(1);
+    }
+  for(i1 = 0; i1 < nCLKW; i1++) pthread_cond_init(&clk_wait[i1].cond, NULL);
+
+  logSTART();
+  if(cap_fname != NULL) capSTART();
+
+  if(nbattn > 0)
+    {
+    benchATTN(nbattn);
+    exit(0);
+    }
 
   /*initialize */
   for(i1 = 0; i1 < nLU; i1++) pLU[i1] = NULL;
@@ -612,10 +5744,10 @@ int main(void)
    *    O_NONBLOCK: do not block waiting for a response
    * MAPPING REQUIRES ROOT PRIVILIGES OR CHANGING ACCESS PREVILIGES OF /dev/ttyUSB0 
    */
-  sio = open ("/dev/ttyAMA0", O_RDWR | O_NOCTTY | O_NDELAY);
+  sio = open (sio_dev, O_RDWR | O_NOCTTY | O_NDELAY);
   if(sio < 0)
     {
-    printf("Unable to open /dev/ttyAMA0 ....\n");
+    printf("Unable to open %s ....\n", sio_dev);
     exit(-1);
     }
   bzero(&sio_attr, sizeof(sio_attr));
@@ -632,221 +5764,52 @@ int main(void)
   tcflush (sio,TCIFLUSH);
   tcsetattr (sio, TCSANOW, &sio_attr);
 	  
-  /* ATTN* signal from HV module is routed to GPIO23
-   * Setup system to access GPIO registers
-   * Access GPIO23 as input, no interrupt, pull/down disabled (all are defaults)
-   * MAPPING REQUIRES ROOT PRIVILIGES OR CHANGING ACCESS PREVILIGES OF /dev/mem 
-   */   
-   fd = open("/dev/mem", O_RDWR | O_SYNC); /* needs to run as root!! */
-   if(fd < 0)
-     {
-     printf("Unable to open /dev/mem ....\n");
-     exit(-1);
-     }
-
-   gpioReg = mmap
-      (
-      0,
-      0xB4,     /* length of GPIO registers */
-      PROT_READ|PROT_WRITE|PROT_EXEC,
-      MAP_SHARED|MAP_LOCKED,
-      fd,
-      0x20200000); /* beginning of GPIO registers in memory */
-
-   close(fd);
+  /* ATTN* signal from HV module is routed to GPIO23 */
+  attn_open();
 
-  
-  /* Send handshake message to every slot to determine which ones have a module.
-   * This will also clear any module holding the ATTN* line (it has a pending response
-   * in its output buffer)
+  /* Warm start: take the logic unit table saved by the last run and serve right away,
+   * the slots are revalidated in the background once the bus thread runs
    */
-  for(slot = 0; slot < nSLOTS; slot++)
-    {
-	ga = 255 - slot;  /* geographical address of slot */
-	sio_TXbuff[0] = ga;
-	sio_TXbuff[1] = 0x06;  /* ACK */
-	sio_TXbuff[2] = '\n';
-	sio_TXbuff[3] = '\0';
-	write(sio,sio_TXbuff,strlen(sio_TXbuff));	
-	if(msgget(50) > MSGstat_NONE) SLOTwMOD[nMOD++] = slot; /* 50 char wait */
-	}	  	
-  if(nMOD <= 0)
+  if((nbench == 0) && (topoLOAD(topo_file) == NORMAL))
     {
-
-    printf("i2lchv - no modules found.... exiting\n");
-    exit(0);
-
+    printf("found %d logic units in %s - revalidating in the background\n", lstLU + 1, topo_file);
+    topo_warm = 1;
     }
-
-if(1) {	  
-	printf("found %d modules\n",nMOD);
-  /* get module ID */
-  for(imod = 0; imod < nMOD; imod++)
+  else
     {
-    /* retrieve slot# of module */
-    slot = SLOTwMOD[imod];
-    /* get number of submodules in this module */
-    ga = 255 - slot;
-	sio_TXbuff[0] = ga;
-	sio_TXbuff[1] = 0x06;
-	sio_TXbuff[2] = '\0';
-    /* Note: we choose to use the slot# as the transation ticket# */
-    sprintf(s1,"%d SM\n",slot);
-    strcat(sio_TXbuff,s1);
-    sio_TXlen = strlen(sio_TXbuff);
-	write(sio,sio_TXbuff,sio_TXlen); /* send message */
-	if(msgget(sio_TXlen+50) != MSGstat_HNDSHK) goto skip_slot; /* get handshake */
-    
-    /* wait up-to 2 sec for module to indicate is ready to send response to previous command */
-    if(IsGpioSet(23,2.0) != NORMAL) goto skip_slot;
-      
-    /* Module has response ready - send handshake sequence to start xfer
-     * The slot geographical address & 0x06 (ACK) are
-     * already in the buffer - we just add the LF and a NULL
-     */
-    sio_TXbuff[2] = '\n';
-    sio_TXbuff[3] = '\0';
-    sio_TXlen = strlen(sio_TXbuff);
-    write(sio,sio_TXbuff,strlen(sio_TXbuff)); /* send handshake */            
-    if(msgget(50) != MSGstat_OK) goto skip_slot; /* 50 char wait (13ms) */
-
-    /* decode message */
-    sio_MSGbuff[sio_MSGlen] = '\0';        
-    sio_MSGbuff[0] = ' '; /* convert ACK char into SPACE for decoding */
-    
-    /* message terminates with CRLF */
-    ps1 = strchr(sio_MSGbuff,'\r');   /* search for CR */
-    *ps1 = '\0';       /* replace CR by NULL to terminate string */
-    sscanf(sio_MSGbuff,"%d %s %d",&i1,s1,&nsm);
-      
-    /* Check that the ticket-number field matches the slot# (we sent this value)
-     * & the command is "SM"
+    /* Probe every slot: handshake to determine which ones have a module (this also
+     * clears any module holding the ATTN* line), then SM & ID of each submodule
      */
-    if((i1 != slot) || (strcmp(s1,"SM") != 0)) goto skip_slot; /* error */
-    
-    /* get module ID & submodule information (e.g number of channels & properties) */
-    for(i3 = 0;  i3 < nsm;  i3++)
+    for(slot = 0; slot < nSLOTS; slot++)
       {
-      sio_TXbuff[2] = '\0';
-      if(nsm <= 1)
-        {
-        /* one sub-module, commands do not include sub-module address
-         * Use the slot# as the transation ticket#
-         */
-        sprintf(s1,"%d ID\n",slot);
-        }
-      else
-        {
-        /* sub-module i3 of [ 0 -> (nsm-1)]
-         * Use the slot# as the transation ticket#
-         */
-        sprintf(s1,"%d %d ID\n",slot,i3);
-        }
-      strcat(sio_TXbuff,s1);
-      sio_TXlen = strlen(sio_TXbuff);
-      write(sio,sio_TXbuff,sio_TXlen); /* send command */
-	  if(msgget(sio_TXlen+50) != MSGstat_HNDSHK) goto skip_submodule; /* get handshake */
-              
-      /* wait up-to 2 sec for module to indicate is ready to send response to previous command */
-      if(IsGpioSet(23,2.0) != NORMAL) goto skip_submodule;
-      
-      /* module ready - send handshake sequence to start xfer
-       * The slot geographical address & 0x06 (ACK) are
-       * already in the buffer - we just add the LF and a NULL
-       */
-      sio_TXbuff[2] = '\n';
-      sio_TXbuff[3] = '\0';
-      sio_TXlen = strlen(sio_TXbuff);
-      write(sio,sio_TXbuff,sio_TXlen);           
-      if(msgget(50) != MSGstat_OK) goto skip_submodule; /* 50 char wait (13ms) */
-
-      /* decode response  - response should start with "YXX ID " where Y = 0x06 &
-       * XX = transation ticket# = slot# (one or 2 characters)      
-       * Skip over the number of bytes taken by preamble (ACK, slot# & command) */
-      i1 = 1;
-      if(slot > 9) i1 = 2;
-      i1 = i1+5; /* 5 bytes = ACK + " ID " */
-      strcpy(s1,&sio_MSGbuff[i1]);
-      
-      ps1 = strchr(s1,'\r');  /* end-of-message sequence is CRLF. Search for CR */
-      *ps1 = '\0';  /* replace CR by NULL to terminate string */
-      sscanf(s1,"%s",s2);  /* s2 should be the module type */
-      sprintf(s3,"S%d",i3);  /*submodule number */
-      strcat(s2,s3);    /* logic unit type  */
-                  
-      /* search for logic unit type */
-      i2 = -1;
-      for(i1 = 0; i1 < nLUTYP; i1++)
-        {
-        i4 = strcmp(&LU_type[i1][0],s2);
-        if(i4 == 0) i2 = i1;
-        }
-                   
-      /* skip if no matching logic unit found */
-      if(i2 < 0)
-        {
-        printf("main - unknown logic unit type %s @ slot = %d\n",s2,slot);
-        goto skip_submodule;
-        }
-      
-      /* found logic unit type */ 
-      /* create structure to store this logic unit info */
-      pLUtmp = NULL;
-      pLUtmp = (struct LUnit *)malloc(sizeof(struct LUnit));
-      
-      if(pLUtmp == NULL) /* failed to allocate structure */
-        {
-        printf("main - malloc failed!, slot = %d, smod = %d, LUTYP = %s\n\n",slot,i3,s2);
-        goto skip_submodule;
-        }
-      lstLU = lstLU +1;
-      pLU[lstLU] = pLUtmp;
-                      
-      /* store - basic header for commands */
-      pLUtmp->hdr[0] = ga;
-      pLUtmp->hdr[1] = 0x06;
-      pLUtmp->hdr[2] = '\0';
-      if(nsm <= 1)
-        {
-        /* One sub-module, commands do not include sub-module address
-         * The slot# is used as the transaction#
-         */
-        sprintf(s3,"%d ",slot);
-        }
-      else
-        {
-        /*sub-module i3 of [ 0 -> (nsm-1)]
-         * The slot# is used as the transaction#
-         */
-        sprintf(s3,"%d %d ",slot,i3);
-        }
-      strcat(pLUtmp->hdr,s3);
-                      
-      /* store - ack message */
-      pLUtmp->ack[0] = ga;
-      pLUtmp->ack[1] = 0x06;
-      pLUtmp->ack[2] = '\n';
-      pLUtmp->ack[3] = '\0';
-                      
-      /* store - */
-      pLUtmp->lutype = i2; /* logic unit type index */
-      pLUtmp->slot = slot; /* slot number */
-      pLUtmp->nsmod = nsm;   /* number of submodules */
-      pLUtmp->smod = i3; /* submodule number */
-      strcpy(pLUtmp->id,s1); /* module/submodule id */
-                      
-      /* Map Slot/submodule to LU */
-      SS2LU[slot][i3] = lstLU;
-        
-      skip_submodule: continue;
-      } /* bottom of loop over submodules */
-    
-    skip_slot: continue;
-    } /* bottom over slots */
- } /* if(1)*/
+      if(slotPROBE(slot, found, bad) > 0) topoSET(slot, found);
+      }
+    if(nMOD <= 0)
+      {
+
+      printf("i2lchv - no modules found.... exiting\n");
+      exit(0);
+
+      }
+    printf("found %d modules\n",nMOD);
+
+    /* module metadata - ID, PROP & ATTR are then answered without bus traffic */
+    for(i1 = 0; i1 <= lstLU; i1++) metaFETCH(pLU[i1]);
+    topoSAVE(topo_file);
+    }
    
+  if(nbench > 0)
+    {
+    benchBUS(nbench);
+    exit(0);
+    }
+
+  /* crate state for local readers */
+  if((strcmp(shm_file, "-") != 0) && (shmOPEN(shm_file) == NORMAL)) shmTOPO();
+
   /* Telnet server */
   printf("Network server started\n");	
+  fflush(stdout);
   NetServer(BASE_PORT);
   };
 
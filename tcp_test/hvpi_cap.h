@@ -0,0 +1,103 @@
+/*
+ * hvpi_cap.h
+ *
+ * Traffic capture file written by the rPI HV bridge server (20140803_i2lchv_rPI-linux -C FILE)
+ * and read by i2lchv_replay, with a header-only reader.
+ *
+ * The file is append-only: a file header once, then records. Every server start appends a
+ * HVPI_CAP_START record, so one file may hold several runs. All fields are little-endian
+ * (the rPI and a PC), the record header is packed.
+ *
+ *   file header : u32 magic, u16 version, u16 0
+ *   record      : u16 length (whole record), u8 type, i8 slot (-1 = none), u32 connection,
+ *                 i32 status, i64 time (server usnow(), us), then length - 20 bytes of data
+ *
+ *   type       slot       connection  status                   data
+ *   START      -1         0           1 = virtual clock (-V)   i64 wall clock us at time 0
+ *   REQ        -1         id          length of the line       text command line (no CR/LF)
+ *   BREQ       -1         id          0                        binary request frame
+ *   RSP        -1         id          NORMAL or error code     -
+ *   TX         module     0           0                        bytes written to the UART
+ *   RX         module     0           msgget() status          bytes read by one msgget()
+ *   ATTN       module     0           1 = up, 0 = timeout      -  (end of an ATTN* wait)
+ *   DROP       -1         0           records lost             -  (ring full; the gap is
+ *                                                                   right before this record)
+ *
+ * A connection id is given to each accepted connection; the responses of a connection
+ * come in request order, so the n-th RSP answers the n-th REQ/BREQ. Data longer than
+ * HVPI_CAP_DATA bytes is cut (REQ keeps the full length in status).
+ *
+ * Example,
+ *   FILE *fp = fopen(name, "rb");
+ *   struct hvpi_cap_rec rec;
+ *   if(hvpi_cap_open(fp) == 0) while(hvpi_cap_next(fp, &rec) == 0) ...
+ *
+ * 17-Oct-2026
+ */
+#ifndef HVPI_CAP_H
+#define HVPI_CAP_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#define  HVPI_CAP_MAGIC    0x43505648 /* "HVPC" */
+#define  HVPI_CAP_VERSION  1
+#define  HVPI_CAP_DATA     256        /* data bytes kept with a record */
+
+#define  HVPI_CAP_START    0
+#define  HVPI_CAP_REQ      1
+#define  HVPI_CAP_BREQ     2
+#define  HVPI_CAP_RSP      3
+#define  HVPI_CAP_TX       4
+#define  HVPI_CAP_RX       5
+#define  HVPI_CAP_ATTN     6
+#define  HVPI_CAP_DROP     7
+
+struct hvpi_cap_filehdr
+  {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t pad;
+  } __attribute__((packed));
+
+struct hvpi_cap_hdr
+  {
+  uint16_t len;                               /* whole record */
+  uint8_t  type;
+  int8_t   slot;
+  uint32_t conn;
+  int32_t  status;
+  int64_t  t;
+  } __attribute__((packed));
+
+/* A record as read back (data NUL terminated) */
+struct hvpi_cap_rec
+  {
+  struct hvpi_cap_hdr h;
+  int      ndata;
+  uint8_t  data[HVPI_CAP_DATA + 1];
+  };
+
+
+/* Check the file header. Returns -1 if it is not a capture of this version */
+static inline int hvpi_cap_open(FILE *fp)
+  {
+  struct hvpi_cap_filehdr fh;
+
+  if(fread(&fh, sizeof(fh), 1, fp) != 1) return -1;
+  return ((fh.magic == HVPI_CAP_MAGIC) && (fh.version == HVPI_CAP_VERSION)) ? 0 : -1;
+  }
+
+
+/* Next record. Returns -1 at the end of the file (or a record cut short by a crash) */
+static inline int hvpi_cap_next(FILE *fp, struct hvpi_cap_rec *rec)
+  {
+  if(fread(&rec->h, sizeof(rec->h), 1, fp) != 1) return -1;
+  if((rec->h.len < sizeof(rec->h)) || (rec->h.len > sizeof(rec->h) + HVPI_CAP_DATA)) return -1;
+  rec->ndata = rec->h.len - sizeof(rec->h);
+  if((rec->ndata > 0) && (fread(rec->data, rec->ndata, 1, fp) != 1)) return -1;
+  rec->data[rec->ndata] = '\0';
+  return 0;
+  }
+
+#endif
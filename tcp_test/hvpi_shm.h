@@ -0,0 +1,178 @@
+/*
+ * hvpi_shm.h
+ *
+ * Crate state published by the rPI HV bridge server (20140803_i2lchv_rPI-linux) in a
+ * shared-memory file, and a header-only reader for local consumers (shim, logger, exporter).
+ *
+ * The server is the only writer. Every logic unit record has its own sequence counter
+ * (seqlock): it is odd while the server updates the record, readers copy what they need
+ * and retry if the counter was odd or moved. Readers never block the server.
+ *
+ * Logic unit index = SLOT# * HVPI_NSUBMOD + SUBMODULE# (as in the binary protocol).
+ * Times are CLOCK_MONOTONIC microseconds (hvpi_shm_now()), 0 = not valid.
+ *
+ * Example,
+ *   const struct hvpi_shm *shm = hvpi_shm_open(HVPI_SHM_FILE);
+ *   float v; int64_t t;
+ *   if(hvpi_val_read(shm, 3 * HVPI_NSUBMOD + 0, hvpi_prop_index(shm, 6, "MV"), 0, &v, &t) == 0) ...
+ *
+ * 17-Oct-2026
+ */
+#ifndef HVPI_SHM_H
+#define HVPI_SHM_H
+
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define  HVPI_SHM_FILE     "/dev/shm/hvpi_crate"
+#define  HVPI_SHM_MAGIC    0x53505648 /* "HVPS" */
+#define  HVPI_SHM_VERSION  1
+
+#define  HVPI_NSLOTS      16
+#define  HVPI_NSUBMOD      2
+#define  HVPI_NLU         (HVPI_NSLOTS * HVPI_NSUBMOD)
+#define  HVPI_NPROP       16
+#define  HVPI_NCHAN       24
+#define  HVPI_L16         16
+#define  HVPI_LID        128
+
+/* One logic unit */
+struct hvpi_lu
+  {
+  uint32_t seq;                               /* odd while the server writes the record */
+  int32_t  present;                           /* a logic unit is at this address */
+  int32_t  slot, smod, nsmod;
+  char     type[HVPI_L16];                    /* 1461NS0, 1469PS1, ... */
+  char     id[HVPI_LID];                      /* ID response */
+  int32_t  nprop;                             /* properties, in PROP order (0 = not known yet) */
+  char     pname[HVPI_NPROP][HVPI_L16];
+  int32_t  nval[HVPI_NPROP];                  /* channels read of each property */
+  float    val[HVPI_NPROP][HVPI_NCHAN];       /* channel values (ST: the status word) */
+  int64_t  tread[HVPI_NPROP][HVPI_NCHAN];     /* when each value was read from the module */
+  int32_t  npsum;
+  uint16_t psum[HVPI_NPROP];                  /* PSUM change counters, PROP order */
+  int64_t  tpsum;                             /* when PSUM was read */
+  int64_t  tupdate;                           /* last change of the record */
+  };
+
+/* The segment */
+struct hvpi_shm
+  {
+  uint32_t magic, version;
+  uint32_t size;                              /* sizeof(struct hvpi_shm) */
+  uint32_t nlu;                               /* HVPI_NLU */
+  int32_t  pid;                               /* server process */
+  uint32_t ntopo;                             /* logic unit table changes */
+  int64_t  tstart;                            /* server start */
+  struct hvpi_lu lu[HVPI_NLU];
+  };
+
+
+/* Monotonic time in microseconds - the clock of tread, tpsum, tupdate */
+static inline int64_t hvpi_shm_now(void)
+  {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+  }
+
+
+/* Map the segment read-only. Returns NULL if it is missing or of another layout */
+static inline const struct hvpi_shm *hvpi_shm_open(const char *fname)
+  {
+  const struct hvpi_shm *shm;
+  struct stat st;
+  int fd;
+
+  fd = open(fname, O_RDONLY);
+  if(fd < 0) return NULL;
+  if((fstat(fd, &st) != 0) || (st.st_size < (off_t)sizeof(struct hvpi_shm)))
+    {
+    close(fd);
+    return NULL;
+    }
+  shm = (const struct hvpi_shm *)mmap(NULL, sizeof(struct hvpi_shm), PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if(shm == MAP_FAILED) return NULL;
+  if((shm->magic != HVPI_SHM_MAGIC) || (shm->version != HVPI_SHM_VERSION) ||
+     (shm->size != sizeof(struct hvpi_shm)))
+    {
+    munmap((void *)shm, sizeof(struct hvpi_shm));
+    return NULL;
+    }
+  return shm;
+  }
+
+
+static inline void hvpi_shm_close(const struct hvpi_shm *shm)
+  {
+  if(shm != NULL) munmap((void *)shm, sizeof(struct hvpi_shm));
+  }
+
+
+/* Consistent copy of logic unit ilu. Returns -1 if there is none at that address */
+static inline int hvpi_lu_read(const struct hvpi_shm *shm, int ilu, struct hvpi_lu *out)
+  {
+  const struct hvpi_lu *p;
+  uint32_t s0;
+
+  if((ilu < 0) || (ilu >= HVPI_NLU)) return -1;
+  p = &shm->lu[ilu];
+  for(;;)
+    {
+    s0 = __atomic_load_n(&p->seq, __ATOMIC_ACQUIRE);
+    if(s0 & 1) continue;
+    memcpy(out, (const void *)p, sizeof(*out));
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if(__atomic_load_n(&p->seq, __ATOMIC_RELAXED) == s0) break;
+    }
+  return out->present ? 0 : -1;
+  }
+
+
+/* One channel value and when it was read. Returns -1 if not known */
+static inline int hvpi_val_read(const struct hvpi_shm *shm, int ilu, int iprop, int ich,
+  float *val, int64_t *tread)
+  {
+  const struct hvpi_lu *p;
+  uint32_t s0;
+  int ok;
+
+  if((ilu < 0) || (ilu >= HVPI_NLU) || (iprop < 0) || (iprop >= HVPI_NPROP) ||
+     (ich < 0) || (ich >= HVPI_NCHAN)) return -1;
+  p = &shm->lu[ilu];
+  for(;;)
+    {
+    s0 = __atomic_load_n(&p->seq, __ATOMIC_ACQUIRE);
+    if(s0 & 1) continue;
+    ok = p->present && (iprop < p->nprop) && (ich < p->nval[iprop]);
+    *val = p->val[iprop][ich];
+    *tread = p->tread[iprop][ich];
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if(__atomic_load_n(&p->seq, __ATOMIC_RELAXED) == s0) break;
+    }
+  return (ok && (*tread != 0)) ? 0 : -1;
+  }
+
+
+/* Index of property name of logic unit ilu (PROP order), -1 if unknown */
+static inline int hvpi_prop_index(const struct hvpi_shm *shm, int ilu, const char *name)
+  {
+  struct hvpi_lu lu;
+  int ip;
+
+  if(hvpi_lu_read(shm, ilu, &lu) < 0) return -1;
+  for(ip = 0; (ip < lu.nprop) && (ip < HVPI_NPROP); ip++)
+    {
+    if(strncmp(lu.pname[ip], name, HVPI_L16) == 0) return ip;
+    }
+  return -1;
+  }
+
+#endif
@@ -0,0 +1,658 @@
+/*
+ * i2lchv_bench
+ *
+ * Benchmark client for the rPI HV bridge server (20140803_i2lchv_rPI-linux).
+ *
+ * Connection test:
+ *  (A) opens and closes C connections as fast as possible -> connections per second
+ *  (B) opens N connections, sends _BUS on each and waits for every prompt, then reads
+ *      the resident memory of the server from /proc -> memory per connection
+ *
+ * Load test (-m): N connections send a mix of commands for -T seconds, at a total target rate
+ * (-R, spread evenly over the connections) or each as fast as the server answers (-R 0).
+ * Logic units are taken from _LL and picked at random for each request. The latency of a
+ * request runs from the time it was due, so a server that falls behind the rate is charged
+ * for the wait too. Throughput, errors ("?" responses) and p50/p99/p99.9/max latency are
+ * reported per command type and for all of them, as text, CSV or JSON lines (-o), with a
+ * label (-l) to tell builds apart in a regression log. Run it against the emulator or the
+ * simulator: LD writes to the modules.
+ *   MIX is TYPE=WEIGHT[,TYPE=WEIGHT...] of
+ *     _LL                      _LL
+ *     RC                       SLOT# SUBMODULE# RC MV
+ *     PSUM                     SLOT# SUBMODULE# PSUM
+ *     DMP                      SLOT# SUBMODULE# DMP CH      (random channel)
+ *     LD                       SLOT# SUBMODULE# LD PROP CH VALUE (-W, default DV 0)
+ *     HVSTATUS                 SLOT# SUBMODULE# HVSTATUS
+ *   e.g. i2lchv_bench -m RC=10,PSUM=5,DMP=1,_LL=1 -n 20 -R 200 -T 30 -o json -l test-build
+ *
+ * Options,
+ *  -H host   server address (default 127.0.0.1)
+ *  -p port   server port (default 24742)
+ *  -c C      connect/close cycles (default 1000)
+ *  -n N      connections held open at the same time (default 200)
+ *  -P pid    server process id, to read its VmRSS (local server only)
+ *  -m MIX    run the load test with this command mix instead of the connection test
+ *  -R RATE   load test: total requests/s (default 0 = closed loop)
+ *  -T SEC    load test: duration (default 10)
+ *  -A MS     load test: send RC, DMP and PSUM as cache reads (@MS prefix)
+ *  -W PROP,VALUE  load test: what LD writes to the random channel (default DV,0)
+ *  -o FMT    load test report: text (default), csv or json (one JSON object per line)
+ *  -l LABEL  load test: label of the run in the report (e.g. the build)
+ *  -S SEED   load test: seed of the command and logic unit choice (default 1)
+ *
+ * COMPILE: gcc i2lchv_bench.c -o i2lchv_bench
+ *
+ * 17-Oct-2026
+ */
+
+#define  BASE_PORT   24742
+#define  L16         16
+#define  L256        256
+#define  L4096       4096
+#define  nTYPE       6   /* load test command types */
+#define  nLU         32  /* logic units */
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/resource.h>
+#include <poll.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+unsigned char *prompt = "hvpi>";
+struct sockaddr_in srvAddr;
+
+/* Load test */
+struct LoadLU                  /* a logic unit from _LL */
+  {
+  int slot, sm, nchan;
+  };
+
+struct LoadType                /* one command type of the mix */
+  {
+  char *name;
+  int weight;
+  long n, nerr, nlost;         /* responses, "?" responses, no response */
+  int *lat, nlat, maxlat;      /* latencies [us] */
+  };
+
+struct LoadConn
+  {
+  int fd, busy, type;
+  long long tdue, tnext;       /* when the request in flight was due, when the next one is */
+  int len;
+  unsigned char buff[L4096];   /* response so far */
+  };
+
+struct LoadLU ld_lu[nLU];
+int ld_nlu = 0;
+struct LoadType ld_type[nTYPE] = {{.name = "_LL"}, {.name = "RC"}, {.name = "PSUM"}, {.name = "DMP"},
+  {.name = "LD"}, {.name = "HVSTATUS"}};
+int ld_wsum = 0;
+unsigned ld_seed = 1;
+int ld_maxage = 0;             /* -A */
+char ld_wprop[L16] = "DV", ld_wval[L16] = "0"; /* -W */
+
+
+/* ======================================================================================
+ *
+ * Monotonic time in microseconds
+ *
+ * ======================================================================================
+ */
+long long usnow(void)
+  {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long)ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+  }
+
+
+/* ======================================================================================
+ *
+ * Resident memory of process pid in kB (-1 if not available)
+ *
+ * ======================================================================================
+ */
+long rsskb(int pid)
+  {
+  char fname[L256], line[L256];
+  FILE *fp;
+  long kb = -1;
+
+  if(pid <= 0) return -1;
+  sprintf(fname, "/proc/%d/status", pid);
+  fp = fopen(fname, "r");
+  if(fp == NULL) return -1;
+  while(fgets(line, L256, fp) != NULL)
+    {
+    if(strncmp(line, "VmRSS:", 6) == 0) sscanf(&line[6], "%ld", &kb);
+    }
+  fclose(fp);
+  return kb;
+  }
+
+
+/* ======================================================================================
+ *
+ * Open a connection to the server (-1 on failure)
+ *
+ * ======================================================================================
+ */
+int srvConnect(void)
+  {
+  int fd, yes = 1;
+
+  fd = socket(AF_INET, SOCK_STREAM, 0);
+  if(fd < 0) return -1;
+  if(connect(fd, (struct sockaddr *)&srvAddr, sizeof(srvAddr)) != 0)
+    {
+    close(fd);
+    return -1;
+    }
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+  return fd;
+  }
+
+
+/* ======================================================================================
+ *
+ * Read until the prompt arrives. Return codes,
+ *  -1 = connection closed or error
+ *   0 = prompt received
+ *
+ * ======================================================================================
+ */
+int srvPrompt(int fd)
+  {
+  unsigned char buff[L4096];
+  int len = 0, n, lp = strlen(prompt);
+
+  for(;;)
+    {
+    n = read(fd, &buff[len], L4096 - 1 - len);
+    if(n <= 0) return -1;
+    len = len + n;
+    buff[len] = '\0';
+    if((len >= lp) && (strcmp(&buff[len - lp], prompt) == 0)) return 0;
+    if(len >= L4096 - 1 - lp)
+      {
+      /* keep the tail only */
+      memmove(buff, &buff[len - lp], lp);
+      len = lp;
+      }
+    }
+  }
+
+
+/* ======================================================================================
+ *
+ * Random number for the load test (xorshift, repeatable with -S)
+ *
+ * ======================================================================================
+ */
+unsigned ldRAND(void)
+  {
+  ld_seed ^= ld_seed << 13;
+  ld_seed ^= ld_seed >> 17;
+  ld_seed ^= ld_seed << 5;
+  return ld_seed;
+  }
+
+
+/* ======================================================================================
+ *
+ * Parse the command mix TYPE=WEIGHT[,TYPE=WEIGHT...]. Returns the sum of the weights,
+ * -1 if the mix is bad
+ *
+ * ======================================================================================
+ */
+int ldMIX(char *spec)
+  {
+  char buff[L256], *item, *save, *pw;
+  int it;
+
+  strncpy(buff, spec, L256 - 1);
+  buff[L256 - 1] = '\0';
+  ld_wsum = 0;
+  for(item = strtok_r(buff, ",", &save); item != NULL; item = strtok_r(NULL, ",", &save))
+    {
+    pw = strchr(item, '=');
+    if(pw != NULL) *pw++ = '\0';
+    for(it = 0; (it < nTYPE) && (strcasecmp(item, ld_type[it].name) != 0); it++);
+    if((it == nTYPE) || ((pw != NULL) && (atoi(pw) < 0)))
+      {
+      printf("bad command mix item %s\n", item);
+      return -1;
+      }
+    ld_type[it].weight = (pw != NULL) ? atoi(pw) : 1;
+    ld_wsum = ld_wsum + ld_type[it].weight;
+    }
+  return (ld_wsum > 0) ? ld_wsum : -1;
+  }
+
+
+/* ======================================================================================
+ *
+ * Read the logic units from _LL. Returns their number (-1 if the server is not there)
+ *
+ * ======================================================================================
+ */
+int ldUNITS(void)
+  {
+  unsigned char buff[L4096];
+  char *line, *save, type[L16];
+  int fd, len = 0, n, lp = strlen(prompt);
+
+  fd = srvConnect();
+  if(fd < 0) return -1;
+  write(fd, "_LL\r\n", 5);
+  for(;;)
+    {
+    n = read(fd, &buff[len], L4096 - 1 - len);
+    if(n <= 0) break;
+    len = len + n;
+    buff[len] = '\0';
+    if(((len >= lp) && (strcmp(&buff[len - lp], prompt) == 0)) || (len >= L4096 - 1)) break;
+    }
+  close(fd);
+  buff[len] = '\0';
+
+  /* SLOT# TYPE SUBMODULE# ... CHANNELS ... */
+  ld_nlu = 0;
+  for(line = strtok_r(buff, "\r\n", &save); (line != NULL) && (ld_nlu < nLU); line = strtok_r(NULL, "\r\n", &save))
+    {
+    if(sscanf(line, "%d %15s %d %*d %*d %d", &ld_lu[ld_nlu].slot, type, &ld_lu[ld_nlu].sm, &ld_lu[ld_nlu].nchan) != 4) continue;
+    if(ld_lu[ld_nlu].nchan <= 0) ld_lu[ld_nlu].nchan = 1;
+    ld_nlu++;
+    }
+  return ld_nlu;
+  }
+
+
+/* ======================================================================================
+ *
+ * Pick the type of the next request and write the command into cmd
+ *
+ * ======================================================================================
+ */
+int ldCMD(char *cmd)
+  {
+  struct LoadLU *pl;
+  char age[L16];
+  int it, w;
+
+  w = ldRAND() % ld_wsum;
+  for(it = 0; w >= ld_type[it].weight; it++) w = w - ld_type[it].weight;
+  pl = &ld_lu[ldRAND() % ld_nlu];
+  age[0] = '\0';
+  if(ld_maxage > 0) sprintf(age, "@%d ", ld_maxage);
+  switch(it)
+    {
+    case 0: strcpy(cmd, "_LL\r\n"); break;
+    case 1: sprintf(cmd, "%s%d %d RC MV\r\n", age, pl->slot, pl->sm); break;
+    case 2: sprintf(cmd, "%s%d %d PSUM\r\n", age, pl->slot, pl->sm); break;
+    case 3: sprintf(cmd, "%s%d %d DMP %u\r\n", age, pl->slot, pl->sm, ldRAND() % pl->nchan); break;
+    case 4: sprintf(cmd, "%d %d LD %s %u %s\r\n", pl->slot, pl->sm, ld_wprop, ldRAND() % pl->nchan, ld_wval); break;
+    default: sprintf(cmd, "%d %d HVSTATUS\r\n", pl->slot, pl->sm); break;
+    }
+  return it;
+  }
+
+
+/* ======================================================================================
+ *
+ * Record the latency of one response
+ *
+ * ======================================================================================
+ */
+void ldREC(struct LoadType *pt, long long lat, int err)
+  {
+  int *pn;
+
+  pt->n++;
+  if(err) pt->nerr++;
+  if(pt->nlat == pt->maxlat)
+    {
+    pn = (int *)realloc(pt->lat, (pt->maxlat + 4096) * sizeof(int));
+    if(pn == NULL) return; /* keep the count, lose the sample */
+    pt->lat = pn;
+    pt->maxlat = pt->maxlat + 4096;
+    }
+  pt->lat[pt->nlat++] = (lat > 0x7fffffff) ? 0x7fffffff : (int)lat;
+  }
+
+
+int ldCMPINT(const void *p1, const void *p2)
+  {
+  int i1 = *(const int *)p1, i2 = *(const int *)p2;
+
+  return (i1 > i2) - (i1 < i2);
+  }
+
+
+/* ======================================================================================
+ *
+ * Print one line of the report: latencies sorted, percentiles by nearest rank
+ *
+ * ======================================================================================
+ */
+void ldLINE(char *fmt, char *label, int nconn, double rate, double secs, struct LoadType *pt)
+  {
+  double pct[3] = {0.50, 0.99, 0.999};
+  long long v[4] = {0, 0, 0, 0};
+  double rps;
+  int ip, ir;
+
+  if(pt->nlat > 0)
+    {
+    qsort(pt->lat, pt->nlat, sizeof(int), ldCMPINT);
+    for(ip = 0; ip < 3; ip++)
+      {
+      ir = (int)(pct[ip] * pt->nlat + 0.999999) - 1;
+      if(ir < 0) ir = 0;
+      v[ip] = pt->lat[ir];
+      }
+    v[3] = pt->lat[pt->nlat - 1];
+    }
+  rps = (secs > 0) ? pt->n / secs : 0.0;
+
+  if(strcmp(fmt, "json") == 0)
+    printf("{\"label\":\"%s\",\"type\":\"%s\",\"conns\":%d,\"target_rps\":%.1f,\"secs\":%.3f,"
+      "\"n\":%ld,\"err\":%ld,\"lost\":%ld,\"rps\":%.1f,"
+      "\"p50_us\":%lld,\"p99_us\":%lld,\"p999_us\":%lld,\"max_us\":%lld}\n",
+      label, pt->name, nconn, rate, secs, pt->n, pt->nerr, pt->nlost, rps, v[0], v[1], v[2], v[3]);
+  else if(strcmp(fmt, "csv") == 0)
+    printf("%s,%s,%d,%.1f,%.3f,%ld,%ld,%ld,%.1f,%lld,%lld,%lld,%lld\n",
+      label, pt->name, nconn, rate, secs, pt->n, pt->nerr, pt->nlost, rps, v[0], v[1], v[2], v[3]);
+  else
+    printf("%-9s %8ld %6ld %6ld %9.1f %9.3f %9.3f %9.3f %9.3f\n", pt->name, pt->n, pt->nerr, pt->nlost,
+      rps, v[0] / 1000.0, v[1] / 1000.0, v[2] / 1000.0, v[3] / 1000.0);
+  }
+
+
+/* ======================================================================================
+ *
+ * Load test: nconn connections for secs seconds at rate requests/s in total (0 = each
+ * connection sends its next request as soon as the previous one is answered)
+ *
+ * ======================================================================================
+ */
+int ldRUN(int nconn, double rate, double secs, char *fmt, char *label, char *mix)
+  {
+  struct LoadConn *pconn, *pc;
+  struct LoadType all;
+  struct pollfd *pfd;
+  long long t0, tstop, tnow, twake, tlast, interval;
+  char cmd[L256];
+  int ic, it, n, len, nbusy, tmo, lp = strlen(prompt);
+
+  if(ldUNITS() <= 0)
+    {
+    printf("no logic units from _LL (is the server up?)\n");
+    return -1;
+    }
+  pconn = (struct LoadConn *)calloc(nconn, sizeof(struct LoadConn));
+  pfd = (struct pollfd *)calloc(nconn, sizeof(struct pollfd));
+  if((pconn == NULL) || (pfd == NULL))
+    {
+    printf("malloc failed\n");
+    return -1;
+    }
+  for(ic = 0; ic < nconn; ic++)
+    {
+    pconn[ic].fd = srvConnect();
+    if(pconn[ic].fd < 0)
+      {
+      printf("connection %d failed: %s\n", ic, strerror(errno));
+      return -1;
+      }
+    }
+
+  interval = (rate > 0) ? (long long)(nconn * 1.0e6 / rate) : 0;
+  t0 = usnow();
+  tstop = t0 + (long long)(secs * 1.0e6);
+  tlast = t0;
+  for(ic = 0; ic < nconn; ic++) pconn[ic].tnext = t0 + interval * ic / nconn; /* staggered */
+
+  for(;;)
+    {
+    /* send what is due */
+    tnow = usnow();
+    twake = tstop;
+    nbusy = 0;
+    for(ic = 0; ic < nconn; ic++)
+      {
+      pc = &pconn[ic];
+      if((pc->fd >= 0) && !pc->busy && (tnow < tstop) && (pc->tnext <= tnow))
+        {
+        pc->type = ldCMD(cmd);
+        pc->tdue = (interval > 0) ? pc->tnext : tnow;
+        pc->tnext = pc->tdue + interval;
+        pc->len = 0;
+        pc->busy = 1;
+        len = strlen(cmd);
+        if(write(pc->fd, cmd, len) != len)
+          {
+          ld_type[pc->type].nlost++;
+          close(pc->fd);
+          pc->fd = -1;
+          pc->busy = 0;
+          }
+        }
+      if(pc->busy) nbusy++;
+      else if((pc->fd >= 0) && (pc->tnext < twake)) twake = pc->tnext;
+      pfd[ic].fd = pc->busy ? pc->fd : -1;
+      pfd[ic].events = POLLIN;
+      pfd[ic].revents = 0;
+      }
+    if((tnow >= tstop) && ((nbusy == 0) || (tnow >= tstop + 5000000))) break; /* 5 s to drain */
+
+    tmo = (tnow < tstop) ? (int)((twake - tnow + 999) / 1000) : 100;
+    if(tmo < 0) tmo = 0;
+    if(poll(pfd, nconn, tmo) <= 0) continue;
+
+    /* collect responses */
+    for(ic = 0; ic < nconn; ic++)
+      {
+      pc = &pconn[ic];
+      if((pfd[ic].revents == 0) || !pc->busy) continue;
+      n = read(pc->fd, &pc->buff[pc->len], L4096 - 1 - pc->len);
+      if(n <= 0)
+        {
+        ld_type[pc->type].nlost++;
+        close(pc->fd);
+        pc->fd = -1;
+        pc->busy = 0;
+        continue;
+        }
+      pc->len = pc->len + n;
+      pc->buff[pc->len] = '\0';
+      if((pc->len >= lp) && (strcmp(&pc->buff[pc->len - lp], prompt) == 0))
+        {
+        tlast = usnow();
+        ldREC(&ld_type[pc->type], tlast - pc->tdue,
+          (pc->buff[0] == '?') || (strstr(pc->buff, " ?\r") != NULL) || (strstr(pc->buff, " ?\n") != NULL));
+        pc->busy = 0;
+        }
+      else if(pc->len >= L4096 - 1 - lp)
+        {
+        /* long response: keep the head for the error check and the tail for the prompt */
+        memmove(&pc->buff[L16], &pc->buff[pc->len - lp], lp);
+        pc->len = L16 + lp;
+        }
+      }
+    }
+  for(ic = 0; ic < nconn; ic++)
+    {
+    pc = &pconn[ic];
+    if(pc->busy) ld_type[pc->type].nlost++;
+    if(pc->fd >= 0) close(pc->fd);
+    }
+
+  /* report */
+  secs = (tlast - t0) / 1.0e6;
+  memset(&all, 0, sizeof(all));
+  all.name = "ALL";
+  if(strcmp(fmt, "csv") == 0) printf("label,type,conns,target_rps,secs,n,err,lost,rps,p50_us,p99_us,p999_us,max_us\n");
+  else if(strcmp(fmt, "json") != 0)
+    {
+    printf("load          : %d connections, %d logic units, mix %s, target %.1f requests/s, %.3f s%s%s\n",
+      nconn, ld_nlu, mix, rate, secs, (label[0] != '\0') ? ", " : "", label);
+    printf("TYPE             N    ERR   LOST     REQ/S   P50[ms]   P99[ms] P99.9[ms]   MAX[ms]\n");
+    }
+  for(it = 0; it < nTYPE; it++)
+    {
+    if(ld_type[it].weight == 0) continue;
+    ldLINE(fmt, label, nconn, rate * ld_type[it].weight / ld_wsum, secs, &ld_type[it]);
+    all.n = all.n + ld_type[it].n;
+    all.nerr = all.nerr + ld_type[it].nerr;
+    all.nlost = all.nlost + ld_type[it].nlost;
+    for(n = 0; n < ld_type[it].nlat; n++) ldREC(&all, ld_type[it].lat[n], 0);
+    all.n = all.n - ld_type[it].nlat; /* counted above */
+    }
+  ldLINE(fmt, label, nconn, rate, secs, &all);
+  free(pconn);
+  free(pfd);
+  return 0;
+  }
+
+
+int main(int argc, char *argv[])
+  {
+  struct rlimit rl;
+  struct linger lng;
+  long long t0, dt;
+  long rss0, rss1;
+  int *pfd;
+  double rate = 0.0, secs = 10.0;
+  int opt, port = BASE_PORT, ncycle = 1000, nconn = 200, pid = 0;
+  int i1, fd, nfail, nopen;
+  char *host = "127.0.0.1", *mix = NULL, *fmt = "text", *label = "", *pv;
+
+  while((opt = getopt(argc, argv, "H:p:c:n:P:m:R:T:A:W:o:l:S:")) != -1)
+    {
+    switch(opt)
+      {
+      case 'H': host = optarg; break;
+      case 'p': port = atoi(optarg); break;
+      case 'c': ncycle = atoi(optarg); break;
+      case 'n': nconn = atoi(optarg); break;
+      case 'P': pid = atoi(optarg); break;
+      case 'm': mix = optarg; break;
+      case 'R': rate = atof(optarg); break;
+      case 'T': secs = atof(optarg); break;
+      case 'A': ld_maxage = atoi(optarg); break;
+      case 'W':
+        pv = strchr(optarg, ',');
+        if(pv != NULL) *pv++ = '\0';
+        snprintf(ld_wprop, L16, "%s", optarg);
+        if(pv != NULL) snprintf(ld_wval, L16, "%s", pv);
+        break;
+      case 'o': fmt = optarg; break;
+      case 'l': label = optarg; break;
+      case 'S': ld_seed = (atoi(optarg) != 0) ? atoi(optarg) : 1; break;
+      default:
+        printf("usage: %s [-H host] [-p port] [-c cycles] [-n connections] [-P server-pid]\n"
+               "       [-m mix -R rate -T secs -A max-age -W prop,value -o text|csv|json -l label -S seed]\n", argv[0]);
+        exit(1);
+      }
+    }
+
+  memset(&srvAddr, 0, sizeof(srvAddr));
+  srvAddr.sin_family = AF_INET;
+  srvAddr.sin_port = htons(port);
+  if(inet_aton(host, &srvAddr.sin_addr) == 0)
+    {
+    printf("bad server address %s\n", host);
+    exit(1);
+    }
+
+  /* we may need many descriptors */
+  if(getrlimit(RLIMIT_NOFILE, &rl) == 0)
+    {
+    rl.rlim_cur = rl.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &rl);
+    }
+
+  if(mix != NULL)
+    {
+    if((ldMIX(mix) < 0) || (nconn <= 0) || (secs <= 0)) exit(1);
+    exit((ldRUN(nconn, rate, secs, fmt, label, mix) == 0) ? 0 : 1);
+    }
+
+  /* (A) connect/close rate */
+  lng.l_onoff = 1;
+  lng.l_linger = 0;
+  nfail = 0;
+  t0 = usnow();
+  for(i1 = 0; i1 < ncycle; i1++)
+    {
+    fd = srvConnect();
+    if(fd < 0)
+      {
+      nfail++;
+      continue;
+      }
+    /* reset instead of FIN: thousands of client TIME_WAIT sockets would make the
+     * local port search in connect() the bottleneck instead of the server
+     */
+    setsockopt(fd, SOL_SOCKET, SO_LINGER, &lng, sizeof(lng));
+    close(fd);
+    }
+  dt = usnow() - t0;
+  printf("connect/close : %d cycles, %d failed, %.1f connections/s\n",
+    ncycle, nfail, (dt > 0) ? (ncycle - nfail) * 1.0e6 / dt : 0.0);
+
+  /* (B) memory per open connection */
+  pfd = (int *)malloc(nconn * sizeof(int));
+  if(pfd == NULL)
+    {
+    printf("malloc failed\n");
+    exit(1);
+    }
+  usleep(200000); /* let the server settle after (A) */
+  rss0 = rsskb(pid);
+  nopen = 0;
+  nfail = 0;
+  t0 = usnow();
+  for(i1 = 0; i1 < nconn; i1++)
+    {
+    pfd[i1] = srvConnect();
+    if(pfd[i1] < 0)
+      {
+      nfail++;
+      continue;
+      }
+    nopen++;
+    write(pfd[i1], "_BUS\r\n", 6);
+    }
+  for(i1 = 0; i1 < nconn; i1++)
+    {
+    if(pfd[i1] < 0) continue;
+    if(srvPrompt(pfd[i1]) < 0) nfail++;
+    }
+  dt = usnow() - t0;
+  rss1 = rsskb(pid);
+  printf("open          : %d connections, %d failed, %.1f ms to open and serve all\n",
+    nopen, nfail, dt / 1000.0);
+  if((rss0 > 0) && (rss1 > 0))
+    {
+    printf("server RSS    : %ld kB idle, %ld kB with %d connections, %.2f kB/connection\n",
+      rss0, rss1, nopen, (nopen > 0) ? (double)(rss1 - rss0) / nopen : 0.0);
+    }
+  for(i1 = 0; i1 < nconn; i1++)
+    {
+    if(pfd[i1] >= 0) close(pfd[i1]);
+    }
+  free(pfd);
+  return 0;
+  }
@@ -0,0 +1,618 @@
+/*
+ * i2lchv_replay
+ *
+ * Replays a traffic capture of the rPI HV bridge server (20140803_i2lchv_rPI-linux -C FILE,
+ * layout in hvpi_cap.h) into a server, e.g. one running on the i2lchv_sim crate simulator,
+ * and compares the latencies with the captured ones.
+ *
+ * Every captured connection gets its own connection and sends its text requests at the
+ * captured times (scaled by -x), pipelined as they were. With -x 0 a connection sends its
+ * next request as soon as the previous one is answered. The latency of a request runs from
+ * when it was sent to its prompt; the captured latency from the request to its response
+ * record. Both are reported per command verb (p50/p99/max, "?" errors) as text, CSV or
+ * JSON lines (-o), so a caching or scheduling change can be judged on real traffic.
+ * Binary protocol requests are counted but not replayed, nor are text requests the capture
+ * cut at HVPI_CAP_DATA bytes. After a DROP record (the server's capture ring was full) the
+ * responses of that run can no longer be paired with their requests: the later requests
+ * are replayed without a captured latency and the drops are reported.
+ *
+ * Options,
+ *  -H host   server address (default 127.0.0.1)
+ *  -p port   server port (default 24742)
+ *  -x SPEED  1 = as captured (default), 10 = ten times faster, 0 = closed loop
+ *  -r RUN    replay only run RUN of the file (1 = first server start, default 0 = all,
+ *            one after the other)
+ *  -o FMT    report: text (default), csv or json (one JSON object per line)
+ *  -l LABEL  label of the run in the report (e.g. the build)
+ *  -d        print the records of the capture as text and exit
+ *
+ * e.g. i2lchv_sim -c 3:1461N,5:1469P -l /tmp/i2lchv_tty &
+ *      20140803_i2lchv_rPI-linux -d /tmp/i2lchv_tty -g /tmp/i2lchv_gpio -t - &
+ *      i2lchv_replay -x 10 shift.cap
+ *
+ * COMPILE: gcc i2lchv_replay.c -o i2lchv_replay
+ *
+ * 17-Oct-2026
+ */
+
+#define  BASE_PORT   24742
+#define  L16         16
+#define  L256        256
+#define  L4096       4096
+#define  nVERB       32  /* command verbs in the report */
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include "hvpi_cap.h"
+
+/* One captured text request */
+struct Req
+  {
+  int       conn;         /* RConn index */
+  int       verb;
+  long long t;            /* when it is due, us from the start of the replay at -x 1 */
+  long long lat0;         /* captured latency (-1 = no response captured) */
+  int       err0;         /* captured response was an error */
+  long long tsent, lat;   /* replay (lat -1 = no response) */
+  int       err;
+  char      *cmd;
+  };
+
+/* One captured connection */
+struct RConn
+  {
+  int       run;
+  uint32_t  id;
+  int       *req, nreq, maxreq; /* its requests, in order */
+  int       nrsp;               /* captured responses paired so far */
+  int       next;               /* next request to send */
+  int       head;               /* oldest request without response */
+  int       fd;                 /* -1 = not open yet or closed */
+  int       match, atstart;     /* prompt bytes matched, at the first byte of a response */
+  };
+
+unsigned char *prompt = "hvpi>";
+struct sockaddr_in srvAddr;
+struct Req   *req = NULL;
+int          nreq = 0, maxreq = 0;
+struct RConn *rconn = NULL;
+int          nrconn = 0, maxrconn = 0;
+char         *vname[nVERB];
+int          nvname = 0;
+long         nbreq = 0;         /* binary requests, not replayed */
+long         ncut = 0;          /* text requests cut in the capture, not replayed */
+long         ndrop = 0;         /* records the server dropped */
+long         nunpaired = 0;     /* requests after a drop, no captured latency */
+
+
+/* ======================================================================================
+ *
+ * Monotonic time in microseconds
+ *
+ * ======================================================================================
+ */
+long long usnow(void)
+  {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long)ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+  }
+
+
+/* ======================================================================================
+ *
+ * Grow an array of n elements of size sz to hold one more
+ *
+ * ======================================================================================
+ */
+void *grow(void *p, int n, int *pmax, int sz)
+  {
+  if(n < *pmax) return p;
+  *pmax = (*pmax == 0) ? 256 : 2 * *pmax;
+  p = realloc(p, (size_t)*pmax * sz);
+  if(p == NULL)
+    {
+    printf("malloc failed\n");
+    exit(1);
+    }
+  return p;
+  }
+
+
+/* ======================================================================================
+ *
+ * Verb of a command line: _XXX, or the module command after SLOT# SUBMODULE#
+ *
+ * ======================================================================================
+ */
+int verbOF(char *cmd)
+  {
+  char w[3][L16];
+  int nw, iw, iv, i1;
+
+  memset(w, 0, sizeof(w));
+  if(cmd[0] == '@') cmd = cmd + strcspn(cmd, " \t"); /* max-age prefix */
+  nw = sscanf(cmd, "%15s %15s %15s", w[0], w[1], w[2]);
+  iw = ((nw >= 1) && (w[0][0] == '_')) ? 0 : 2;
+  if(nw <= iw) strcpy(w[iw], "?");
+  for(i1 = 0; w[iw][i1] != '\0'; i1++) w[iw][i1] = toupper(w[iw][i1]);
+  for(iv = 0; iv < nvname; iv++)
+    {
+    if(strcmp(vname[iv], w[iw]) == 0) return iv;
+    }
+  if(nvname == nVERB) return nVERB - 1; /* the last one takes the rest */
+  vname[nvname] = strdup((nvname == nVERB - 1) ? "OTHER" : w[iw]);
+  return nvname++;
+  }
+
+
+/* ======================================================================================
+ *
+ * Connection of the current run with capture id (created if new)
+ *
+ * ======================================================================================
+ */
+int connOF(int run, uint32_t id)
+  {
+  struct RConn *pc;
+  int ic;
+
+  for(ic = nrconn - 1; (ic >= 0) && (rconn[ic].run == run); ic--)
+    {
+    if(rconn[ic].id == id) return ic;
+    }
+  rconn = (struct RConn *)grow(rconn, nrconn, &maxrconn, sizeof(struct RConn));
+  pc = &rconn[nrconn];
+  memset(pc, 0, sizeof(*pc));
+  pc->run = run;
+  pc->id = id;
+  pc->fd = -1;
+  return nrconn++;
+  }
+
+
+/* ======================================================================================
+ *
+ * Print one record of the capture (-d)
+ *
+ * ======================================================================================
+ */
+void capPRINT(struct hvpi_cap_rec *pr, long long t0)
+  {
+  static const char *tname[8] = {"START", "REQ", "BREQ", "RSP", "TX", "RX", "ATTN", "DROP"};
+  int i1;
+
+  printf("%12.6f %-5s %3d %5u %6d ", (pr->h.t - t0) / 1.0e6,
+    (pr->h.type < 8) ? tname[pr->h.type] : "?", pr->h.slot, pr->h.conn, pr->h.status);
+  if(pr->h.type == HVPI_CAP_START) printf("wall clock at 0: %lld", (long long)*(int64_t *)pr->data);
+  else if(pr->h.type == HVPI_CAP_BREQ) printf("%d bytes", pr->ndata);
+  else
+    {
+    for(i1 = 0; i1 < pr->ndata; i1++)
+      {
+      if((pr->data[i1] < ' ') || (pr->data[i1] > '~')) printf("\\x%02x", pr->data[i1]);
+      else putchar(pr->data[i1]);
+      }
+    }
+  putchar('\n');
+  }
+
+
+/* ======================================================================================
+ *
+ * Read the capture: text requests of run (0 = all) paired with their responses, or print
+ * every record (dump). Pairing stops at a DROP until the next run. Returns -1 if the
+ * file is not a capture
+ *
+ * ======================================================================================
+ */
+int capLOAD(char *fname, int run, int dump)
+  {
+  struct hvpi_cap_rec rec;
+  struct RConn *pc;
+  struct Req *pq;
+  long long t0 = 0, toff = 0, tlast = 0;
+  FILE *fp;
+  int irun = 0, ic, paired = 1;
+
+  fp = fopen(fname, "rb");
+  if(fp == NULL)
+    {
+    printf("can't open %s: %s\n", fname, strerror(errno));
+    return -1;
+    }
+  if(hvpi_cap_open(fp) != 0)
+    {
+    printf("%s is not a capture file\n", fname);
+    fclose(fp);
+    return -1;
+    }
+  while(hvpi_cap_next(fp, &rec) == 0)
+    {
+    if(rec.h.type == HVPI_CAP_START)
+      {
+      /* runs are put one after the other */
+      irun++;
+      toff = tlast;
+      t0 = rec.h.t;
+      paired = 1;
+      }
+    if(dump)
+      {
+      capPRINT(&rec, t0);
+      continue;
+      }
+    if((irun == 0) || ((run > 0) && (irun != run))) continue;
+    tlast = toff + rec.h.t - t0;
+
+    switch(rec.h.type)
+      {
+      case HVPI_CAP_REQ:
+        if(rec.h.status > rec.ndata)
+          {
+          /* cut short - keeps its place in the response order, not replayed */
+          ncut++;
+          pc = &rconn[connOF(irun, rec.h.conn)];
+          pc->req = (int *)grow(pc->req, pc->nreq, &pc->maxreq, sizeof(int));
+          pc->req[pc->nreq++] = -1;
+          break;
+          }
+        if(paired == 0) nunpaired++;
+        ic = connOF(irun, rec.h.conn);
+        req = (struct Req *)grow(req, nreq, &maxreq, sizeof(struct Req));
+        pq = &req[nreq];
+        memset(pq, 0, sizeof(*pq));
+        pq->conn = ic;
+        pq->t = tlast;
+        pq->lat0 = -1;
+        pq->lat = -1;
+        pq->cmd = strdup(rec.data);
+        pq->verb = verbOF(pq->cmd);
+        pc = &rconn[ic];
+        pc->req = (int *)grow(pc->req, pc->nreq, &pc->maxreq, sizeof(int));
+        pc->req[pc->nreq++] = nreq++;
+        break;
+      case HVPI_CAP_BREQ:
+        /* keeps its place in the response order, not replayed */
+        nbreq++;
+        pc = &rconn[connOF(irun, rec.h.conn)];
+        pc->req = (int *)grow(pc->req, pc->nreq, &pc->maxreq, sizeof(int));
+        pc->req[pc->nreq++] = -1;
+        break;
+      case HVPI_CAP_RSP:
+        if(paired == 0) break;
+        pc = &rconn[connOF(irun, rec.h.conn)];
+        if(pc->nrsp >= pc->nreq) break; /* request before the capture started */
+        ic = pc->req[pc->nrsp++];
+        if(ic < 0) break;
+        req[ic].lat0 = tlast - req[ic].t;
+        req[ic].err0 = (rec.h.status != 0);
+        break;
+      case HVPI_CAP_DROP:
+        /* a lost REQ or RSP would shift every later pair of the run */
+        ndrop = ndrop + rec.h.status;
+        paired = 0;
+        break;
+      }
+    }
+  fclose(fp);
+
+  /* drop the binary requests from the send lists */
+  for(ic = 0; ic < nrconn; ic++)
+    {
+    pc = &rconn[ic];
+    pc->nrsp = 0;
+    for(irun = 0; irun < pc->nreq; irun++)
+      {
+      if(pc->req[irun] >= 0) pc->req[pc->nrsp++] = pc->req[irun];
+      }
+    pc->nreq = pc->nrsp;
+    }
+  return 0;
+  }
+
+
+/* ======================================================================================
+ *
+ * Open a connection to the server (-1 on failure)
+ *
+ * ======================================================================================
+ */
+int srvConnect(void)
+  {
+  int fd, yes = 1;
+
+  fd = socket(AF_INET, SOCK_STREAM, 0);
+  if(fd < 0) return -1;
+  if(connect(fd, (struct sockaddr *)&srvAddr, sizeof(srvAddr)) != 0)
+    {
+    close(fd);
+    return -1;
+    }
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+  return fd;
+  }
+
+
+/* ======================================================================================
+ *
+ * Replay the requests. speed 0 = closed loop per connection. Returns the wall time [us]
+ *
+ * ======================================================================================
+ */
+long long replay(double speed)
+  {
+  unsigned char buff[L4096], line[L4096 + 2];
+  struct pollfd *pfd;
+  struct RConn *pc;
+  struct Req *pq;
+  long long t0, tnow, twake, tdue;
+  int ic, i1, n, nopen, tmo, lp = strlen(prompt);
+
+  pfd = (struct pollfd *)calloc(nrconn, sizeof(struct pollfd));
+  if(pfd == NULL)
+    {
+    printf("malloc failed\n");
+    exit(1);
+    }
+  t0 = usnow();
+  for(;;)
+    {
+    /* send what is due */
+    tnow = usnow();
+    twake = -1;
+    nopen = 0;
+    for(ic = 0; ic < nrconn; ic++)
+      {
+      pc = &rconn[ic];
+      pfd[ic].fd = -1;
+      pfd[ic].events = POLLIN;
+      pfd[ic].revents = 0;
+      while(pc->next < pc->nreq)
+        {
+        pq = &req[pc->req[pc->next]];
+        if(speed > 0) tdue = t0 + (long long)(pq->t / speed);
+        else tdue = (pc->head == pc->next) ? tnow : -1;
+        if((tdue < 0) || (tdue > tnow))
+          {
+          if((tdue > 0) && ((twake < 0) || (tdue < twake))) twake = tdue;
+          break;
+          }
+        if(pc->fd < 0)
+          {
+          if(pc->next > 0) break; /* closed by the server (_Q) */
+          pc->fd = srvConnect();
+          pc->atstart = 1;
+          if(pc->fd < 0)
+            {
+            printf("connection failed: %s\n", strerror(errno));
+            exit(1);
+            }
+          }
+        n = sprintf(line, "%s\r\n", pq->cmd);
+        pq->tsent = usnow();
+        if(write(pc->fd, line, n) != n)
+          {
+          close(pc->fd);
+          pc->fd = -1;
+          pc->next = pc->nreq; /* the rest is lost */
+          break;
+          }
+        pc->next++;
+        }
+      if((pc->fd >= 0) && (pc->head < pc->next))
+        {
+        pfd[ic].fd = pc->fd;
+        nopen++;
+        }
+      else if((pc->fd >= 0) && (pc->next >= pc->nreq))
+        {
+        close(pc->fd);
+        pc->fd = -1;
+        }
+      if(pc->next < pc->nreq) nopen++;
+      }
+    if(nopen == 0) break;
+
+    tmo = (twake < 0) ? 1000 : (int)((twake - tnow + 999) / 1000);
+    if(poll(pfd, nrconn, tmo) <= 0) continue;
+
+    /* collect responses: every prompt ends the oldest request of the connection */
+    for(ic = 0; ic < nrconn; ic++)
+      {
+      pc = &rconn[ic];
+      if((pfd[ic].revents == 0) || (pc->fd < 0)) continue;
+      n = read(pc->fd, buff, L4096);
+      if(n <= 0)
+        {
+        close(pc->fd);
+        pc->fd = -1;
+        pc->head = pc->next; /* no response for the requests in flight */
+        if(pc->next > 0) pc->next = pc->nreq;
+        continue;
+        }
+      tnow = usnow();
+      for(i1 = 0; (i1 < n) && (pc->head < pc->next); i1++)
+        {
+        pq = &req[pc->req[pc->head]];
+        if(pc->atstart)
+          {
+          pq->err = (buff[i1] == '?');
+          pc->atstart = 0;
+          }
+        if(buff[i1] == prompt[pc->match]) pc->match++;
+        else pc->match = (buff[i1] == prompt[0]) ? 1 : 0;
+        if(pc->match == lp)
+          {
+          pq->lat = tnow - pq->tsent;
+          pc->head++;
+          pc->match = 0;
+          pc->atstart = 1;
+          }
+        }
+      }
+    }
+  free(pfd);
+  return usnow() - t0;
+  }
+
+
+/* ======================================================================================
+ *
+ * Percentile p of the n latencies in lat (sorted in place), nearest rank
+ *
+ * ======================================================================================
+ */
+int cmpLL(const void *p1, const void *p2)
+  {
+  long long l1 = *(const long long *)p1, l2 = *(const long long *)p2;
+
+  return (l1 > l2) - (l1 < l2);
+  }
+
+long long pct(long long *lat, int n, double p)
+  {
+  int ir;
+
+  if(n == 0) return 0;
+  ir = (int)(p * n + 0.999999) - 1;
+  return lat[(ir < 0) ? 0 : ir];
+  }
+
+
+/* ======================================================================================
+ *
+ * Report one verb (iv < 0 = all of them)
+ *
+ * ======================================================================================
+ */
+void report(char *fmt, char *label, double speed, double secs, int iv, long long *l0, long long *l1)
+  {
+  long long v0[3], v1[3];
+  long n = 0, n0 = 0, n1 = 0, e0 = 0, e1 = 0, nlost = 0;
+  int iq;
+
+  for(iq = 0; iq < nreq; iq++)
+    {
+    if((iv >= 0) && (req[iq].verb != iv)) continue;
+    n++;
+    if(req[iq].lat0 >= 0) l0[n0++] = req[iq].lat0;
+    if(req[iq].lat >= 0) l1[n1++] = req[iq].lat;
+    else nlost++;
+    e0 = e0 + req[iq].err0;
+    e1 = e1 + ((req[iq].lat >= 0) && req[iq].err);
+    }
+  qsort(l0, n0, sizeof(long long), cmpLL);
+  qsort(l1, n1, sizeof(long long), cmpLL);
+  v0[0] = pct(l0, n0, 0.50);
+  v0[1] = pct(l0, n0, 0.99);
+  v0[2] = (n0 > 0) ? l0[n0 - 1] : 0;
+  v1[0] = pct(l1, n1, 0.50);
+  v1[1] = pct(l1, n1, 0.99);
+  v1[2] = (n1 > 0) ? l1[n1 - 1] : 0;
+
+  if(strcmp(fmt, "json") == 0)
+    printf("{\"label\":\"%s\",\"verb\":\"%s\",\"speed\":%.2f,\"secs\":%.3f,\"n\":%ld,"
+      "\"err_cap\":%ld,\"err\":%ld,\"lost\":%ld,"
+      "\"p50_cap_us\":%lld,\"p99_cap_us\":%lld,\"max_cap_us\":%lld,"
+      "\"p50_us\":%lld,\"p99_us\":%lld,\"max_us\":%lld}\n",
+      label, (iv < 0) ? "ALL" : vname[iv], speed, secs, n, e0, e1, nlost,
+      v0[0], v0[1], v0[2], v1[0], v1[1], v1[2]);
+  else if(strcmp(fmt, "csv") == 0)
+    printf("%s,%s,%.2f,%.3f,%ld,%ld,%ld,%ld,%lld,%lld,%lld,%lld,%lld,%lld\n",
+      label, (iv < 0) ? "ALL" : vname[iv], speed, secs, n, e0, e1, nlost,
+      v0[0], v0[1], v0[2], v1[0], v1[1], v1[2]);
+  else
+    printf("%-9s %7ld %5ld %5ld %5ld  %9.3f %9.3f %9.3f  %9.3f %9.3f %9.3f\n",
+      (iv < 0) ? "ALL" : vname[iv], n, e0, e1, nlost,
+      v0[0] / 1000.0, v0[1] / 1000.0, v0[2] / 1000.0, v1[0] / 1000.0, v1[1] / 1000.0, v1[2] / 1000.0);
+  }
+
+
+int main(int argc, char *argv[])
+  {
+  long long *l0, *l1, dt;
+  double speed = 1.0, secs;
+  int opt, port = BASE_PORT, run = 0, dump = 0, iv;
+  char *host = "127.0.0.1", *fmt = "text", *label = "";
+
+  while((opt = getopt(argc, argv, "H:p:x:r:o:l:d")) != -1)
+    {
+    switch(opt)
+      {
+      case 'H': host = optarg; break;
+      case 'p': port = atoi(optarg); break;
+      case 'x': speed = atof(optarg); break;
+      case 'r': run = atoi(optarg); break;
+      case 'o': fmt = optarg; break;
+      case 'l': label = optarg; break;
+      case 'd': dump = 1; break;
+      default:
+        optind = argc;
+        break;
+      }
+    }
+  if(optind != argc - 1)
+    {
+    printf("usage: %s [-H host] [-p port] [-x speed] [-r run] [-o text|csv|json] [-l label] [-d] capture-file\n", argv[0]);
+    exit(1);
+    }
+
+  memset(&srvAddr, 0, sizeof(srvAddr));
+  srvAddr.sin_family = AF_INET;
+  srvAddr.sin_port = htons(port);
+  if(inet_aton(host, &srvAddr.sin_addr) == 0)
+    {
+    printf("bad server address %s\n", host);
+    exit(1);
+    }
+
+  if(capLOAD(argv[optind], run, dump) < 0) exit(1);
+  if(dump) exit(0);
+  if(nreq == 0)
+    {
+    printf("no text requests in %s\n", argv[optind]);
+    exit(1);
+    }
+
+  if(ndrop > 0)
+    fprintf(stderr, "warning: the capture lost %ld records, %ld requests after a loss have no captured latency\n",
+      ndrop, nunpaired);
+  if(ncut > 0) fprintf(stderr, "warning: %ld requests longer than %d bytes were cut in the capture, not replayed\n",
+    ncut, HVPI_CAP_DATA);
+
+  dt = replay(speed);
+  secs = dt / 1.0e6;
+
+  l0 = (long long *)malloc(nreq * sizeof(long long));
+  l1 = (long long *)malloc(nreq * sizeof(long long));
+  if((l0 == NULL) || (l1 == NULL))
+    {
+    printf("malloc failed\n");
+    exit(1);
+    }
+  if(strcmp(fmt, "csv") == 0)
+    printf("label,verb,speed,secs,n,err_cap,err,lost,p50_cap_us,p99_cap_us,max_cap_us,p50_us,p99_us,max_us\n");
+  else if(strcmp(fmt, "json") != 0)
+    {
+    printf("replay        : %s, %d requests on %d connections (%ld binary not replayed), speed %.2f, %.3f s%s%s\n",
+      argv[optind], nreq, nrconn, nbreq, speed, secs, (label[0] != '\0') ? ", " : "", label);
+    printf("                              captured [ms]                  replayed [ms]\n");
+    printf("VERB            N  ERR0   ERR  LOST        P50       P99       MAX        P50       P99       MAX\n");
+    }
+  for(iv = 0; iv < nvname; iv++) report(fmt, label, speed, secs, iv, l0, l1);
+  report(fmt, label, speed, secs, -1, l0, l1);
+  return 0;
+  }
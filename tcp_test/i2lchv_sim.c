@@ -0,0 +1,919 @@
+/*
+ * i2lchv_sim
+ *
+ * Crate simulator for the rPI HV bridge server (20140803_i2lchv_rPI-linux) - the module
+ * side of the LeCroy serial protocol on a pseudo-terminal, so the real serial code of the
+ * server (msgget(), handshakes, ATTN*) runs without a crate.
+ *
+ * Wire protocol, as seen by a module:
+ *   server -> module : GA ACK text LF        GA = 255 - SLOT# (geographical address), ACK = 0x06
+ *                      text = "TICKET [SUBMODULE#] module-cmd-syntax", empty = handshake/xfer
+ *   module -> server : ACK CR LF             handshake, the command was taken (NAK 0x15 if the
+ *                                            module still holds a response)
+ *                      ATTN* raised          once the response is ready
+ *   server -> module : GA ACK LF             send the response
+ *   module -> server : ACK response CR LF    and ATTN* released (ACK CR LF if nothing is pending)
+ *   A slot without module does not answer at all.
+ *
+ * ATTN* is bit 23 of word 13 (GPLEV0) of a file laid out like the BCM2835 GPIO registers;
+ * the server maps it instead of /dev/mem (-g FILE) and samples it like the real line.
+ *
+ * Channel model, advanced whenever a frame arrives (simulated time = wall clock * -x):
+ *  - MV ramps toward DV (limited to HVL) at RUP V/s when |V| goes up, RDN V/s when it goes
+ *    down, toward 0 after HVOFF or with CE = 0. The readback adds noise and a slow drift.
+ *  - MC = |V| / load + charging current C dV/dt + noise.
+ *  - MC above TC trips the channel: it goes to 0 V and stays off until the next HVON.
+ *  - ST bits: 01 on, 02 ramping up, 04 ramping down, 08 tripped, 10 DV limited by HVL.
+ *  - PSUM counters move only on real changes: MV or MC off by more than MVDZ or MCDZ from
+ *    the value last counted, any change of ST, a LD that changed a setting.
+ *
+ * Fault injection (-f), per slot, each fault with its own rate (0..1), drawn from a
+ * generator of its own (-F) so the same seed gives the same faults:
+ *   mute     command ignored, no handshake                 (server: MSGstat_NONE)
+ *   nak      command refused with NAK CR LF                (MSGstat_noACK)
+ *   noattn   command taken but ATTN* never raised          (IsGpioSet() timeout)
+ *   delay    ATTN* raised MS later (rate/MS, default 1000)  (slow module)
+ *   trunc    response cut short, no CR LF                  (MSGstat_noEOM)
+ *   garbage  1-4 random bytes inserted in the response     (noACK or a damaged reply)
+ * kill -USR1 prints the faults injected so far.
+ *
+ * Virtual clock (-V, with the server's -V): the time is the one the server keeps in the GPIO
+ * file (int64 at word 64), and instead of raising ATTN* on time the simulator writes when
+ * it goes up (int64 at word 66, 0 = never); the server compares it with its clock. Once
+ * done with a frame the simulator also counts it (int64 at word 68) after the characters
+ * it wrote back (int64 at word 70): the server reads until it has them all and does not
+ * wait on the wall clock for a module that does not answer.
+ *
+ * Usage,
+ *   i2lchv_sim -c 3:1461N,5:1469P -l /tmp/i2lchv_tty &
+ *   20140803_i2lchv_rPI-linux -d /tmp/i2lchv_tty -g /tmp/i2lchv_gpio
+ *
+ * Options,
+ *  -c SPEC   crate: SLOT:TYPE,... with TYPE 1461N, 1461P, 1469N, 1469P (2 submodules),
+ *            1471N or 1471P (default 1:1461N)
+ *  -g FILE   GPIO register file holding ATTN* (default /tmp/i2lchv_gpio)
+ *  -l LINK   symbolic link to the pty for the server's -d (default: print the pty name only)
+ *  -A US     module processing time, command to ATTN* (default 5000)
+ *  -x SCALE  simulated seconds per wall-clock second of the channel model (default 1)
+ *  -R MOHM   load of every channel (default 1000)
+ *  -C NF     capacitance of every channel (default 10)
+ *  -S SEED   seed of the noise (default 1) - same seed, same commands, same values
+ *  -f SPEC   faults: SLOT:FAULT=RATE[,FAULT=RATE...][;SLOT:...], SLOT * = every slot,
+ *            e.g. "*:nak=0.01;5:noattn=0.05,delay=0.1/500"
+ *  -F SEED   seed of the fault generator (default 1)
+ *  -V        run on the server's virtual clock
+ *  -v        print every frame
+ *
+ * COMPILE: gcc i2lchv_sim.c -o i2lchv_sim -lm
+ *
+ * 17-Oct-2026
+ */
+
+#define  _GNU_SOURCE  /* posix_openpt(), cfmakeraw() */
+#define  L16          16
+#define  L256         256
+#define  L4096        4096
+#define  nSLOTS       16  /* slots in a crate */
+#define  nSUBMOD       2  /* maximum submodules of a module */
+#define  nPROP        11  /* properties of a logic unit */
+#define  nCHAN        12  /* maximum channels of a logic unit */
+#define  ATTN_GPIO    23
+#define  GPIO_LEV0    13  /* word of the GPIO level register */
+#define  GPIO_VCLK    64  /* int64 virtual time (server) */
+#define  GPIO_VATTN   66  /* int64 virtual time ATTN* goes up, 0 = never (simulator) */
+#define  GPIO_VFRAME  68  /* int64 frames taken from the server (simulator) */
+#define  GPIO_VBYTE   70  /* int64 characters written back (simulator) */
+#define  ACK          0x06
+#define  NAK          0x15
+#define  TSTEP        0.05 /* s - longest step of the channel model */
+
+/* Faults */
+#define  nFAULT    6
+#define  F_MUTE    0
+#define  F_NAK     1
+#define  F_NOATTN  2
+#define  F_DELAY   3
+#define  F_TRUNC   4
+#define  F_GARB    5
+
+/* prop[] index of the properties the model uses */
+#define  P_MC     0
+#define  P_MV     1
+#define  P_DV     2
+#define  P_RUP    3
+#define  P_RDN    4
+#define  P_TC     5
+#define  P_CE     6
+#define  P_ST     7
+#define  P_MVDZ   8
+#define  P_MCDZ   9
+#define  P_HVL   10
+
+/* ST bits */
+#define  ST_ON     0x01
+#define  ST_RUP    0x02
+#define  ST_RDN    0x04
+#define  ST_TRIP   0x08
+#define  ST_HVL    0x10
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <math.h>
+#include <stdint.h>
+#include <termios.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* Property table - names in PROP order, ATTR response, format of a value */
+struct Prop
+  {
+  char  name[L16];
+  char  attr[L256];
+  char  fmt[L16];
+  float def;          /* value at power-up */
+  };
+
+struct Prop prop[nPROP] =
+  {
+  {"MC",   "Current_uA uA M N 7 %7.1lf",    "%.1f",  0.1},
+  {"MV",   "Meas_V V M N 7 %7.1lf",         "%.1f",  0.3},
+  {"DV",   "Target_V V N N -3000.0_0.0_0.5 %7.1lf", "%.1f", 0.0},
+  {"RUP",  "RUP_V/s V/s P N 50_1000_10 %7.1f", "%.1f", 50.0},
+  {"RDN",  "RDN_V/s V/s P N 50_1000_10 %7.1f", "%.1f", 100.0},
+  {"TC",   "Trip_uA uA P N 1000_10_1 %7.1f", "%.1f",  13.0},
+  {"CE",   "CE_En na P N En_Ds %2s",        "%.0f",  1.0},
+  {"ST",   "Status na M N 2 %2x",           "%02X",  1.0},
+  {"MVDZ", "MV_Zone V N N 0_3000 %8f",      "%.1f",  5.0},
+  {"MCDZ", "MC_Zone uA N N 0_3000 %8f",     "%.1f",  3.0},
+  {"HVL",  "HVL_V V P N -3000_0_0.5 %7.1f", "%.1f",  -2500.0}
+  };
+
+/* Channel state of the model */
+struct Chan
+  {
+  double    v;        /* output voltage */
+  double    drift;    /* readback offset */
+  int       trip;
+  float     cmv, cmc; /* MV & MC when PSUM last counted them */
+  };
+
+/* Logic unit - one submodule */
+struct LUnit
+  {
+  int       nchan;
+  float     val[nPROP][nCHAN]; /* as read back by RC (settings & last model step) */
+  uint16_t  psum[nPROP];     /* change counter of each property */
+  int       hvon;
+  struct Chan ch[nCHAN];
+  double    tsim;            /* simulated time of the last step (s) */
+  int       moving;          /* a channel may be ramping - steps of at most TSTEP */
+  };
+
+/* Module in a slot */
+struct Module
+  {
+  char          type[L16];   /* 1461N, ... */
+  int           nsm;
+  char          serial[L16];
+  struct LUnit  lu[nSUBMOD];
+  char          rsp[L4096];  /* response waiting for the transfer */
+  long long     tready;      /* when ATTN* goes up for rsp, 0 = nothing pending */
+  };
+
+struct Module *crate[nSLOTS];
+int       ptm = -1;                   /* pty master */
+volatile uint32_t *gpio = NULL;       /* GPIO register file */
+long long attn_us = 5000;
+int       verbose = 0;
+double    sim_scale = 1.0;   /* -x */
+double    sim_load = 1000.0; /* MOhm (-R) */
+double    sim_cap = 10.0;    /* nF (-C) */
+long long sim_t0;            /* usnow() at start */
+int       sim_virtual = 0;   /* -V */
+long long sim_nframe = 0, sim_nbyte = 0; /* frames taken, characters written back */
+uint64_t  sim_rng = 1;       /* -S */
+
+const char *fault_name[nFAULT] = {"mute", "nak", "noattn", "delay", "trunc", "garbage"};
+double    fault_rate[nSLOTS][nFAULT];
+int       fault_delay[nSLOTS];   /* ms */
+long      fault_n[nSLOTS][nFAULT]; /* injected */
+uint64_t  fault_rng = 1;       /* -F */
+volatile sig_atomic_t fault_dump = 0;
+
+
+/* ======================================================================================
+ *
+ * Monotonic time in microseconds
+ *
+ * ======================================================================================
+ */
+long long usnow(void)
+  {
+  struct timespec ts;
+
+  if(sim_virtual) return __atomic_load_n((volatile int64_t *)&gpio[GPIO_VCLK], __ATOMIC_ACQUIRE);
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long)ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+  }
+
+
+/* ======================================================================================
+ *
+ * Drive ATTN* - the line is up while any module has a response ready. For the virtual
+ * clock, publish when that will be
+ *
+ * ======================================================================================
+ */
+void attnSET(long long tnow)
+  {
+  long long tup = 0;
+  int slot, up = 0;
+
+  for(slot = 0; slot < nSLOTS; slot++)
+    {
+    if((crate[slot] == NULL) || (crate[slot]->tready == 0)) continue;
+    if(crate[slot]->tready <= tnow) up = 1;
+    if((tup == 0) || (crate[slot]->tready < tup)) tup = crate[slot]->tready;
+    }
+  __atomic_store_n((volatile int64_t *)&gpio[GPIO_VATTN], tup, __ATOMIC_RELEASE);
+  if(up) __atomic_or_fetch(&gpio[GPIO_LEV0], 1u << ATTN_GPIO, __ATOMIC_RELEASE);
+  else __atomic_and_fetch(&gpio[GPIO_LEV0], ~(1u << ATTN_GPIO), __ATOMIC_RELEASE);
+  }
+
+
+/* ======================================================================================
+ *
+ * Gaussian noise of sigma 1 (xorshift64* and Box-Muller)
+ *
+ * ======================================================================================
+ */
+double gauss(void)
+  {
+  double u1, u2;
+
+  sim_rng ^= sim_rng >> 12;
+  sim_rng ^= sim_rng << 25;
+  sim_rng ^= sim_rng >> 27;
+  u1 = ((sim_rng * 2685821657736338717ULL) >> 11) * (1.0 / 9007199254740992.0);
+  sim_rng ^= sim_rng >> 12;
+  sim_rng ^= sim_rng << 25;
+  sim_rng ^= sim_rng >> 27;
+  u2 = ((sim_rng * 2685821657736338717ULL) >> 11) * (1.0 / 9007199254740992.0);
+  if(u1 < 1.0e-300) u1 = 1.0e-300;
+  return sqrt(-2.0 * log(u1)) * cos(2.0 * M_PI * u2);
+  }
+
+
+/* ======================================================================================
+ *
+ * Uniform [0,1) from the fault generator (xorshift64*)
+ *
+ * ======================================================================================
+ */
+double frand(void)
+  {
+  fault_rng ^= fault_rng >> 12;
+  fault_rng ^= fault_rng << 25;
+  fault_rng ^= fault_rng >> 27;
+  return ((fault_rng * 2685821657736338717ULL) >> 11) * (1.0 / 9007199254740992.0);
+  }
+
+
+/* ======================================================================================
+ *
+ * Inject fault ifl at slot this time? Counts the ones injected
+ *
+ * ======================================================================================
+ */
+int faultHIT(int slot, int ifl)
+  {
+  if(fault_rate[slot][ifl] <= 0.0) return 0;
+  if(frand() >= fault_rate[slot][ifl]) return 0;
+  fault_n[slot][ifl]++;
+  return 1;
+  }
+
+
+/* ======================================================================================
+ *
+ * Parse the fault specification (-f). Return codes,
+ *  -1 = syntax error
+ *   0 = done
+ *
+ * ======================================================================================
+ */
+int faultSPEC(char *spec)
+  {
+  char s1[L4096], *pg, *pf, *sg, *sf, *pv;
+  int slot, s0, s1n, ifl, i1;
+
+  for(slot = 0; slot < nSLOTS; slot++) fault_delay[slot] = 1000;
+  strncpy(s1, spec, L4096 - 1);
+  s1[L4096 - 1] = '\0';
+  for(pg = strtok_r(s1, ";", &sg); pg != NULL; pg = strtok_r(NULL, ";", &sg))
+    {
+    /* SLOT: */
+    pf = strchr(pg, ':');
+    if(pf == NULL) return -1;
+    *pf++ = '\0';
+    if(strcmp(pg, "*") == 0)
+      {
+      s0 = 0;
+      s1n = nSLOTS - 1;
+      }
+    else
+      {
+      s0 = s1n = atoi(pg);
+      if((s0 < 0) || (s0 >= nSLOTS)) return -1;
+      }
+
+    /* FAULT=RATE[/MS] ... */
+    for(pf = strtok_r(pf, ",", &sf); pf != NULL; pf = strtok_r(NULL, ",", &sf))
+      {
+      pv = strchr(pf, '=');
+      if(pv == NULL) return -1;
+      *pv++ = '\0';
+      for(ifl = 0; (ifl < nFAULT) && (strcmp(pf, fault_name[ifl]) != 0); ifl++);
+      if(ifl == nFAULT) return -1;
+      for(i1 = s0; i1 <= s1n; i1++)
+        {
+        fault_rate[i1][ifl] = atof(pv);
+        if((ifl == F_DELAY) && (strchr(pv, '/') != NULL)) fault_delay[i1] = atoi(strchr(pv, '/') + 1);
+        }
+      }
+    }
+  return 0;
+  }
+
+
+/* ======================================================================================
+ *
+ * SIGUSR1 - print the faults injected so far
+ *
+ * ======================================================================================
+ */
+void faultSIG(int sig)
+  {
+  (void)sig;
+  fault_dump = 1;
+  }
+
+
+/* ======================================================================================
+ *
+ * Print the faults injected so far
+ *
+ * ======================================================================================
+ */
+void faultPRINT(void)
+  {
+  int slot, ifl;
+
+  for(slot = 0; slot < nSLOTS; slot++)
+    {
+    if(crate[slot] == NULL) continue;
+    printf("FAULT SLOT %d", slot);
+    for(ifl = 0; ifl < nFAULT; ifl++) printf(" %s %ld", fault_name[ifl], fault_n[slot][ifl]);
+    printf("\n");
+    }
+  fflush(stdout);
+  }
+
+
+/* ======================================================================================
+ *
+ * Advance channel ich of logic unit plu by dt simulated seconds. Returns 1 while the
+ * output is still ramping
+ *
+ * ======================================================================================
+ */
+int chanSTEP(struct LUnit *plu, int ich, double dt)
+  {
+  struct Chan *pc = &plu->ch[ich];
+  double target, hvl, rate, dv, v0, mc, mv;
+  int st;
+
+  /* where the output is going */
+  st = 0;
+  target = plu->val[P_DV][ich];
+  hvl = plu->val[P_HVL][ich];
+  if(fabs(target) > fabs(hvl))
+    {
+    target = (target < 0) ? -fabs(hvl) : fabs(hvl);
+    st |= ST_HVL;
+    }
+  if((plu->hvon == 0) || (plu->val[P_CE][ich] == 0) || pc->trip) target = 0.0;
+  else st |= ST_ON;
+
+  /* ramp */
+  v0 = pc->v;
+  dv = target - pc->v;
+  rate = (fabs(target) > fabs(pc->v)) ? plu->val[P_RUP][ich] : plu->val[P_RDN][ich];
+  if(fabs(dv) <= rate * dt) pc->v = target;
+  else
+    {
+    pc->v += (dv > 0) ? rate * dt : -rate * dt;
+    st |= (fabs(target) > fabs(pc->v)) ? ST_RUP : ST_RDN;
+    }
+
+  /* load and charging current (V/MOhm = uA, nF * V/s = 1e-3 uA) */
+  mc = fabs(pc->v) / sim_load + sim_cap * fabs(pc->v - v0) / dt * 1.0e-3 + 0.02 * gauss();
+  if(mc < 0) mc = 0;
+  if((st & ST_ON) && (mc > plu->val[P_TC][ich]))
+    {
+    pc->trip = 1;
+    pc->v = 0.0;
+    st = (st & ST_HVL) | ST_TRIP;
+    }
+  if(pc->trip) st |= ST_TRIP;
+
+  /* readback: slow bounded drift and noise */
+  pc->drift += 0.05 * sqrt(dt) * gauss();
+  if(pc->drift > 0.5) pc->drift = 0.5;
+  if(pc->drift < -0.5) pc->drift = -0.5;
+  mv = pc->v + pc->drift + 0.1 * gauss();
+
+  plu->val[P_MV][ich] = mv;
+  plu->val[P_MC][ich] = mc;
+  if(fabs(mv - pc->cmv) > plu->val[P_MVDZ][ich])
+    {
+    pc->cmv = mv;
+    plu->psum[P_MV]++;
+    }
+  if(fabs(mc - pc->cmc) > plu->val[P_MCDZ][ich])
+    {
+    pc->cmc = mc;
+    plu->psum[P_MC]++;
+    }
+  if(plu->val[P_ST][ich] != st)
+    {
+    plu->val[P_ST][ich] = st;
+    plu->psum[P_ST]++;
+    }
+  return ((st & (ST_RUP | ST_RDN)) != 0);
+  }
+
+
+/* ======================================================================================
+ *
+ * Bring the channel model of every logic unit up to wall-clock time tnow. A logic unit
+ * whose outputs have settled takes the whole interval in one step (noise and drift are
+ * drawn for the step length), so long idle stretches of virtual time cost nothing
+ *
+ * ======================================================================================
+ */
+void simADVANCE(long long tnow)
+  {
+  struct LUnit *plu;
+  double tsim, dt;
+  int slot, ism, ich, moving;
+
+  tsim = (tnow - sim_t0) * 1.0e-6 * sim_scale;
+  for(slot = 0; slot < nSLOTS; slot++)
+    {
+    if(crate[slot] == NULL) continue;
+    for(ism = 0; ism < crate[slot]->nsm; ism++)
+      {
+      plu = &crate[slot]->lu[ism];
+      while(plu->tsim < tsim)
+        {
+        dt = tsim - plu->tsim;
+        if((dt > TSTEP) && plu->moving) dt = TSTEP;
+        moving = 0;
+        for(ich = 0; ich < plu->nchan; ich++) moving |= chanSTEP(plu, ich, dt);
+        plu->moving = moving;
+        plu->tsim += dt;
+        }
+      }
+    }
+  }
+
+
+/* ======================================================================================
+ *
+ * Put a module of type (1461N, 1469P, ...) in a slot. Return codes,
+ *  -1 = unknown type or bad slot
+ *   0 = done
+ *
+ * ======================================================================================
+ */
+int modNEW(int slot, char *type)
+  {
+  struct Module *pm;
+  int ism, ip, ich, nchan;
+
+  if((slot < 0) || (slot >= nSLOTS)) return -1;
+  if((strlen(type) != 5) || ((type[4] != 'N') && (type[4] != 'P'))) return -1;
+  if(strncmp(type, "1461", 4) == 0) nchan = 12;
+  else if(strncmp(type, "1469", 4) == 0) nchan = 6;
+  else if(strncmp(type, "1471", 4) == 0) nchan = 8;
+  else return -1;
+
+  pm = (struct Module *)calloc(1, sizeof(struct Module));
+  if(pm == NULL) return -1;
+  strcpy(pm->type, type);
+  pm->nsm = (strncmp(type, "1469", 4) == 0) ? 2 : 1;
+  sprintf(pm->serial, "B5%04d", 1880 + slot);
+  for(ism = 0; ism < pm->nsm; ism++)
+    {
+    pm->lu[ism].nchan = nchan;
+    pm->lu[ism].moving = 1;
+    for(ip = 0; ip < nPROP; ip++)
+      {
+      for(ich = 0; ich < nchan; ich++) pm->lu[ism].val[ip][ich] = prop[ip].def;
+      }
+    /* positive modules */
+    for(ich = 0; (ich < nchan) && (type[4] == 'P'); ich++) pm->lu[ism].val[P_HVL][ich] = -prop[P_HVL].def;
+    for(ich = 0; ich < nchan; ich++)
+      {
+      pm->lu[ism].ch[ich].cmv = prop[P_MV].def;
+      pm->lu[ism].ch[ich].cmc = prop[P_MC].def;
+      }
+    }
+  crate[slot] = pm;
+  return 0;
+  }
+
+
+/* ======================================================================================
+ *
+ * Index of a property name, -1 if unknown
+ *
+ * ======================================================================================
+ */
+int propIDX(char *name)
+  {
+  int ip;
+
+  for(ip = 0; ip < nPROP; ip++)
+    {
+    if(strcasecmp(name, prop[ip].name) == 0) return ip;
+    }
+  return -1;
+  }
+
+
+/* ======================================================================================
+ *
+ * Execute a module command of logic unit plu, response (without ACK and CR LF) in rsp.
+ * w[] are the words of the command, w[0] is the verb
+ *
+ * ======================================================================================
+ */
+void modCMD(struct Module *pm, struct LUnit *plu, int ism, char *tkt, char *w[], int nw, char *rsp)
+  {
+  int ip, ich, n;
+  float v;
+
+  for(n = 0; w[0][n] != '\0'; n++) w[0][n] = toupper(w[0][n]);
+  n = sprintf(rsp, "%s %s", tkt, w[0]);
+
+  if(strcmp(w[0], "SM") == 0) sprintf(&rsp[n], " %d", pm->nsm);
+  else if(strcmp(w[0], "ID") == 0)
+    sprintf(&rsp[n], " %s %d 1  11 %d %s -1 1000 1.135", pm->type, ism, plu->nchan, pm->serial);
+  else if(strcmp(w[0], "PROP") == 0)
+    {
+    for(ip = 0; ip < nPROP; ip++) n += sprintf(&rsp[n], " %s", prop[ip].name);
+    }
+  else if((strcmp(w[0], "ATTR") == 0) && (nw > 1) && ((ip = propIDX(w[1])) >= 0))
+    sprintf(&rsp[n], " %s %s", prop[ip].name, prop[ip].attr);
+  else if((strcmp(w[0], "RC") == 0) && (nw > 1) && ((ip = propIDX(w[1])) >= 0))
+    {
+    n += sprintf(&rsp[n], " %s", prop[ip].name);
+    for(ich = 0; ich < plu->nchan; ich++)
+      {
+      rsp[n++] = ' ';
+      if(strcmp(prop[ip].fmt, "%02X") == 0) n += sprintf(&rsp[n], "%02X", (int)plu->val[ip][ich]);
+      else n += sprintf(&rsp[n], prop[ip].fmt, plu->val[ip][ich]);
+      }
+    }
+  else if((strcmp(w[0], "DMP") == 0) && (nw > 1) && ((ich = atoi(w[1])) >= 0) && (ich < plu->nchan))
+    {
+    n += sprintf(&rsp[n], " %d", ich);
+    for(ip = 0; ip < nPROP; ip++)
+      {
+      rsp[n++] = ' ';
+      if(strcmp(prop[ip].fmt, "%02X") == 0) n += sprintf(&rsp[n], "%02X", (int)plu->val[ip][ich]);
+      else n += sprintf(&rsp[n], prop[ip].fmt, plu->val[ip][ich]);
+      }
+    }
+  else if(strcmp(w[0], "PSUM") == 0)
+    {
+    for(ip = 0; ip < nPROP; ip++) n += sprintf(&rsp[n], " %04X", plu->psum[ip]);
+    }
+  else if((strcmp(w[0], "LD") == 0) && (nw > 3) && ((ip = propIDX(w[1])) >= 0))
+    {
+    /* LD PROP first-channel value [value ...] */
+    n += sprintf(&rsp[n], " %s %s", prop[ip].name, w[2]);
+    if((ip == P_MC) || (ip == P_MV) || (ip == P_ST)) return; /* measured - not settable */
+    for(ich = atoi(w[2]); (ich >= 0) && (ich < plu->nchan) && (ich - atoi(w[2]) + 3 < nw); ich++)
+      {
+      v = atof(w[ich - atoi(w[2]) + 3]);
+      if(plu->val[ip][ich] != v) plu->psum[ip]++;
+      plu->val[ip][ich] = v;
+      }
+    plu->moving = 1;
+    }
+  else if((strcmp(w[0], "HVON") == 0) || (strcmp(w[0], "HVOFF") == 0))
+    {
+    /* the model ramps the channels from here; HVON also resets trips */
+    plu->hvon = (strcmp(w[0], "HVON") == 0);
+    plu->moving = 1;
+    for(ich = 0; (ich < plu->nchan) && plu->hvon; ich++) plu->ch[ich].trip = 0;
+    }
+  else if(strcmp(w[0], "HVSTATUS") == 0) sprintf(&rsp[n], " %s", plu->hvon ? "HVON" : "HVOFF");
+  else sprintf(rsp, "%s ?", tkt);
+  }
+
+
+/* ======================================================================================
+ *
+ * Write to the server, counting the characters
+ *
+ * ======================================================================================
+ */
+void simSEND(unsigned char *out, int nout)
+  {
+  int n;
+
+  n = write(ptm, out, nout);
+  if(n > 0) sim_nbyte = sim_nbyte + n;
+  }
+
+
+/* ======================================================================================
+ *
+ * One frame from the server (without the LF): GA ACK text
+ *
+ * ======================================================================================
+ */
+void simFRAME(unsigned char *fr, int len, long long tnow)
+  {
+  struct Module *pm;
+  unsigned char out[L4096 + L16];
+  char txt[L4096], *w[L256], *tkt;
+  int slot, nw, ism, nout, i1, n;
+
+  if((len < 2) || (fr[1] != ACK)) return;
+  slot = 255 - fr[0];
+  if((slot < 0) || (slot >= nSLOTS) || (crate[slot] == NULL)) return; /* nobody there */
+  pm = crate[slot];
+  simADVANCE(tnow);
+  memcpy(txt, &fr[2], len - 2);
+  txt[len - 2] = '\0';
+  if(verbose) printf("slot %d <- %s\n", slot, txt);
+
+  if(txt[0] == '\0')
+    {
+    /* transfer request - the pending response if it is ready, else a handshake */
+    if((pm->tready != 0) && (pm->tready <= tnow))
+      {
+      nout = sprintf(out, "%c%s\r\n", ACK, pm->rsp);
+      pm->tready = 0;
+      if(verbose) printf("slot %d -> %s\n", slot, pm->rsp);
+      if(faultHIT(slot, F_TRUNC)) nout = 1 + (nout - 3) / 2; /* lose the tail and CR LF */
+      if(faultHIT(slot, F_GARB))
+        {
+        n = 1 + (int)(frand() * 4);
+        i1 = (int)(frand() * (nout - 2)); /* anywhere before CR LF */
+        memmove(&out[i1 + n], &out[i1], nout - i1);
+        for(nout += n; n > 0; n--)
+          {
+          do out[i1 + n - 1] = (unsigned char)(frand() * 256); while((out[i1 + n - 1] == '\r') || (out[i1 + n - 1] == '\n'));
+          }
+        }
+      }
+    else nout = sprintf(out, "%c\r\n", ACK);
+    attnSET(tnow);
+    simSEND(out, nout);
+    return;
+    }
+
+  if(pm->tready != 0)
+    {
+    /* still holding a response */
+    nout = sprintf(out, "%c\r\n", NAK);
+    simSEND(out, nout);
+    return;
+    }
+
+  if(faultHIT(slot, F_MUTE)) return;
+  if(faultHIT(slot, F_NAK))
+    {
+    nout = sprintf(out, "%c\r\n", NAK);
+    simSEND(out, nout);
+    return;
+    }
+
+  /* TICKET [SUBMODULE#] command */
+  nw = 0;
+  for(w[nw] = strtok(txt, " \t\r"); (w[nw] != NULL) && (nw < L256 - 1); w[nw] = strtok(NULL, " \t\r")) nw++;
+  if(nw < 2) return;
+  tkt = w[0];
+  ism = 0;
+  if(pm->nsm > 1)
+    {
+    if((nw < 3) || !isdigit(w[1][0]))
+      {
+      /* SM is addressed to the module, not a submodule */
+      if(strcasecmp(w[1], "SM") != 0) return;
+      }
+    else
+      {
+      ism = atoi(w[1]);
+      if(ism >= pm->nsm) return;
+      memmove(&w[1], &w[2], (nw - 2) * sizeof(char *));
+      nw--;
+      }
+    }
+  modCMD(pm, &pm->lu[ism], ism, tkt, &w[1], nw - 1, pm->rsp);
+  pm->tready = tnow + attn_us;
+  if(faultHIT(slot, F_DELAY)) pm->tready += fault_delay[slot] * 1000LL;
+  if(faultHIT(slot, F_NOATTN)) pm->tready = 0; /* the module lost it */
+  attnSET(tnow);
+  nout = sprintf(out, "%c\r\n", ACK);
+  simSEND(out, nout);
+  }
+
+
+/* ======================================================================================
+ *
+ * Create the pty in raw mode, return its name
+ *
+ * ======================================================================================
+ */
+char *ptyOPEN(void)
+  {
+  struct termios tio;
+  char *name;
+  int fd;
+
+  ptm = posix_openpt(O_RDWR | O_NOCTTY);
+  if((ptm < 0) || (grantpt(ptm) != 0) || (unlockpt(ptm) != 0)) return NULL;
+  name = ptsname(ptm);
+  if(name == NULL) return NULL;
+
+  /* raw line; the slave stays open so the pty lives on when the server closes it */
+  fd = open(name, O_RDWR | O_NOCTTY);
+  if(fd < 0) return NULL;
+  tcgetattr(fd, &tio);
+  cfmakeraw(&tio);
+  tcsetattr(fd, TCSANOW, &tio);
+  return name;
+  }
+
+
+/* ======================================================================================
+ *
+ * Create and map the GPIO register file
+ *
+ * ======================================================================================
+ */
+int gpioOPEN(char *fname)
+  {
+  int fd;
+
+  fd = open(fname, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if(fd < 0) return -1;
+  if(ftruncate(fd, 4096) != 0)
+    {
+    close(fd);
+    return -1;
+    }
+  gpio = (volatile uint32_t *)mmap(NULL, 4096, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if(gpio == MAP_FAILED) return -1;
+  return 0;
+  }
+
+
+int main(int argc, char *argv[])
+  {
+  unsigned char buf[L4096];
+  struct pollfd pfd;
+  long long tnow, tnext;
+  char *spec = "1:1461N", *gfile = "/tmp/i2lchv_gpio", *link = NULL, *name, *ps1, *ps2;
+  char s1[L256];
+  int opt, len = 0, n, i1, slot, tmo;
+
+  while((opt = getopt(argc, argv, "c:g:l:A:x:R:C:S:f:F:Vv")) != -1)
+    {
+    switch(opt)
+      {
+      case 'c': spec = optarg; break;
+      case 'g': gfile = optarg; break;
+      case 'l': link = optarg; break;
+      case 'A': attn_us = atoll(optarg); break;
+      case 'x': sim_scale = atof(optarg); break;
+      case 'R': sim_load = atof(optarg); break;
+      case 'C': sim_cap = atof(optarg); break;
+      case 'S': sim_rng = strtoull(optarg, NULL, 0) | 1; break;
+      case 'f':
+        if(faultSPEC(optarg) != 0)
+          {
+          printf("bad fault specification %s (SLOT:FAULT=RATE,...;...)\n", optarg);
+          exit(1);
+          }
+        break;
+      case 'F': fault_rng = strtoull(optarg, NULL, 0) | 1; break;
+      case 'V': sim_virtual = 1; break;
+      case 'v': verbose = 1; break;
+      default:
+        printf("usage: %s [-c SLOT:TYPE,...] [-g gpio-file] [-l pty-link] [-A attn-us] [-x scale] [-R MOhm] [-C nF] [-S seed] [-f faults] [-F seed] [-V] [-v]\n", argv[0]);
+        exit(1);
+      }
+    }
+
+  /* the crate */
+  strncpy(s1, spec, L256 - 1);
+  s1[L256 - 1] = '\0';
+  for(ps1 = strtok(s1, ","); ps1 != NULL; ps1 = strtok(NULL, ","))
+    {
+    ps2 = strchr(ps1, ':');
+    slot = atoi(ps1);
+    if((ps2 == NULL) || (modNEW(slot, ps2 + 1) != 0))
+      {
+      printf("bad module %s (SLOT:TYPE, TYPE 1461N/P, 1469N/P or 1471N/P)\n", ps1);
+      exit(1);
+      }
+    }
+
+  if(gpioOPEN(gfile) != 0)
+    {
+    printf("can't create GPIO file %s: %s\n", gfile, strerror(errno));
+    exit(1);
+    }
+  sim_t0 = usnow();
+  attnSET(sim_t0);
+  name = ptyOPEN();
+  if(name == NULL)
+    {
+    printf("can't create pty: %s\n", strerror(errno));
+    exit(1);
+    }
+  if(link != NULL)
+    {
+    unlink(link);
+    if(symlink(name, link) != 0)
+      {
+      printf("can't link %s: %s\n", link, strerror(errno));
+      exit(1);
+      }
+    }
+  printf("%s\n", name);
+  fflush(stdout);
+
+  signal(SIGUSR1, faultSIG);
+  pfd.fd = ptm;
+  pfd.events = POLLIN;
+  for(;;)
+    {
+    if(fault_dump)
+      {
+      fault_dump = 0;
+      faultPRINT();
+      }
+    /* sleep until the next frame or the next module ready with its response */
+    tnow = usnow();
+    tnext = 0;
+    for(slot = 0; slot < nSLOTS; slot++)
+      {
+      if((crate[slot] == NULL) || (crate[slot]->tready <= tnow)) continue;
+      if((tnext == 0) || (crate[slot]->tready < tnext)) tnext = crate[slot]->tready;
+      }
+    tmo = ((tnext == 0) || sim_virtual) ? -1 : (int)((tnext - tnow + 999) / 1000);
+    n = poll(&pfd, 1, tmo);
+    tnow = usnow();
+    attnSET(tnow);
+    if(n <= 0) continue;
+
+    n = read(ptm, &buf[len], L4096 - len);
+    if(n <= 0)
+      {
+      usleep(10000); /* no server on the other side */
+      continue;
+      }
+    len = len + n;
+    for(;;)
+      {
+      for(i1 = 0; (i1 < len) && (buf[i1] != '\n'); i1++);
+      if(i1 == len) break;
+      simFRAME(buf, i1, tnow);
+      sim_nframe++;
+      __atomic_store_n((volatile int64_t *)&gpio[GPIO_VBYTE], sim_nbyte, __ATOMIC_RELEASE);
+      __atomic_store_n((volatile int64_t *)&gpio[GPIO_VFRAME], sim_nframe, __ATOMIC_RELEASE);
+      memmove(buf, &buf[i1 + 1], len - i1 - 1);
+      len = len - i1 - 1;
+      }
+    if(len == L4096) len = 0; /* garbage */
+    }
+  return 0;
+  }